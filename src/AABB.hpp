@@ -2,6 +2,7 @@
 #define AABB_HPP_
 
 #include "./rtCommon.hpp"
+#include "./stats.hpp"
 
 //Axis aligned bounding box
 class AABB {
@@ -21,6 +22,7 @@ class AABB {
     }
 
     inline bool hit(const Ray& r, float tmin, float tmax) const {
+        RT_COUNT(AABBTests);
         //Using the slab method:
         //compute (tx0, tx1)
         //compute (ty0, ty1)
@@ -42,7 +44,7 @@ class AABB {
         //Y
         t0 = fmin((_min.getY() - r.origin().getY()) / r.direction().getY(),
                                (_max.getY() - r.origin().getY()) / r.direction().getY());
-        t1 = fmax((_min.getX() - r.origin().getY()) / r.direction().getY(),
+        t1 = fmax((_min.getY() - r.origin().getY()) / r.direction().getY(),
                                (_max.getY() - r.origin().getY()) / r.direction().getY());
         tmin = fmax(t0, tmin);
         tmax = fmin(t1, tmax);
@@ -51,7 +53,7 @@ class AABB {
         //Z
         t0 = fmin((_min.getZ() - r.origin().getZ()) / r.direction().getZ(),
                                (_max.getZ() - r.origin().getZ()) / r.direction().getZ());
-        t1 = fmax((_min.getX() - r.origin().getZ()) / r.direction().getZ(),
+        t1 = fmax((_min.getZ() - r.origin().getZ()) / r.direction().getZ(),
                                (_max.getZ() - r.origin().getZ()) / r.direction().getZ());
         tmin = fmax(t0, tmin);
         tmax = fmin(t1, tmax);
@@ -67,6 +69,10 @@ class AABB {
 
 };
 
+inline float component(const Vector3& v, int axis) {
+    return axis == 0 ? v.getX() : axis == 1 ? v.getY() : v.getZ();
+}
+
 //create the bounding box comprised of 2 boxes
 AABB surroundingBox(AABB box0, AABB box1){
     Vector3 small(fmin(box0.min().getX(), box1.min().getX()),
@@ -2,6 +2,18 @@
 #define XYRECT_HPP_
 #include "./rtCommon.hpp"
 #include "./geometry.hpp"
+#include "./stats.hpp"
+
+//solid angle pdf of picking a point uniformly on a rectangle of the given area, seen along toPoint from its origin
+inline float rectSolidAnglePdf(const Vector3& toPoint, const Vector3& normal, float area) {
+    float distanceSquared = toPoint.vecLengthSquared();
+    float cosine = fabs(toPoint.dotProduct(normal)) / sqrt(distanceSquared);
+    //seen edge on, the rectangle covers no solid angle
+    if (cosine < 1e-6) {
+        return 0;
+    }
+    return distanceSquared / (cosine * area);
+}
 
 //axis aligned rectangle on the xy plane
 class XYRect : public Geometry {
@@ -11,7 +23,28 @@ class XYRect : public Geometry {
     XYRect(float _x0, float _x1, float _y0, float _y1, float _k, shared_ptr<Material> mat) 
     :x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat){};
 
-    virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const override;
+    virtual bool closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const override;
+    virtual void surfaceHit(const Ray& ray, const HitCandidate& candidate, hitRecord& rec) const override;
+    virtual shared_ptr<Material> material() const override { return mp; }
+    virtual bool sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const override;
+    virtual float directionPdf(const Vector3& origin, const Vector3& direction) const override;
+    virtual float surfaceArea() const override { return (x1-x0)*(y1-y0); }
+    virtual bool surfacePoint(float u, float v, Vector3& p) const override {
+        p = Vector3(x0 + u*(x1-x0), y0 + v*(y1-y0), k);
+        return true;
+    }
+    virtual void surfaceExtent(float& uLength, float& vLength, bool& wrapU) const override {
+        uLength = x1-x0;
+        vLength = y1-y0;
+        wrapU = false;
+    }
+    virtual void setMaterial(shared_ptr<Material> m) override { mp = m; }
+    //light leaves both faces
+    virtual void normalCone(Vector3& axis, float& cosTheta, bool& twoSided) const override {
+        axis = Vector3(0, 0, 1);
+        cosTheta = 1;
+        twoSided = true;
+    }
 
     virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override {
         //BB must have x, y, and z be > 0, so pad the z dimension a small amount
@@ -24,7 +57,8 @@ class XYRect : public Geometry {
     float x0, x1, y0, y1, k;
 };
 
-bool XYRect::hit(const Ray& r, float t0, float t1, hitRecord& rec) const {
+bool XYRect::closestHit(const Ray& r, float t0, float t1, HitCandidate& candidate) const {
+    RT_COUNT(XYRectTests);
     auto t = (k-r.origin().getZ()) / r.direction().getZ();
     if (t < t0 || t > t1) {
         return false;
@@ -34,14 +68,38 @@ bool XYRect::hit(const Ray& r, float t0, float t1, hitRecord& rec) const {
     if(x < x0 || x > x1 || y < y0 || y > y1) {
         return false;
     }
+    candidate.t = t;
+    candidate.object = this;
+    return true;
+}
+
+void XYRect::surfaceHit(const Ray& r, const HitCandidate& candidate, hitRecord& rec) const {
+    auto t = candidate.t;
+    auto x = r.origin().getX() + t*r.direction().getX();
+    auto y = r.origin().getY() + t*r.direction().getY();
     rec.u = (x-x0)/(x1-x0);
     rec.v = (y-y0)/(y1-y0);
     rec.t = t;
     auto outwardNormal = Vector3(0, 0, 1);
     rec.setFaceNormal(r, outwardNormal);
     rec.matPtr = mp;
+    rec.object = this;
     rec.p = r.pointAtParameter(t);
-    return true;
+}
+
+bool XYRect::sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const {
+    Vector3 toPoint = Vector3(x0 + u1*(x1-x0), y0 + u2*(y1-y0), k) - origin;
+    pdf = rectSolidAnglePdf(toPoint, Vector3(0, 0, 1), (x1-x0)*(y1-y0));
+    direction = unitVector(toPoint);
+    return pdf > 0;
+}
+
+float XYRect::directionPdf(const Vector3& origin, const Vector3& direction) const {
+    HitCandidate candidate;
+    if (!closestHit(Ray(origin, direction), 0.001, infinity, candidate)) {
+        return 0;
+    }
+    return rectSolidAnglePdf(direction*candidate.t, Vector3(0, 0, 1), (x1-x0)*(y1-y0));
 }
 
 //axis aligned rectangle on the XZ plane 
@@ -52,7 +110,28 @@ class XZRect : public Geometry {
     XZRect(float _x0, float _x1, float _z0, float _z1, float _k, shared_ptr<Material> mat) 
     :x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat){};
 
-    virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const override;
+    virtual bool closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const override;
+    virtual void surfaceHit(const Ray& ray, const HitCandidate& candidate, hitRecord& rec) const override;
+    virtual shared_ptr<Material> material() const override { return mp; }
+    virtual bool sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const override;
+    virtual float directionPdf(const Vector3& origin, const Vector3& direction) const override;
+    virtual float surfaceArea() const override { return (x1-x0)*(z1-z0); }
+    virtual bool surfacePoint(float u, float v, Vector3& p) const override {
+        p = Vector3(x0 + u*(x1-x0), k, z0 + v*(z1-z0));
+        return true;
+    }
+    virtual void surfaceExtent(float& uLength, float& vLength, bool& wrapU) const override {
+        uLength = x1-x0;
+        vLength = z1-z0;
+        wrapU = false;
+    }
+    virtual void setMaterial(shared_ptr<Material> m) override { mp = m; }
+    //light leaves both faces
+    virtual void normalCone(Vector3& axis, float& cosTheta, bool& twoSided) const override {
+        axis = Vector3(0, 1, 0);
+        cosTheta = 1;
+        twoSided = true;
+    }
 
     virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override {
         //BB must have x, y, and z be > 0, so pad the y dimension a small amount
@@ -65,7 +144,8 @@ class XZRect : public Geometry {
     float x0, x1, z0, z1, k;
 };
 
-bool XZRect::hit(const Ray& r, float t0, float t1, hitRecord& rec) const {
+bool XZRect::closestHit(const Ray& r, float t0, float t1, HitCandidate& candidate) const {
+    RT_COUNT(XZRectTests);
     auto t = (k-r.origin().getY()) / r.direction().getY();
     if (t < t0 || t > t1) {
         return false;
@@ -75,14 +155,38 @@ bool XZRect::hit(const Ray& r, float t0, float t1, hitRecord& rec) const {
     if(x < x0 || x > x1 || z < z0 || z > z1) {
         return false;
     }
+    candidate.t = t;
+    candidate.object = this;
+    return true;
+}
+
+void XZRect::surfaceHit(const Ray& r, const HitCandidate& candidate, hitRecord& rec) const {
+    auto t = candidate.t;
+    auto x = r.origin().getX() + t*r.direction().getX();
+    auto z = r.origin().getZ() + t*r.direction().getZ();
     rec.u = (x-x0)/(x1-x0);
     rec.v = (z-z0)/(z1-z0);
     rec.t = t;
     auto outwardNormal = Vector3(0, 1, 0);
     rec.setFaceNormal(r, outwardNormal);
     rec.matPtr = mp;
+    rec.object = this;
     rec.p = r.pointAtParameter(t);
-    return true;
+}
+
+bool XZRect::sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const {
+    Vector3 toPoint = Vector3(x0 + u1*(x1-x0), k, z0 + u2*(z1-z0)) - origin;
+    pdf = rectSolidAnglePdf(toPoint, Vector3(0, 1, 0), (x1-x0)*(z1-z0));
+    direction = unitVector(toPoint);
+    return pdf > 0;
+}
+
+float XZRect::directionPdf(const Vector3& origin, const Vector3& direction) const {
+    HitCandidate candidate;
+    if (!closestHit(Ray(origin, direction), 0.001, infinity, candidate)) {
+        return 0;
+    }
+    return rectSolidAnglePdf(direction*candidate.t, Vector3(0, 1, 0), (x1-x0)*(z1-z0));
 }
 
 //axis aligned rectangle on the XZ plane 
@@ -93,7 +197,28 @@ class ZYRect : public Geometry {
     ZYRect(float _y0, float _y1, float _z0, float _z1, float _k, shared_ptr<Material> mat) 
     :y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat){};
 
-    virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const override;
+    virtual bool closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const override;
+    virtual void surfaceHit(const Ray& ray, const HitCandidate& candidate, hitRecord& rec) const override;
+    virtual shared_ptr<Material> material() const override { return mp; }
+    virtual bool sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const override;
+    virtual float directionPdf(const Vector3& origin, const Vector3& direction) const override;
+    virtual float surfaceArea() const override { return (z1-z0)*(y1-y0); }
+    virtual bool surfacePoint(float u, float v, Vector3& p) const override {
+        p = Vector3(k, y0 + u*(y1-y0), z0 + v*(z1-z0));
+        return true;
+    }
+    virtual void surfaceExtent(float& uLength, float& vLength, bool& wrapU) const override {
+        uLength = y1-y0;
+        vLength = z1-z0;
+        wrapU = false;
+    }
+    virtual void setMaterial(shared_ptr<Material> m) override { mp = m; }
+    //light leaves both faces
+    virtual void normalCone(Vector3& axis, float& cosTheta, bool& twoSided) const override {
+        axis = Vector3(1, 0, 0);
+        cosTheta = 1;
+        twoSided = true;
+    }
 
     virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override {
         //BB must have x, y, and z be > 0, so pad the x dimension a small amount
@@ -106,7 +231,8 @@ class ZYRect : public Geometry {
     float y0, y1, z0, z1, k;
 };
 
-bool ZYRect::hit(const Ray& r, float t0, float t1, hitRecord& rec) const {
+bool ZYRect::closestHit(const Ray& r, float t0, float t1, HitCandidate& candidate) const {
+    RT_COUNT(ZYRectTests);
     auto t = (k-r.origin().getX()) / r.direction().getX();
     if (t < t0 || t > t1) {
         return false;
@@ -116,14 +242,38 @@ bool ZYRect::hit(const Ray& r, float t0, float t1, hitRecord& rec) const {
     if(y < y0 || y > y1 || z < z0 || z > z1) {
         return false;
     }
+    candidate.t = t;
+    candidate.object = this;
+    return true;
+}
+
+void ZYRect::surfaceHit(const Ray& r, const HitCandidate& candidate, hitRecord& rec) const {
+    auto t = candidate.t;
+    auto y = r.origin().getY() + t*r.direction().getY();
+    auto z = r.origin().getZ() + t*r.direction().getZ();
     rec.u = (y-y0)/(y1-y0);
     rec.v = (z-z0)/(z1-z0);
     rec.t = t;
     auto outwardNormal = Vector3(1, 0, 0);
     rec.setFaceNormal(r, outwardNormal);
     rec.matPtr = mp;
+    rec.object = this;
     rec.p = r.pointAtParameter(t);
-    return true;
+}
+
+bool ZYRect::sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const {
+    Vector3 toPoint = Vector3(k, y0 + u1*(y1-y0), z0 + u2*(z1-z0)) - origin;
+    pdf = rectSolidAnglePdf(toPoint, Vector3(1, 0, 0), (y1-y0)*(z1-z0));
+    direction = unitVector(toPoint);
+    return pdf > 0;
+}
+
+float ZYRect::directionPdf(const Vector3& origin, const Vector3& direction) const {
+    HitCandidate candidate;
+    if (!closestHit(Ray(origin, direction), 0.001, infinity, candidate)) {
+        return 0;
+    }
+    return rectSolidAnglePdf(direction*candidate.t, Vector3(1, 0, 0), (y1-y0)*(z1-z0));
 }
 
 
@@ -0,0 +1,199 @@
+#ifndef ANIMATION_HPP_
+#define ANIMATION_HPP_
+
+#include "./rtCommon.hpp"
+#include "./logeometry.hpp"
+#include "./bvh.hpp"
+#include "./movingSphere.hpp"
+#include "./scenes.hpp"
+#include "./render.hpp"
+#include "./color.hpp"
+#include "./denoise.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+//where the camera is at a given frame
+struct CameraKey {
+    float frame;
+    Vector3 lookfrom;
+    Vector3 lookat;
+    float vfov;
+};
+
+//camera keyframes, linearly interpolated between neighbouring keys
+class CameraPath {
+    public:
+    CameraPath(){}
+
+    //keys must be added in frame order
+    void add(const CameraKey& key) { keys.push_back(key); }
+
+    CameraKey at(float frame) const {
+        if (frame <= keys.front().frame) {
+            return keys.front();
+        }
+        if (frame >= keys.back().frame) {
+            return keys.back();
+        }
+        size_t next = 1;
+        while (keys[next].frame < frame) {
+            next++;
+        }
+        const CameraKey& a = keys[next-1];
+        const CameraKey& b = keys[next];
+        float s = (frame - a.frame) / (b.frame - a.frame);
+        return CameraKey{frame,
+            a.lookfrom + (b.lookfrom - a.lookfrom)*s,
+            a.lookat + (b.lookat - a.lookat)*s,
+            a.vfov + (b.vfov - a.vfov)*s};
+    }
+
+    std::vector<CameraKey> keys;
+};
+
+//a path that circles the camera once around lookat, keeping its height
+CameraPath orbitPath(Vector3 lookfrom, Vector3 lookat, float vfov, int frames) {
+    CameraPath path;
+    Vector3 offset = lookfrom - lookat;
+    float radius = sqrt(offset.getX()*offset.getX() + offset.getZ()*offset.getZ());
+    float start = atan2(offset.getZ(), offset.getX());
+    //one key per frame, so the linear interpolation never cuts across the circle
+    for (int f = 0; f <= frames; f++) {
+        float angle = start + 2*pi*f / frames;
+        Vector3 from = lookat + Vector3(radius*cos(angle), offset.getY(), radius*sin(angle));
+        path.add(CameraKey{static_cast<float>(f), from, lookat, vfov});
+    }
+    return path;
+}
+
+//moves one object of the scene from frame to frame
+class ObjectTrack {
+    public:
+    virtual ~ObjectTrack(){}
+    //move the object to where it is during frame, with the shutter open for the given fraction of the frame
+    //return false if the object did not move, so the BVH above it can be left alone
+    virtual bool update(float frame, float shutter) = 0;
+    virtual const Geometry* object() const = 0;
+};
+
+//a moving sphere follows position(frame) and is motion blurred over the time the shutter is open
+class MovingSphereTrack : public ObjectTrack {
+    public:
+    MovingSphereTrack(shared_ptr<MovingSphere> s, std::function<Vector3(float)> p) : sphere(s), position(p) {}
+
+    virtual bool update(float frame, float shutter) override {
+        Vector3 c0 = position(frame);
+        Vector3 c1 = position(frame + shutter);
+        if ((c0 - sphere->center0).vecLengthSquared() == 0 && (c1 - sphere->center1).vecLengthSquared() == 0) {
+            return false;
+        }
+        //camera rays carry times in [0, 1) within a frame
+        sphere->center0 = c0;
+        sphere->center1 = c1;
+        sphere->time0 = 0;
+        sphere->time1 = 1;
+        return true;
+    }
+
+    virtual const Geometry* object() const override { return sphere.get(); }
+
+    shared_ptr<MovingSphere> sphere;
+    std::function<Vector3(float)> position;
+};
+
+struct SequenceSettings {
+    int frames = 24;
+    //fraction of a frame the shutter stays open for
+    float shutter = 0.5;
+    //frames are written as <outputPrefix>0000.ppm, <outputPrefix>0001.ppm, ...
+    std::string outputPrefix = "frame";
+};
+
+std::string frameFileName(const std::string& prefix, int frame) {
+    char number[16];
+    snprintf(number, sizeof(number), "%04d", frame);
+    return prefix + number + ".ppm";
+}
+
+//renders a sequence of frames from one scene
+//the scene, its textures and noise tables and the BVH are built once and stay resident,
+//each frame only moves the tracked objects, refits the BVH above them and moves the camera
+class SequenceRenderer {
+    public:
+    SequenceRenderer(const Scene& s) : scene(s), lights(s.objects) {
+        ArenaScope scope(scene.arena);
+        LoGeometry objects = scene.objects;
+        bvh = makeSceneObject<BVHNode>(objects, 0.0, 1.0);
+    }
+
+    void addTrack(shared_ptr<ObjectTrack> track) { tracks.push_back(track); }
+
+    //render every frame, encoding frame N on another thread while frame N+1 renders
+    void render(const CameraPath& path, const RenderSettings& settings, const SequenceSettings& sequence) {
+        //two frames in flight: one being rendered, one being encoded
+        FrameBuffer buffers[2];
+        AuxBuffers aux;
+        DenoiseSettings denoiseSettings;
+        denoiseSettings.threads = settings.threads;
+        std::future<bool> encoding[2];
+        auto start = std::chrono::steady_clock::now();
+
+        for (int frame = 0; frame < sequence.frames; frame++) {
+            int slot = frame % 2;
+            TraceScope trace("frame");
+            trace.arg("frame", frame);
+            if (encoding[slot].valid()) {
+                encoding[slot].get();
+            }
+
+            std::unordered_set<const Geometry*> dirty;
+            for (auto& track : tracks) {
+                if (track->update(frame, sequence.shutter)) {
+                    dirty.insert(track->object());
+                }
+            }
+            if (!dirty.empty()) {
+                bvh->refit(dirty, 0.0, 1.0);
+            }
+
+            CameraKey key = path.at(frame);
+            Camera cam = scene.camera(key.lookfrom, key.lookat, key.vfov);
+            if (settings.denoise) {
+                renderFrame(*bvh, lights, cam, settings, buffers[slot], &aux);
+                buffers[slot] = denoise(buffers[slot], aux, denoiseSettings);
+            }
+            else {
+                renderFrame(*bvh, lights, cam, settings, buffers[slot]);
+            }
+            std::cerr << "\rFrame " << frame + 1 << "/" << sequence.frames << " rendered" << std::endl;
+
+            std::string fileName = frameFileName(sequence.outputPrefix, frame);
+            const FrameBuffer& image = buffers[slot];
+            encoding[slot] = std::async(std::launch::async, [fileName, &image]() {
+                return writeImage(fileName, image);
+            });
+        }
+        for (auto& pending : encoding) {
+            if (pending.valid()) {
+                pending.get();
+            }
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << sequence.frames << " frames in " << elapsed.count() << "s ("
+                  << sequence.frames * 3600.0 / elapsed.count() << " frames/hour)\n";
+    }
+
+    const Scene& scene;
+    LightList lights;
+    shared_ptr<BVHNode> bvh;
+    std::vector<shared_ptr<ObjectTrack>> tracks;
+};
+
+#endif /* ANIMATION_HPP_*/
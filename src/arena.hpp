@@ -0,0 +1,144 @@
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include "./rtCommon.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <tuple>
+#include <typeindex>
+#include <utility>
+#include <vector>
+
+//bump allocator: hands out memory from large chunks in order and only ever frees it all at once
+class Arena {
+    public:
+    static constexpr size_t chunkSize = 1 << 20;
+
+    Arena() {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment) {
+        size_t offset = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        if (!cursor || offset + size > static_cast<size_t>(end - cursor)) {
+            //anything bigger than a chunk gets a chunk of its own
+            size_t capacity = std::max(chunkSize, size + alignment);
+            chunks.emplace_back(new char[capacity]);
+            cursor = chunks.back().get();
+            end = cursor + capacity;
+            offset = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        }
+        void* result = cursor + offset;
+        cursor += offset + size;
+        allocations++;
+        bytes += size;
+        return result;
+    }
+
+    size_t allocations = 0;
+    size_t bytes = 0;
+    std::vector<std::unique_ptr<char[]>> chunks;
+
+    private:
+    char* cursor = nullptr;
+    char* end = nullptr;
+};
+
+//the memory a scene's objects live in, one arena per object type so that objects of a type (all the spheres,
+//all the BVH nodes) sit next to each other in the order they were made
+class SceneArena {
+    public:
+    template <typename T>
+    Arena& pool() {
+        auto found = pools.find(std::type_index(typeid(T)));
+        if (found == pools.end()) {
+            found = pools.emplace(std::piecewise_construct, std::forward_as_tuple(typeid(T)), std::forward_as_tuple()).first;
+        }
+        return found->second;
+    }
+
+    size_t allocations() const {
+        size_t count = 0;
+        for (const auto& pool : pools) {
+            count += pool.second.allocations;
+        }
+        return count;
+    }
+
+    size_t chunks() const {
+        size_t count = 0;
+        for (const auto& pool : pools) {
+            count += pool.second.chunks.size();
+        }
+        return count;
+    }
+
+    size_t bytes() const {
+        size_t count = 0;
+        for (const auto& pool : pools) {
+            count += pool.second.bytes;
+        }
+        return count;
+    }
+
+    private:
+    std::map<std::type_index, Arena> pools;
+};
+
+//allocator for std::allocate_shared that places an object and its reference count next to each other in an
+//arena, deallocating does nothing, the memory goes when the last object holding the arena does
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator(shared_ptr<SceneArena> owner, Arena* pool) : owner(std::move(owner)), pool(pool) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : owner(other.owner), pool(other.pool) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(pool->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return pool == other.pool; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return pool != other.pool; }
+
+    shared_ptr<SceneArena> owner;
+    Arena* pool;
+};
+
+//the arena scene objects made on this thread go into, none makes them with make_shared as usual
+inline shared_ptr<SceneArena>& currentSceneArena() {
+    thread_local shared_ptr<SceneArena> arena;
+    return arena;
+}
+
+//places scene objects made on this thread in arena until it goes out of scope
+class ArenaScope {
+    public:
+    ArenaScope(shared_ptr<SceneArena> arena) : previous(currentSceneArena()) {
+        currentSceneArena() = std::move(arena);
+    }
+    ~ArenaScope() {
+        currentSceneArena() = previous;
+    }
+
+    private:
+    shared_ptr<SceneArena> previous;
+};
+
+//make_shared for scene objects: primitives, materials, textures and BVH nodes go into the current scene arena
+template <typename T, typename... Args>
+shared_ptr<T> makeSceneObject(Args&&... args) {
+    const shared_ptr<SceneArena>& arena = currentSceneArena();
+    if (!arena) {
+        return make_shared<T>(std::forward<Args>(args)...);
+    }
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena, &arena->pool<T>()), std::forward<Args>(args)...);
+}
+
+#endif /* ARENA_HPP_*/
@@ -0,0 +1,82 @@
+#ifndef BAKE_HPP_
+#define BAKE_HPP_
+
+#include "./rtCommon.hpp"
+#include "./scenes.hpp"
+#include "./material.hpp"
+#include "./texture.hpp"
+#include "./threading.hpp"
+#include "./trace.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+//procedural textures (checkers, perlin turbulence) are worked out from the hit point on every lookup, which at
+//hundreds of samples per pixel repeats the same trig and noise for the same bit of surface over and over
+//baking evaluates them once per texel in each primitive's uv space and swaps in a BakedTexture
+struct BakeSettings {
+    //texel density on the surface
+    float texelsPerUnit = 64;
+    //surfaces that would need more texels than this along u or v stay procedural
+    //(the ground sphere of radius 1000 would need 400k)
+    int maxResolution = 4096;
+    //0 uses every hardware thread
+    int threads = 0;
+};
+
+struct BakeReport {
+    int baked = 0;
+    //procedural textures left as they were, on surfaces too big or without a uv mapping to bake into
+    int skipped = 0;
+    size_t texels = 0;
+};
+
+//bake the procedural albedo of every Lambertian primitive in scene that has a uv mapping, each primitive
+//gets its own copy of the material, so primitives sharing a texture keep their own baked grid
+BakeReport bakeTextures(Scene& scene, const BakeSettings& settings) {
+    TraceScope trace("bake textures", "setup");
+    BakeReport report;
+    int threadCount = settings.threads > 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    ArenaScope scope(scene.arena);
+    for (auto& object : scene.objects.objects) {
+        shared_ptr<Material> material = object->material();
+        if (!material || material->kind() != MaterialKind::Lambertian) {
+            continue;
+        }
+        const Lambertian& lambertian = static_cast<const Lambertian&>(*material);
+        if (!lambertian.albedo->isProcedural()) {
+            continue;
+        }
+        float uLength, vLength;
+        bool wrapU;
+        object->surfaceExtent(uLength, vLength, wrapU);
+        int width = static_cast<int>(ceil(uLength * settings.texelsPerUnit));
+        int height = static_cast<int>(ceil(vLength * settings.texelsPerUnit));
+        Vector3 p;
+        if (width <= 0 || height <= 0 || width > settings.maxResolution || height > settings.maxResolution
+            || !object->surfacePoint(0.5, 0.5, p)) {
+            report.skipped++;
+            continue;
+        }
+
+        auto baked = makeSceneObject<BakedTexture>(width, height, wrapU);
+        const Texture& source = *lambertian.albedo;
+        const Geometry& surface = *object;
+        forEachRow(height, threadCount, [&](int y) {
+            float v = (y + 0.5f) / height;
+            for (int x = 0; x < width; x++) {
+                float u = (x + 0.5f) / width;
+                Vector3 point;
+                surface.surfacePoint(u, v, point);
+                baked->texels[y*width + x] = source.value(u, v, point);
+            }
+        });
+        object->setMaterial(makeSceneObject<Lambertian>(baked));
+        report.baked++;
+        report.texels += size_t(width) * height;
+    }
+    return report;
+}
+
+#endif /* BAKE_HPP_*/
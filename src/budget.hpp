@@ -0,0 +1,213 @@
+#ifndef BUDGET_HPP_
+#define BUDGET_HPP_
+
+#include "./rtCommon.hpp"
+#include "./render.hpp"
+#include "./threading.hpp"
+#include "./trace.hpp"
+#include "./perfCounters.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+//rendering to a wall clock deadline instead of a fixed number of samples per pixel
+//the frame is rendered in progressive passes: uniform ones first, timed to learn how many samples a second the
+//scene takes, then passes that hand each pixel samples by how noisy it still is, each sized to a share of the
+//time left, the last one to the time left itself
+//a pass stops taking new rows once the deadline is reached, so a misjudged pass ends on time with every pixel
+//holding whole samples, and the image is each pixel's mean over however many it got
+struct BudgetSettings {
+    //wall clock seconds for the frame, from the call to renderWithBudget
+    double seconds = 10;
+    //samples every pixel gets before noise decides where the rest go, enough for a variance estimate
+    int uniformSamples = 4;
+    //each pass but the last is planned to take this share of the time left, more passes steer samples better
+    //but each has to wait on its slowest row
+    float passShare = 0.5;
+};
+
+struct BudgetReport {
+    int passes = 0;
+    size_t samples = 0;
+    double seconds = 0;
+};
+
+//render image progressively until settings' deadline, samplesTaken is set to each pixel's sample count
+//if aux is given it is filled with the first hit buffers the denoiser needs, as renderFrame does
+BudgetReport renderWithBudget(const Geometry& scene, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    const BudgetSettings& budget, FrameBuffer& image, std::vector<float>& samplesTaken, AuxBuffers* aux = nullptr) {
+    TraceScope trace("render to budget");
+    trace.arg("milliseconds", static_cast<int64_t>(budget.seconds * 1000));
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(budget.seconds));
+    int width = settings.width;
+    int height = settings.height;
+    int pixels = width * height;
+    int threadCount = renderThreadCount(settings);
+
+    std::vector<Vector3> sum(pixels, Vector3(0, 0, 0));
+    std::vector<float> lumSum(pixels, 0);
+    std::vector<float> lumSquared(pixels, 0);
+    std::vector<int> count(pixels, 0);
+    std::vector<FirstHit> firstHitSum;
+    if (aux) {
+        firstHitSum.assign(pixels, FirstHit{Vector3(0, 0, 0), Vector3(0, 0, 0), 0});
+    }
+    //samples the current pass adds to each pixel
+    std::vector<int> extra(pixels, 0);
+    //per sample luminance variance relative to the pixel's brightness, and its 3x3 blur
+    std::vector<float> noise(pixels, 0);
+    std::vector<float> blurredNoise(pixels, 0);
+
+    auto prototype = makeSampler(settings.samplerType, settings.samplesPerPixel);
+    BudgetReport report;
+    //samples a second, measured on the passes so far
+    double rate = 0;
+
+    while (true) {
+        double remaining = std::chrono::duration<double>(deadline - Clock::now()).count();
+        //the first pass always runs, there is no image without it
+        if (report.passes > 0 && remaining <= 0) {
+            break;
+        }
+        int minCount = *std::min_element(count.begin(), count.end());
+        size_t planned = 0;
+        bool last = false;
+        if (minCount < budget.uniformSamples) {
+            //uniform passes double every pixel's samples, from 1 up to uniformSamples
+            int add = std::min(std::max(minCount, 1), budget.uniformSamples - minCount);
+            std::fill(extra.begin(), extra.end(), add);
+            planned = size_t(add) * pixels;
+        } else {
+            //a pass of at least a sample per pixel's worth of time is worth planning on its own, below that the
+            //rest of the time goes to one last pass
+            double passTime = remaining * budget.passShare;
+            if (passTime * rate < pixels) {
+                passTime = remaining;
+                last = true;
+            }
+            size_t target = static_cast<size_t>(passTime * rate);
+            if (target == 0) {
+                break;
+            }
+            for (int p = 0; p < pixels; p++) {
+                float mean = lumSum[p] / count[p];
+                float variance = count[p] > 1 ? std::max(0.0f, lumSquared[p] / count[p] - mean*mean) * count[p] / (count[p] - 1) : 0;
+                noise[p] = variance / (mean*mean + 1e-3f);
+            }
+            //a pixel whose few samples all agreed looks noiseless, borrow its neighbours' estimate
+            forEachRow(height, threadCount, [&](int y) {
+                for (int x = 0; x < width; x++) {
+                    float total = 0;
+                    int n = 0;
+                    for (int qy = std::max(0, y - 1); qy <= std::min(height - 1, y + 1); qy++) {
+                        for (int qx = std::max(0, x - 1); qx <= std::min(width - 1, x + 1); qx++) {
+                            total += noise[qy * width + qx];
+                            n++;
+                        }
+                    }
+                    blurredNoise[y * width + x] = std::max(noise[y * width + x], total / n);
+                }
+            });
+            //a sample at a pixel with n of them cuts its error by about its variance / n^2
+            double totalWeight = 0;
+            for (int p = 0; p < pixels; p++) {
+                noise[p] = (blurredNoise[p] + 1e-4f) / (float(count[p]) * count[p]);
+                totalWeight += noise[p];
+            }
+            //hand out target samples in proportion, carrying the fractions along each row, and no more than doubling
+            //a pixel's samples in one pass so a single noisy estimate can't take the whole pass
+            double carry = 0;
+            for (int p = 0; p < pixels; p++) {
+                carry += target * noise[p] / totalWeight;
+                int add = static_cast<int>(carry);
+                carry -= add;
+                extra[p] = std::min(add, count[p]);
+                planned += extra[p];
+            }
+            if (planned == 0) {
+                break;
+            }
+        }
+
+        TraceScope passTrace("budget pass");
+        passTrace.arg("pass", report.passes);
+        passTrace.arg("samples", planned);
+        auto passStart = Clock::now();
+        std::atomic<size_t> done(0);
+        bool firstPass = report.passes == 0;
+        forEachRow(height, threadCount, [&](int y) {
+            if (!firstPass && Clock::now() >= deadline) {
+                return;
+            }
+            PerfScope perf(PerfPhase::Render);
+            auto sampler = prototype->clone();
+            size_t rowSamples = 0;
+            for (int x = 0; x < width; x++) {
+                int p = y * width + x;
+                for (int k = 0; k < extra[p]; k++) {
+                    Ray r = cameraRay(cam, settings, x, y, count[p], *sampler);
+                    FirstHit firstHit;
+                    Vector3 sample = traceSample(r, scene, lights, settings, *sampler, aux ? &firstHit : nullptr);
+                    sum[p] += sample;
+                    lumSum[p] += luminance(sample);
+                    lumSquared[p] += luminance(sample) * luminance(sample);
+                    if (aux) {
+                        firstHitSum[p].albedo += firstHit.albedo;
+                        firstHitSum[p].normal += firstHit.normal;
+                        firstHitSum[p].distance += firstHit.distance;
+                    }
+                    count[p]++;
+                }
+                rowSamples += extra[p];
+            }
+            done += rowSamples;
+        });
+        double passSeconds = std::chrono::duration<double>(Clock::now() - passStart).count();
+        report.passes++;
+        report.samples += done;
+        if (passSeconds > 0 && done > 0) {
+            rate = done / passSeconds;
+        }
+        remaining = std::chrono::duration<double>(deadline - Clock::now()).count();
+        if (settings.progress) {
+            settings.progress->store(static_cast<float>(std::min(1.0, 1 - remaining / budget.seconds)));
+        }
+        if (settings.showProgress) {
+            std::cerr << "\rPass " << report.passes << ": " << done << " samples, "
+                << std::max(0.0, remaining) << "s left      " << std::flush;
+        }
+        if (last) {
+            break;
+        }
+    }
+
+    if (image.width != width || image.height != height) {
+        image = FrameBuffer(width, height);
+    }
+    if (aux && (aux->albedo.width != width || aux->albedo.height != height)) {
+        *aux = AuxBuffers(width, height);
+    }
+    samplesTaken.assign(pixels, 0);
+    for (int p = 0; p < pixels; p++) {
+        int n = count[p];
+        image.pixels[p] = sum[p] / n;
+        samplesTaken[p] = n;
+        if (aux) {
+            aux->albedo.pixels[p] = firstHitSum[p].albedo / n;
+            aux->normal.pixels[p] = firstHitSum[p].normal / n;
+            aux->depth[p] = firstHitSum[p].distance / n;
+            float mean = luminance(image.pixels[p]);
+            aux->variance[p] = n > 1 ? std::max(0.0f, lumSquared[p] / n - mean*mean) / (n - 1) : 0;
+        }
+    }
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return report;
+}
+
+#endif /* BUDGET_HPP_*/
@@ -5,6 +5,14 @@
 
 #include "./rtCommon.hpp"
 #include "./logeometry.hpp"
+#include "./arena.hpp"
+#include "./stats.hpp"
+#include "./threading.hpp"
+
+#include <array>
+#include <cstdint>
+#include <thread>
+#include <unordered_set>
 
 //Bounding Volume Hierarchy (BVH)
 //https://www.scratchapixel.com/lessons/advanced-rendering/introduction-acceleration-structure/bounding-volume-hierarchy-BVH-part1
@@ -12,111 +20,455 @@ class BVHNode : public Geometry {
     public:
         BVHNode();
 
-        BVHNode(LoGeometry& list, float time0, float time1)
-            : BVHNode(list.objects, 0, list.objects.size(), time0, time1){}
+        //threads 0 builds on every hardware thread
+        BVHNode(LoGeometry& list, float time0, float time1, int threads = 0)
+            : BVHNode(list.objects, 0, list.objects.size(), time0, time1, threads){}
 
+        //a tree over objects[start, end), built by BVHBuilder
         BVHNode(
-            std::vector<shared_ptr<Geometry>>& objects,
-            size_t start, size_t end, float time0, float time1);
+            const std::vector<shared_ptr<Geometry>>& objects,
+            size_t start, size_t end, float time0, float time1, int threads = 0);
+
+        //a node over two children whose boxes box already surrounds
+        BVHNode(shared_ptr<Geometry> left, shared_ptr<Geometry> right, const AABB& box)
+            : left(std::move(left)), right(std::move(right)), box(box) {}
 
-        virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const override;
+        virtual bool closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const override;
+        virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
         virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override;
 
+        //recompute the boxes above any object in dirty after it has moved, keeping the tree topology
+        //returns true if this node contains a dirty object
+        bool refit(const std::unordered_set<const Geometry*>& dirty, float time0, float time1);
+
         public:
             shared_ptr<Geometry> left;
             shared_ptr<Geometry> right;
             AABB box; 
 };
 
-//constructor to build BVH by randomly choosing an axis, sorting the objects, and splitting them into subtrees
-BVHNode::BVHNode(std::vector<shared_ptr<Geometry>>& objects,
-    size_t start, size_t end, float time0, float time1){
-    //get a random int representing x, y, or z axis
-    int axis = static_cast<int>(randomNum(0, 3));
-    auto comparator = (axis == 0) ? xBoxCompare
-                    : (axis == 1)? yBoxCompare
-                    : zBoxCompare;
-    
-    size_t objectSpan = end - start;
-    if(objectSpan == 1){
-        left = objects[start];
-        right = objects[start];
+//builds a BVH over a set of primitive boxes, for BVHNode and FlatScene to lay out as their own nodes
+//every primitive's box and centroid are worked out once into flat arrays, and each node splits its primitives
+//where the surface area heuristic, estimated over bins of centroids along their widest axis, is lowest
+//nodes over many primitives are split one at a time with the binning and partitioning spread over every thread,
+//below that the subtrees left are built whole, one per thread, largest first, all of it on one pool of threads
+//started with the builder
+//the tree only depends on the primitives, not on how many threads built it
+class BVHBuilder {
+    public:
+    //what the build needs of a primitive, moved along with it as nodes are split so each pass reads in order
+    struct BuildPrimitive {
+        Vector3 low;
+        Vector3 high;
+        Vector3 centroid;
+        //the i boxOf was called with
+        uint32_t index;
+    };
+
+    //a box without the AABB's copies, for the passes over every primitive
+    struct Bounds {
+        float low[3] = {infinity, infinity, infinity};
+        float high[3] = {-infinity, -infinity, -infinity};
+
+        void grow(const Vector3& lowPoint, const Vector3& highPoint) {
+            low[0] = std::min(low[0], lowPoint.getX());
+            low[1] = std::min(low[1], lowPoint.getY());
+            low[2] = std::min(low[2], lowPoint.getZ());
+            high[0] = std::max(high[0], highPoint.getX());
+            high[1] = std::max(high[1], highPoint.getY());
+            high[2] = std::max(high[2], highPoint.getZ());
+        }
+
+        void grow(const Bounds& other) {
+            for (int axis = 0; axis < 3; axis++) {
+                low[axis] = std::min(low[axis], other.low[axis]);
+                high[axis] = std::max(high[axis], other.high[axis]);
+            }
+        }
+
+        float halfArea() const {
+            float x = high[0] - low[0], y = high[1] - low[1], z = high[2] - low[2];
+            return x*y + y*z + z*x;
+        }
+
+        AABB box() const {
+            return AABB(Vector3(low[0], low[1], low[2]), Vector3(high[0], high[1], high[2]));
+        }
+    };
+
+    //an interior node over order()[start, end), split at mid along axis
+    //a subtree over k primitives has at most k - 1 interior nodes, and node slots are handed out so that each
+    //subtree owns a contiguous run of that many, its root first: the first child's node is in the next slot and the
+    //second child's (mid - start) slots on, so threads building different subtrees never share a slot
+    //a child over at most leafSize primitives is a leaf and has no node, its subtree's slots are left unused
+    struct Node {
+        Bounds bounds;
+        uint32_t start;
+        uint32_t mid;
+        uint32_t end;
+        uint32_t axis;
+    };
+
+    //boxOf(i, box) sets primitive i's box, for i in [0, count), called from every build thread at once
+    //threads 0 builds on every hardware thread
+    template <typename BoxOf>
+    BVHBuilder(size_t count, int threads, BoxOf boxOf)
+    : count(count), threadCount(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      pool(threadCount), primitives(count), scratch(count), bins(count) {
+        forEachChunk(count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                AABB box;
+                boxOf(i, box);
+                primitives[i] = BuildPrimitive{box.min(), box.max(), (box.min() + box.max()) * 0.5, static_cast<uint32_t>(i)};
+            }
+        });
     }
-    else if (objectSpan == 2) {
-        if(comparator(objects[start], objects[start+1])){
-            left = objects[start];
-            right = objects[start+1];
+
+    //split the primitives until no leaf holds more than leafSize of them
+    void build(size_t leafSize) {
+        maxLeafSize = leafSize;
+        Range whole{0, count, 0, 0};
+        std::vector<Summary> partial((count + chunkSize - 1) / chunkSize);
+        forEachChunk(count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                partial[begin / chunkSize].bounds.grow(primitives[i].low, primitives[i].high);
+                partial[begin / chunkSize].centroidBounds.grow(primitives[i].centroid, primitives[i].centroid);
+            }
+        });
+        for (const Summary& s : partial) {
+            whole.bounds.grow(s.bounds);
+            whole.centroidBounds.grow(s.centroidBounds);
+        }
+        rootBounds = whole.bounds;
+        if (count <= maxLeafSize) {
+            return;
         }
-        else {
-            right = objects[start];
-            left=objects[start+1];
+        nodes.resize(count - 1);
+
+        size_t taskSize = std::max<size_t>(4096, count / (8 * threadCount));
+        std::vector<Range> top = {whole};
+        std::vector<Range> tasks;
+        while (!top.empty()) {
+            Range range = top.back();
+            top.pop_back();
+            if (range.end - range.start <= taskSize) {
+                tasks.push_back(range);
+                continue;
+            }
+            for (const Range& child : split(range, true)) {
+                if (child.end - child.start > maxLeafSize) {
+                    top.push_back(child);
+                }
+            }
         }
+        std::sort(tasks.begin(), tasks.end(), [](const Range& a, const Range& b) {
+            return a.end - a.start > b.end - b.start;
+        });
+        pool.forEach(tasks.size(), [&](size_t i) {
+            buildSubtree(tasks[i]);
+        });
     }
-    else{
-        //Sort the primitives
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
-   
-        auto mid = start + objectSpan/2;
-        left = make_shared<BVHNode>(objects, start, mid, time0, time1);
-        right = make_shared<BVHNode>(objects, mid, end, time0, time1);
-   }
 
-   AABB boxLeft, boxRight;
+    //after build(): the primitives in tree order, every node's and leaf's a contiguous run
+    const std::vector<BuildPrimitive>& order() const { return primitives; }
+    //interior nodes by slot, the root's in slot 0, none if every primitive fits in one leaf
+    const std::vector<Node>& tree() const { return nodes; }
+    //the box around every primitive
+    const Bounds& bounds() const { return rootBounds; }
 
-   if(!left->boundingBox(time0, time1, boxLeft) || !right->boundingBox(time0, time1, boxRight))
+    private:
+    static const int binCount = 16;
+    //nodes this deep are split in half by count instead, which keeps a tree of a few billion primitives within 64
+    //levels for FlatScene's fixed size traversal stack, real scenes don't get near it
+    static const uint32_t maxBinnedDepth = 32;
+    //primitives each thread takes at a time in the parallel passes
+    static const size_t chunkSize = 16384;
 
-   std::cerr << "Must create a bounding box in BVHNode constructor\n";
+    //some primitives' boxes and centroids, and how many fall in each bin
+    struct Summary {
+        Bounds bounds;
+        Bounds centroidBounds;
+        Bounds binBounds[binCount];
+        size_t binCounts[binCount] = {};
+    };
 
-   box = surroundingBox(boxLeft, boxRight);
-    }
+    //primitives[start, end), whose node goes in slot at depth, with the box around them and around their centroids
+    struct Range {
+        size_t start = 0;
+        size_t end = 0;
+        uint32_t slot = 0;
+        uint32_t depth = 0;
+        Bounds bounds;
+        Bounds centroidBounds;
+    };
 
-bool BVHNode::hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const{
-    if(!box.hit(ray, tMin, tMax)){
-        return false;
+    //what split() works in, per chunk
+    struct SplitScratch {
+        std::vector<Summary> partial;
+        std::vector<size_t> leftCounts;
+        std::vector<size_t> leftStart;
+        std::vector<size_t> rightStart;
+        //each chunk's left and right half
+        std::vector<Range> halves;
+    };
+
+    template <typename Work>
+    void forEachChunk(size_t n, Work work) {
+        pool.forEach((n + chunkSize - 1) / chunkSize, [&](size_t chunk) {
+            work(chunk * chunkSize, std::min(n, (chunk + 1) * chunkSize));
+        });
     }
 
-    bool hitLeft = left->hit(ray, tMin, tMax, rec);
-    bool hitRight = right->hit(ray, tMin, hitLeft ? rec.t : tMax, rec);
+    //split range's primitives in two, write its node and return the two halves
+    std::array<Range, 2> split(const Range& range, bool parallel) {
+        size_t n = range.end - range.start;
+        size_t chunks = parallel ? (n + chunkSize - 1) / chunkSize : 1;
+        auto chunkBegin = [&](size_t c) {
+            return range.start + c*chunkSize;
+        };
+        auto chunkEnd = [&](size_t c) {
+            return chunks == 1 ? range.end : std::min(range.end, range.start + (c + 1)*chunkSize);
+        };
+        auto eachChunk = [&](auto work) {
+            if (chunks == 1) {
+                work(0);
+            } else {
+                pool.forEach(chunks, work);
+            }
+        };
+        Node& node = nodes[range.slot];
+        node.bounds = range.bounds;
+        node.start = range.start;
+        node.end = range.end;
+        if (n == 2) {
+            node.mid = range.start + 1;
+            node.axis = 0;
+            return {Range{range.start, range.start + 1, 0}, Range{range.start + 1, range.end, 0}};
+        }
 
-    return hitLeft || hitRight;
-}
+        int axis = 0;
+        const Bounds& centroidBounds = range.centroidBounds;
+        for (int a = 1; a < 3; a++) {
+            if (centroidBounds.high[a] - centroidBounds.low[a] > centroidBounds.high[axis] - centroidBounds.low[axis]) {
+                axis = a;
+            }
+        }
+        int bestBin = 1;
+        bool binned = centroidBounds.high[axis] > centroidBounds.low[axis] && range.depth < maxBinnedDepth;
+        //reused from node to node, a subtree's nodes are split one after another on one thread
+        //(bound to references, so the chunk workers see this thread's copies and not their own)
+        thread_local SplitScratch reused;
+        std::vector<Summary>& partial = reused.partial;
+        std::vector<size_t>& leftCounts = reused.leftCounts;
+        std::vector<size_t>& leftStart = reused.leftStart;
+        std::vector<size_t>& rightStart = reused.rightStart;
+        std::vector<Range>& halves = reused.halves;
+        if (binned) {
+            partial.assign(chunks, Summary());
+            float low = centroidBounds.low[axis];
+            float scale = binCount / (centroidBounds.high[axis] - low);
+            eachChunk([&](size_t c) {
+                Summary& s = partial[c];
+                for (size_t i = chunkBegin(c); i < chunkEnd(c); i++) {
+                    const BuildPrimitive& p = primitives[i];
+                    int bin = std::min(std::max(static_cast<int>((component(p.centroid, axis) - low) * scale), 0), binCount - 1);
+                    bins[i] = static_cast<uint8_t>(bin);
+                    s.binCounts[bin]++;
+                    s.binBounds[bin].grow(p.low, p.high);
+                }
+            });
+            Summary summary;
+            for (const Summary& s : partial) {
+                for (int b = 0; b < binCount; b++) {
+                    summary.binCounts[b] += s.binCounts[b];
+                    summary.binBounds[b].grow(s.binBounds[b]);
+                }
+            }
+            //cost of splitting before bin b: each side's area times its primitive count
+            //the first and last bins both hold a primitive, so every split has something on both sides
+            float rightCost[binCount];
+            Bounds rightBounds;
+            size_t rightCount = 0;
+            for (int b = binCount - 1; b > 0; b--) {
+                rightBounds.grow(summary.binBounds[b]);
+                rightCount += summary.binCounts[b];
+                rightCost[b] = rightCount ? rightBounds.halfArea() * rightCount : 0;
+            }
+            Bounds leftBounds;
+            size_t leftCount = 0;
+            float bestCost = infinity;
+            for (int b = 1; b < binCount; b++) {
+                leftBounds.grow(summary.binBounds[b - 1]);
+                leftCount += summary.binCounts[b - 1];
+                float cost = (leftCount ? leftBounds.halfArea() * leftCount : 0) + rightCost[b];
+                if (cost < bestCost && leftCount > 0 && leftCount < n) {
+                    bestCost = cost;
+                    bestBin = b;
+                }
+            }
+        }
 
-bool BVHNode::boundingBox(float t0, float t1, AABB& outputBox) const {
-    outputBox = box;
-    return true;
-}
+        //move the primitives in bins before bestBin to the front, keeping their order, and work out the boxes of
+        //both halves on the way, every centroid in the same place (or a node past maxBinnedDepth) is split down the
+        //middle instead
+        leftCounts.assign(chunks, 0);
+        auto goesLeft = [&](size_t i) {
+            return binned ? bins[i] < bestBin : i < range.start + n/2;
+        };
+        eachChunk([&](size_t c) {
+            for (size_t i = chunkBegin(c); i < chunkEnd(c); i++) {
+                leftCounts[c] += goesLeft(i);
+            }
+        });
+        leftStart.resize(chunks);
+        rightStart.resize(chunks);
+        size_t left = range.start;
+        size_t right = range.start;
+        for (size_t c = 0; c < chunks; c++) {
+            right += leftCounts[c];
+        }
+        size_t mid = right;
+        for (size_t c = 0; c < chunks; c++) {
+            leftStart[c] = left;
+            rightStart[c] = right;
+            left += leftCounts[c];
+            right += chunkEnd(c) - chunkBegin(c) - leftCounts[c];
+        }
+        halves.assign(2 * chunks, Range());
+        eachChunk([&](size_t c) {
+            size_t l = leftStart[c], r = rightStart[c];
+            for (size_t i = chunkBegin(c); i < chunkEnd(c); i++) {
+                const BuildPrimitive& p = primitives[i];
+                Range& half = halves[2*c + !goesLeft(i)];
+                half.bounds.grow(p.low, p.high);
+                half.centroidBounds.grow(p.centroid, p.centroid);
+                scratch[goesLeft(i) ? l++ : r++] = p;
+            }
+        });
+        eachChunk([&](size_t c) {
+            std::copy(scratch.begin() + chunkBegin(c), scratch.begin() + chunkEnd(c), primitives.begin() + chunkBegin(c));
+        });
 
-bool xBoxCompare(const shared_ptr<Geometry> a, const shared_ptr<Geometry> b){
-    AABB boxA;
-    AABB boxB;
+        std::array<Range, 2> children = {Range{range.start, mid, range.slot + 1, range.depth + 1},
+            Range{mid, range.end, static_cast<uint32_t>(range.slot + (mid - range.start)), range.depth + 1}};
+        for (size_t c = 0; c < chunks; c++) {
+            for (int side = 0; side < 2; side++) {
+                children[side].bounds.grow(halves[2*c + side].bounds);
+                children[side].centroidBounds.grow(halves[2*c + side].centroidBounds);
+            }
+        }
+        node.mid = mid;
+        node.axis = axis;
+        return children;
+    }
 
-    if (!a->boundingBox(0,0,boxA) || !b->boundingBox(0,0, boxB)){
-        std::cerr<<"Must create a bounding box in BVHNode constructor\n";
+    void buildSubtree(const Range& range) {
+        for (const Range& child : split(range, false)) {
+            if (child.end - child.start > maxLeafSize) {
+                buildSubtree(child);
+            }
+        }
     }
-    return boxA.min().getX() < boxB.min().getX();
-}
 
-bool yBoxCompare(const shared_ptr<Geometry> a, const shared_ptr<Geometry> b){
-        AABB boxA;
-    AABB boxB;
+    size_t count;
+    size_t maxLeafSize = 1;
+    int threadCount;
+    ThreadPool pool;
+    //each node's primitives are a contiguous run
+    std::vector<BuildPrimitive> primitives;
+    std::vector<BuildPrimitive> scratch;
+    //the bin of the primitive at each position, while its node is being split
+    std::vector<uint8_t> bins;
+    std::vector<Node> nodes;
+    Bounds rootBounds;
+};
 
-    if (!a->boundingBox(0,0,boxA) || !b->boundingBox(0,0, boxB)){
-        std::cerr<<"Must create a bounding box in BVHNode constructor\n";
+BVHNode::BVHNode(const std::vector<shared_ptr<Geometry>>& objects,
+    size_t start, size_t end, float time0, float time1, int threads){
+    BVHBuilder builder(end - start, threads, [&](size_t i, AABB& box) {
+        if (!objects[start + i]->boundingBox(time0, time1, box)) {
+            std::cerr << "Must create a bounding box in BVHNode constructor\n";
+        }
+    });
+    builder.build(1);
+    if (end - start == 0) {
+        return;
+    }
+    if (end - start == 1) {
+        //one object goes on both sides
+        left = right = objects[start];
+        box = builder.bounds().box();
+        return;
     }
-    return boxA.min().getY() < boxB.min().getY();
+    //the arena isn't shared between threads, so the nodes are made here, each after the children in the slots
+    //above it, and a child over one primitive is that object
+    const auto& order = builder.order();
+    const auto& nodes = builder.tree();
+    std::vector<shared_ptr<Geometry>> made(nodes.size());
+    auto child = [&](size_t slot, size_t from, size_t to) {
+        return to - from == 1 ? objects[start + order[from].index] : std::move(made[slot]);
+    };
+    auto leftOf = [&](size_t slot) {
+        return child(slot + 1, nodes[slot].start, nodes[slot].mid);
+    };
+    auto rightOf = [&](size_t slot) {
+        return child(slot + nodes[slot].mid - nodes[slot].start, nodes[slot].mid, nodes[slot].end);
+    };
+    for (size_t slot = nodes.size() - 1; slot > 0; slot--) {
+        made[slot] = makeSceneObject<BVHNode>(leftOf(slot), rightOf(slot), nodes[slot].bounds.box());
+    }
+    left = leftOf(0);
+    right = rightOf(0);
+    box = nodes[0].bounds.box();
 }
 
-bool zBoxCompare(const shared_ptr<Geometry> a, const shared_ptr<Geometry> b){
-    AABB boxA;
-    AABB boxB;
+bool BVHNode::closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const{
+    RT_COUNT(BVHNodeVisits);
+    if(!box.hit(ray, tMin, tMax)){
+        return false;
+    }
+
+    bool hitLeft = left->closestHit(ray, tMin, tMax, candidate);
+    bool hitRight = right->closestHit(ray, tMin, hitLeft ? candidate.t : tMax, candidate);
 
-    if (!a->boundingBox(0,0,boxA) || !b->boundingBox(0,0, boxB)){
-        std::cerr<<"Must create a bounding box in BVHNode constructor\n";
+    return hitLeft || hitRight;
+}
+
+bool BVHNode::occluded(const Ray& ray, float tMin, float tMax) const{
+    RT_COUNT(BVHNodeVisits);
+    if(!box.hit(ray, tMin, tMax)){
+        return false;
     }
-    return boxA.min().getZ() < boxB.min().getZ();
+    return left->occluded(ray, tMin, tMax) || right->occluded(ray, tMin, tMax);
 }
 
+bool BVHNode::boundingBox(float t0, float t1, AABB& outputBox) const {
+    outputBox = box;
+    return true;
+}
 
+bool BVHNode::refit(const std::unordered_set<const Geometry*>& dirty, float time0, float time1) {
+    auto refitChild = [&](const shared_ptr<Geometry>& child) {
+        auto node = std::dynamic_pointer_cast<BVHNode>(child);
+        if (node) {
+            return node->refit(dirty, time0, time1);
+        }
+        return dirty.count(child.get()) > 0;
+    };
+    bool changed = refitChild(left);
+    //a leaf stores the same object in both children, so only visit it once
+    if (right != left) {
+        changed |= refitChild(right);
+    }
+    if (!changed) {
+        return false;
+    }
 
+    AABB boxLeft, boxRight;
+    left->boundingBox(time0, time1, boxLeft);
+    right->boundingBox(time0, time1, boxRight);
+    box = surroundingBox(boxLeft, boxRight);
+    return true;
+}
 
 #endif /* BVH_HPP_*/
\ No newline at end of file
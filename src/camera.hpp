@@ -2,6 +2,7 @@
 #define CAMERA_HPP_
 
 #include "./rtCommon.hpp"
+#include "./sampler.hpp"
 
 class Camera {
     public:
@@ -25,9 +26,9 @@ class Camera {
         auto vWidth = aspectRatio * vHeight;
 
         //orthonormal basis (u, v, w) to describe camera’s orientation
-        auto w = unitVector(lookfrom - lookat);
-        auto u = unitVector(up.crossProduct(w));
-        auto v = w.crossProduct(u);
+        w = unitVector(lookfrom - lookat);
+        u = unitVector(up.crossProduct(w));
+        v = w.crossProduct(u);
 
         origin = lookfrom;
         horizontal = u * vWidth * focusDist;
@@ -47,6 +48,17 @@ class Camera {
         return Ray(origin + offset, lowerLeftCorner + horizontal*s + vertical*t - origin - offset, randomNum(time0, time1)); 
 }
 
+    //same ray, with the lens position and shutter time drawn from sampler
+    Ray getRay(float s, float t, Sampler& sampler) const {
+        float lensU, lensV;
+        sampler.get2D(lensU, lensV);
+        Vector3 rd = sampleUnitDisk(lensU, lensV) * lensRadius;
+        Vector3 offset = u * rd.getX() + v * rd.getY();
+        float time = time0 + sampler.get1D()*(time1 - time0);
+
+        return Ray(origin + offset, lowerLeftCorner + horizontal*s + vertical*t - origin - offset, time);
+    }
+
 
     private:
     Vector3 origin;
@@ -1,14 +1,18 @@
-
 #ifndef COLOR_HPP_
 #define COLOR_HPP_
 
 #include "./rtCommon.hpp"
+#include "./frameBuffer.hpp"
+#include "./trace.hpp"
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string>
 
 
 
-void writeColor(std::ostream &out, std::ofstream &MyFile, Vector3 pixelColor, int samplesPerPixel) {
+void writeColor(std::ostream &out, Vector3 pixelColor, int samplesPerPixel) {
     auto r = pixelColor.getX();
     auto g = pixelColor.getY();
     auto b = pixelColor.getZ();
@@ -20,11 +24,129 @@ void writeColor(std::ostream &out, std::ofstream &MyFile, Vector3 pixelColor, in
     b = sqrt(scale * b);
 
     // Write the translated [0,255] value of each color component.
-     MyFile << static_cast<int>(256 * restrictColor(r, 0.0, 0.999)) 
+     out << static_cast<int>(256 * restrictColor(r, 0.0, 0.999)) 
         << ' '
         << static_cast<int>(256 * restrictColor(g, 0.0, 0.999)) 
         << ' '
         << static_cast<int>(256 * restrictColor(b, 0.0, 0.999)) << '\n';
 }
 
-#endif /* COLOR_HPP_*/
\ No newline at end of file
+//encode a whole frame as a P3 ppm file
+//the text is built in memory first so the file is written in one go
+bool writeImage(const std::string& fileName, const FrameBuffer& image) {
+    TraceScope trace("encode image", "output");
+    std::ostringstream out;
+    out << "P3\n" << image.width << " " << image.height << "\n255\n";
+    for (int y = 0; y < image.height; y++) {
+        for (int x = 0; x < image.width; x++) {
+            writeColor(out, image.at(x, y), 1);
+        }
+    }
+
+    std::ofstream file(fileName);
+    if (!file) {
+        std::cerr << "Error: could not open " << fileName << " for writing\n";
+        return false;
+    }
+    file << out.str();
+    return true;
+}
+
+//read a P3 ppm written by writeImage back into linear colors
+bool readImage(const std::string& fileName, FrameBuffer& image) {
+    std::ifstream file(fileName);
+    std::string magic;
+    int width, height, maxValue;
+    if (!(file >> magic >> width >> height >> maxValue) || magic != "P3") {
+        std::cerr << "Error: " << fileName << " is not a P3 ppm\n";
+        return false;
+    }
+    image = FrameBuffer(width, height);
+    for (auto& pixel : image.pixels) {
+        int r, g, b;
+        if (!(file >> r >> g >> b)) {
+            std::cerr << "Error: " << fileName << " is truncated\n";
+            return false;
+        }
+        //undo the gamma=2.0 correction, taking the middle of each quantization step
+        auto linear = [](int value) {
+            float c = (value + 0.5f) / 256;
+            return c*c;
+        };
+        pixel = Vector3(linear(r), linear(g), linear(b));
+    }
+    return true;
+}
+
+//strip a trailing .ppm so related images can be named after the main one
+std::string imageBaseName(const std::string& fileName) {
+    size_t dot = fileName.rfind(".ppm");
+    return dot == std::string::npos ? fileName : fileName.substr(0, dot);
+}
+
+//write the denoiser's guide buffers next to the color image as <base>_albedo, _normal and _depth
+void writeAuxImages(const std::string& base, const AuxBuffers& aux) {
+    writeImage(base + "_albedo.ppm", aux.albedo);
+
+    //map normals from [-1, 1] to [0, 1], and undo the gamma writeColor applies
+    FrameBuffer normals(aux.normal.width, aux.normal.height);
+    for (size_t i = 0; i < normals.pixels.size(); i++) {
+        Vector3 n = aux.normal.pixels[i]*0.5 + 0.5;
+        normals.pixels[i] = n * n;
+    }
+    writeImage(base + "_normal.ppm", normals);
+
+    //nearer is brighter
+    float maxDepth = *std::max_element(aux.depth.begin(), aux.depth.end());
+    FrameBuffer depth(aux.albedo.width, aux.albedo.height);
+    for (size_t i = 0; i < depth.pixels.size(); i++) {
+        float d = aux.depth[i] > 0 ? 1 - aux.depth[i] / maxDepth : 0;
+        depth.pixels[i] = Vector3(d*d);
+    }
+    writeImage(base + "_depth.ppm", depth);
+}
+
+//blue for cheap through cyan, green and yellow to red for expensive, t in [0, 1]
+inline Vector3 falseColor(float t) {
+    static const Vector3 stops[] = {Vector3(0, 0, 0.5), Vector3(0, 0.4, 1), Vector3(0, 0.9, 0.6),
+        Vector3(1, 0.9, 0), Vector3(1, 0, 0)};
+    const int last = sizeof(stops) / sizeof(stops[0]) - 1;
+    float position = restrictColor(t, 0, 1) * last;
+    int i = std::min(static_cast<int>(position), last - 1);
+    float f = position - i;
+    return stops[i] * (1 - f) + stops[i + 1] * f;
+}
+
+//write one cost per pixel as a false color image, scaled so the 99th percentile is red, so a few
+//outliers don't leave the rest of the image blue, and report the spread to stderr
+inline void writeCostImage(const std::string& fileName, const char* label, const std::vector<float>& values,
+    int width, int height, float unit) {
+    std::vector<float> sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+    float top = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    double sum = 0;
+    for (float value : values) {
+        sum += value;
+    }
+    std::cerr << "\n" << label << ": mean " << sum / values.size() * unit << ", 99th percentile " << top * unit
+        << ", max " << sorted.back() * unit;
+
+    FrameBuffer image(width, height);
+    for (size_t i = 0; i < values.size(); i++) {
+        //undo the gamma writeColor applies
+        Vector3 c = falseColor(top > 0 ? values[i] / top : 0);
+        image.pixels[i] = c * c;
+    }
+    writeImage(fileName, image);
+}
+
+//write what each pixel cost next to the color image as <base>_time, _bounces and, when counted, _nodes
+void writeCostImages(const std::string& base, const CostBuffers& cost) {
+    writeCostImage(base + "_time.ppm", "time per pixel (us)", cost.seconds, cost.width, cost.height, 1e6);
+    writeCostImage(base + "_bounces.ppm", "bounces per sample", cost.bounces, cost.width, cost.height, 1);
+    if (*std::max_element(cost.nodes.begin(), cost.nodes.end()) > 0) {
+        writeCostImage(base + "_nodes.ppm", "BVH nodes per pixel", cost.nodes, cost.width, cost.height, 1);
+    }
+}
+
+#endif /* COLOR_HPP_*/
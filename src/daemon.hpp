@@ -0,0 +1,430 @@
+#ifndef DAEMON_HPP_
+#define DAEMON_HPP_
+
+#include "./rtCommon.hpp"
+#include "./frameBuffer.hpp"
+#include "./scenes.hpp"
+#include "./lights.hpp"
+#include "./render.hpp"
+#include "./restir.hpp"
+#include "./denoise.hpp"
+#include "./bake.hpp"
+#include "./distributed.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+//a long running render server: clients submit jobs over a socket, poll their progress and fetch the finished
+//images, while built scenes (geometry, BVH, light tree, decoded textures and noise tables) stay in memory,
+//so another view of a scene that was rendered before starts tracing right away
+//the messages are the ones distributed.hpp defines, and jobs are RenderJobs
+
+enum class JobState : int32_t { Queued, Rendering, Done };
+
+struct JobStatus {
+    int32_t state;
+    //fraction of the frame rendered
+    float progress;
+    //1 if the job found its scene already built
+    int32_t sceneCached;
+    //time from picking the job up to tracing its first ray, and the time spent rendering
+    float setupMilliseconds;
+    float renderMilliseconds;
+    //size of the finished image, so a client knows how big an Image reply it may accept
+    int32_t width;
+    int32_t height;
+};
+
+//a job and its result, kept until the client fetches the image or the daemon evicts it
+struct DaemonJobRecord {
+    RenderJob job;
+    JobStatus status{static_cast<int32_t>(JobState::Queued), 0, 0, 0, 0, 0, 0};
+    std::atomic<float> progress{0};
+    FrameBuffer image;
+    //when the job was done, images nobody fetches are dropped after a while
+    std::chrono::steady_clock::time_point finished;
+};
+
+//a scene with everything built from it that rendering needs, shared by every job that asks for it
+struct CachedScene {
+    Scene scene;
+    shared_ptr<Geometry> world;
+    shared_ptr<LightList> lights;
+    //job count at the last use, the least recently used scene is dropped first
+    uint64_t lastUsed = 0;
+};
+
+//a connected client and the thread answering it, its socket stays open until the thread is joined
+struct DaemonConnection {
+    int fd;
+    std::atomic<bool> finished{false};
+    std::thread thread;
+};
+
+class RenderDaemon {
+    public:
+    //scenes kept built at once, the biggest ones hold a few hundred thousand objects
+    static constexpr size_t maxCachedScenes = 4;
+    //finished images kept for --detach clients, older ones are dropped past either limit
+    static constexpr size_t maxDoneJobs = 16;
+    static constexpr int maxDoneMinutes = 60;
+
+    //serve requests on address until a client asks for a shutdown, returns false if it can't listen
+    bool serve(const std::string& address) {
+        int listenFd = openSocket(address, true);
+        if (listenFd < 0) {
+            std::cerr << "Could not listen on " << address << "\n";
+            return false;
+        }
+        std::cerr << "Listening on " << address << "\n";
+        std::thread renderer([this]() { renderJobs(); });
+        std::list<DaemonConnection> connections;
+        //join the threads of clients that disconnected, a long running daemon sees a lot of them
+        auto reap = [&]() {
+            for (auto it = connections.begin(); it != connections.end();) {
+                if (it->finished) {
+                    it->thread.join();
+                    close(it->fd);
+                    it = connections.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        };
+        while (!stopping) {
+            reap();
+            pollfd listening{listenFd, POLLIN, 0};
+            if (poll(&listening, 1, 200) <= 0) {
+                continue;
+            }
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                connections.emplace_back();
+                DaemonConnection& connection = connections.back();
+                connection.fd = fd;
+                connection.thread = std::thread([this, &connection]() {
+                    serveClient(connection.fd);
+                    connection.finished = true;
+                });
+            }
+        }
+        close(listenFd);
+        if (address.compare(0, 5, "unix:") == 0) {
+            unlink(address.substr(5).c_str());
+        }
+        renderer.join();
+        //clients still connected are waiting for their next request, wake them up with an end of stream
+        for (auto& connection : connections) {
+            shutdown(connection.fd, SHUT_RDWR);
+        }
+        for (auto& connection : connections) {
+            connection.thread.join();
+            close(connection.fd);
+        }
+        return true;
+    }
+
+    private:
+    //answer one client's requests until it disconnects, serve() closes the socket
+    void serveClient(int fd) {
+        MessageType type;
+        std::vector<char> payload;
+        //every request fits in a RenderJob
+        while (recvMessage(fd, type, payload, sizeof(RenderJob))) {
+            bool sent = true;
+            if (type == MessageType::Submit && payload.size() == sizeof(RenderJob)) {
+                auto record = std::make_shared<DaemonJobRecord>();
+                memcpy(&record->job, payload.data(), sizeof(RenderJob));
+                std::string error = jobError(record->job);
+                if (!error.empty()) {
+                    if (!sendError(fd, "Job rejected: " + error)) {
+                        break;
+                    }
+                    continue;
+                }
+                int32_t id;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    evictDoneJobs();
+                    id = nextId++;
+                    jobs[id] = record;
+                    queue.push_back(id);
+                }
+                queueChanged.notify_one();
+                sent = sendMessage(fd, MessageType::JobAccepted, &id, sizeof(id));
+            } else if (type == MessageType::Status && payload.size() == sizeof(int32_t)) {
+                int32_t id;
+                memcpy(&id, payload.data(), sizeof(id));
+                std::unique_lock<std::mutex> lock(mutex);
+                auto found = jobs.find(id);
+                if (found == jobs.end()) {
+                    lock.unlock();
+                    sent = sendError(fd, "No job " + std::to_string(id));
+                } else {
+                    JobStatus status = found->second->status;
+                    status.progress = found->second->progress;
+                    lock.unlock();
+                    sent = sendMessage(fd, MessageType::StatusReply, &status, sizeof(status));
+                }
+            } else if (type == MessageType::Fetch && payload.size() == sizeof(int32_t)) {
+                int32_t id;
+                memcpy(&id, payload.data(), sizeof(id));
+                std::unique_lock<std::mutex> lock(mutex);
+                auto found = jobs.find(id);
+                if (found == jobs.end() || found->second->status.state != static_cast<int32_t>(JobState::Done)) {
+                    lock.unlock();
+                    sent = sendError(fd, "Job " + std::to_string(id) + (found == jobs.end() ? " doesn't exist" : " isn't done"));
+                } else {
+                    //a fetched image is handed over, the daemon doesn't keep it
+                    auto record = found->second;
+                    jobs.erase(found);
+                    lock.unlock();
+                    sent = sendImage(fd, record->image);
+                }
+            } else if (type == MessageType::Shutdown) {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                queueChanged.notify_one();
+            } else {
+                sent = sendError(fd, "Unexpected request");
+            }
+            if (!sent) {
+                break;
+            }
+        }
+    }
+
+    static bool sendError(int fd, const std::string& message) {
+        return sendMessage(fd, MessageType::Error, message.data(), message.size());
+    }
+
+    static bool sendImage(int fd, const FrameBuffer& image) {
+        int32_t size[2] = {image.width, image.height};
+        std::vector<float> data;
+        data.reserve(image.pixels.size() * 3);
+        for (const auto& pixel : image.pixels) {
+            data.push_back(pixel.getX());
+            data.push_back(pixel.getY());
+            data.push_back(pixel.getZ());
+        }
+        return sendMessage(fd, MessageType::Image, size, sizeof(size), data.data(), data.size() * sizeof(float));
+    }
+
+    //render queued jobs one at a time, each one uses every render thread
+    void renderJobs() {
+        while (true) {
+            std::shared_ptr<DaemonJobRecord> record;
+            int32_t id;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queueChanged.wait(lock, [&]() { return !queue.empty() || stopping; });
+                if (queue.empty()) {
+                    return;
+                }
+                id = queue.front();
+                queue.pop_front();
+                record = jobs[id];
+                record->status.state = static_cast<int32_t>(JobState::Rendering);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            const RenderJob& job = record->job;
+            bool cached;
+            CachedScene& entry = cachedScene(job, cached);
+            RenderSettings settings = jobSettings(job, entry.scene);
+            settings.showProgress = false;
+            settings.progress = &record->progress;
+            Camera cam = jobCamera(job, entry.scene);
+            auto tracing = std::chrono::steady_clock::now();
+
+            FrameBuffer image;
+            if (job.aux) {
+                AuxBuffers aux;
+                renderFrame(*entry.world, *entry.lights, cam, settings, image, &aux);
+                image = denoise(image, aux, DenoiseSettings());
+            } else {
+                renderFrame(*entry.world, *entry.lights, cam, settings, image);
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            std::chrono::duration<float, std::milli> setup = tracing - start;
+            std::chrono::duration<float, std::milli> rendering = end - tracing;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                record->image = std::move(image);
+                record->status = JobStatus{static_cast<int32_t>(JobState::Done), 1, cached, setup.count(), rendering.count(),
+                    record->image.width, record->image.height};
+                record->finished = end;
+                evictDoneJobs();
+            }
+            std::cerr << "Job " << id << ": scene " << job.sceneNumber << (cached ? " (cached)" : "")
+                << ", tracing after " << setup.count() << "ms, rendered in " << rendering.count() << "ms\n";
+        }
+    }
+
+    //drop done jobs that waited longer than maxDoneMinutes, then the oldest ones past maxDoneJobs, called with mutex held
+    void evictDoneJobs() {
+        auto now = std::chrono::steady_clock::now();
+        std::vector<std::map<int32_t, std::shared_ptr<DaemonJobRecord>>::iterator> done;
+        for (auto it = jobs.begin(); it != jobs.end();) {
+            if (it->second->status.state != static_cast<int32_t>(JobState::Done)) {
+                ++it;
+            } else if (now - it->second->finished > std::chrono::minutes(maxDoneMinutes)) {
+                std::cerr << "Job " << it->first << " was never fetched, dropped its image\n";
+                it = jobs.erase(it);
+            } else {
+                done.push_back(it++);
+            }
+        }
+        if (done.size() <= maxDoneJobs) {
+            return;
+        }
+        std::sort(done.begin(), done.end(), [](const auto& a, const auto& b) { return a->second->finished < b->second->finished; });
+        for (size_t i = 0; i < done.size() - maxDoneJobs; i++) {
+            std::cerr << "Job " << done[i]->first << " was never fetched, dropped its image\n";
+            jobs.erase(done[i]);
+        }
+    }
+
+    //the built scene a job asks for, building it (and dropping the least recently used one) if it isn't cached
+    CachedScene& cachedScene(const RenderJob& job, bool& cached) {
+        auto key = std::make_tuple(job.sceneNumber, job.lightCount, job.seed, job.lightSelection, job.bakeDensity, job.flat);
+        auto found = scenes.find(key);
+        cached = found != scenes.end();
+        if (!cached) {
+            if (scenes.size() >= maxCachedScenes) {
+                auto oldest = scenes.begin();
+                for (auto it = scenes.begin(); it != scenes.end(); ++it) {
+                    if (it->second.lastUsed < oldest->second.lastUsed) {
+                        oldest = it;
+                    }
+                }
+                scenes.erase(oldest);
+            }
+            found = scenes.emplace(key, CachedScene()).first;
+            CachedScene& entry = found->second;
+            seedRandom(job.seed);
+            entry.scene = loadScene(job.sceneNumber, job.lightCount);
+            if (job.bakeDensity > 0) {
+                BakeSettings bakeSettings;
+                bakeSettings.texelsPerUnit = job.bakeDensity;
+                bakeTextures(entry.scene, bakeSettings);
+            }
+            entry.world = sceneHierarchy(entry.scene, job.flat);
+            entry.lights = make_shared<LightList>(entry.scene.objects, static_cast<LightSelection>(job.lightSelection));
+        }
+        found->second.lastUsed = ++jobsStarted;
+        return found->second;
+    }
+
+    std::mutex mutex;
+    std::condition_variable queueChanged;
+    std::deque<int32_t> queue;
+    std::map<int32_t, std::shared_ptr<DaemonJobRecord>> jobs;
+    int32_t nextId = 1;
+    std::atomic<bool> stopping{false};
+
+    //only touched by the render thread
+    std::map<std::tuple<int32_t, int32_t, uint32_t, int32_t, float, int32_t>, CachedScene> scenes;
+    uint64_t jobsStarted = 0;
+};
+
+//longest Error reply a client accepts
+constexpr uint32_t maxDaemonErrorSize = 1024;
+
+//client side: send a request and wait for its reply, false (after printing why) if the reply isn't expected
+//or longer than maxReply
+bool daemonRequest(int fd, MessageType request, const void* payload, uint32_t size, MessageType expected,
+    std::vector<char>& reply, uint32_t maxReply) {
+    MessageType type;
+    if (!sendMessage(fd, request, payload, size) || !recvMessage(fd, type, reply, std::max(maxReply, maxDaemonErrorSize))) {
+        std::cerr << "Lost the connection to the daemon\n";
+        return false;
+    }
+    if (type == MessageType::Error) {
+        std::cerr << std::string(reply.begin(), reply.end()) << "\n";
+        return false;
+    }
+    return type == expected;
+}
+
+bool daemonStatus(int fd, int32_t id, JobStatus& status) {
+    std::vector<char> reply;
+    if (!daemonRequest(fd, MessageType::Status, &id, sizeof(id), MessageType::StatusReply, reply, sizeof(status))
+        || reply.size() != sizeof(status)) {
+        return false;
+    }
+    memcpy(&status, reply.data(), sizeof(status));
+    return true;
+}
+
+bool daemonFetch(int fd, int32_t id, FrameBuffer& image) {
+    //the status says how big the image is, a finished job's size doesn't change
+    JobStatus status;
+    if (!daemonStatus(fd, id, status)) {
+        return false;
+    }
+    size_t imageSize = 2*sizeof(int32_t) + size_t(std::max(status.width, 0)) * std::max(status.height, 0) * 3 * sizeof(float);
+    std::vector<char> reply;
+    if (!daemonRequest(fd, MessageType::Fetch, &id, sizeof(id), MessageType::Image, reply,
+        static_cast<uint32_t>(std::min<size_t>(imageSize, UINT32_MAX))) || reply.size() < 2*sizeof(int32_t)) {
+        return false;
+    }
+    int32_t size[2];
+    memcpy(size, reply.data(), sizeof(size));
+    if (reply.size() != sizeof(size) + size_t(size[0]) * size[1] * 3 * sizeof(float)) {
+        return false;
+    }
+    image = FrameBuffer(size[0], size[1]);
+    const float* data = reinterpret_cast<const float*>(reply.data() + sizeof(size));
+    for (auto& pixel : image.pixels) {
+        pixel = Vector3(data[0], data[1], data[2]);
+        data += 3;
+    }
+    return true;
+}
+
+//submit job and return its id, -1 on failure
+int32_t daemonSubmit(int fd, const RenderJob& job) {
+    std::vector<char> reply;
+    int32_t id;
+    if (!daemonRequest(fd, MessageType::Submit, &job, sizeof(job), MessageType::JobAccepted, reply, sizeof(id))
+        || reply.size() != sizeof(id)) {
+        return -1;
+    }
+    memcpy(&id, reply.data(), sizeof(id));
+    return id;
+}
+
+//wait for a job to finish, printing its progress, and fetch the image
+bool daemonWait(int fd, int32_t id, bool showProgress, FrameBuffer& image) {
+    JobStatus status;
+    while (daemonStatus(fd, id, status)) {
+        if (status.state == static_cast<int32_t>(JobState::Done)) {
+            if (showProgress) {
+                std::cerr << "\rJob " << id << (status.sceneCached ? " (cached scene)" : "") << ": tracing after "
+                    << status.setupMilliseconds << "ms, rendered in " << status.renderMilliseconds << "ms";
+            }
+            return daemonFetch(fd, id, image);
+        }
+        if (showProgress) {
+            std::cerr << "\rJob " << id << (status.state == static_cast<int32_t>(JobState::Queued) ? ": queued " : ": ")
+                << static_cast<int>(status.progress * 100) << "% " << std::flush;
+        }
+        usleep(100000);
+    }
+    return false;
+}
+
+#endif /* DAEMON_HPP_*/
@@ -0,0 +1,153 @@
+#ifndef DENOISE_HPP_
+#define DENOISE_HPP_
+
+#include "./rtCommon.hpp"
+#include "./frameBuffer.hpp"
+#include "./trace.hpp"
+#include "./threading.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+struct DenoiseSettings {
+    //number of a-trous passes, each one doubles the filter's footprint
+    int iterations = 5;
+    //how many standard deviations of luminance noise count as the same surface
+    float sigmaLuminance = 4.0;
+    //exponent on the dot product of normals, higher keeps creases sharper
+    float sigmaNormal = 128.0;
+    //relative depth difference (per pixel of step) that still counts as the same surface
+    float sigmaDepth = 0.02;
+    //albedo difference that still counts as the same surface
+    float sigmaAlbedo = 0.1;
+    int threads = 0;
+};
+
+//texture detail lives in the albedo, so the filter runs on color / albedo and multiplies it back afterwards
+//channels with (almost) no albedo, like the black background, are filtered as they are
+inline Vector3 demodulationFactor(const Vector3& albedo) {
+    return Vector3(albedo.getX() > 0.001 ? albedo.getX() : 1,
+                   albedo.getY() > 0.001 ? albedo.getY() : 1,
+                   albedo.getZ() > 0.001 ? albedo.getZ() : 1);
+}
+
+//edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), with the luminance weight scaled by
+//each pixel's estimated variance like SVGF, so flat noisy regions blur and real edges stay
+FrameBuffer denoise(const FrameBuffer& image, const AuxBuffers& aux, const DenoiseSettings& settings) {
+    TraceScope trace("denoise", "output");
+    int width = image.width;
+    int height = image.height;
+    int threadCount = settings.threads > 0 ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+
+    //B3 spline kernel
+    const float kernel[5] = {1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16};
+
+    std::vector<Vector3> current(width * height);
+    std::vector<Vector3> next(width * height);
+    std::vector<float> variance = aux.variance;
+    std::vector<float> nextVariance(width * height);
+
+    //the averaged normals of edge pixels are shorter than unit length, renormalize them before comparing
+    std::vector<Vector3> normals(aux.normal.pixels);
+    for (auto& normal : normals) {
+        if (normal.vecLengthSquared() > 0) {
+            normal.normalize();
+        }
+    }
+
+    for (int i = 0; i < width * height; i++) {
+        Vector3 factor = demodulationFactor(aux.albedo.pixels[i]);
+        current[i] = image.pixels[i] / factor;
+        float albedoLum = std::max(0.001f, luminance(factor));
+        variance[i] /= albedoLum * albedoLum;
+    }
+
+    //a pixel whose few samples all agreed (often all black) reports no variance and would never be filtered,
+    //so the luminance weight uses variance blurred over the pixel's 3x3 neighbourhood instead
+    std::vector<float> blurredVariance(width * height);
+    auto blurVariance = [&](int y) {
+        const float gaussian[3] = {0.25f, 0.5f, 0.25f};
+        for (int x = 0; x < width; x++) {
+            float sum = 0;
+            float sumWeight = 0;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int qx = x + dx;
+                    int qy = y + dy;
+                    if (qx < 0 || qx >= width || qy < 0 || qy >= height) {
+                        continue;
+                    }
+                    float weight = gaussian[dx + 1] * gaussian[dy + 1];
+                    sum += weight * variance[qy * width + qx];
+                    sumWeight += weight;
+                }
+            }
+            blurredVariance[y * width + x] = sum / sumWeight;
+        }
+    };
+
+    for (int iteration = 0; iteration < settings.iterations; iteration++) {
+        int step = 1 << iteration;
+        forEachRow(height, threadCount, blurVariance);
+        forEachRow(height, threadCount, [&](int y) {
+            for (int x = 0; x < width; x++) {
+                int p = y * width + x;
+                float lumP = luminance(current[p]);
+                float sigmaL = settings.sigmaLuminance * sqrt(blurredVariance[p]) + 1e-4f;
+                const Vector3& normalP = normals[p];
+                const Vector3& albedoP = aux.albedo.pixels[p];
+                float depthP = aux.depth[p];
+
+                Vector3 sum(0, 0, 0);
+                float sumVariance = 0;
+                float sumWeight = 0;
+                for (int dy = -2; dy <= 2; dy++) {
+                    int qy = y + dy * step;
+                    if (qy < 0 || qy >= height) {
+                        continue;
+                    }
+                    for (int dx = -2; dx <= 2; dx++) {
+                        int qx = x + dx * step;
+                        if (qx < 0 || qx >= width) {
+                            continue;
+                        }
+                        int q = qy * width + qx;
+
+                        float lumWeight = fabs(luminance(current[q]) - lumP) / sigmaL;
+                        float normalWeight = pow(std::max(0.0f, normalP.dotProduct(normals[q])), settings.sigmaNormal);
+                        float depthWeight = fabs(aux.depth[q] - depthP) / (settings.sigmaDepth * step * std::max(depthP, 1e-3f));
+                        float albedoWeight = (aux.albedo.pixels[q] - albedoP).vecLengthSquared() / (settings.sigmaAlbedo * settings.sigmaAlbedo);
+                        //pixels that both missed the scene have no normal, compare them on luminance alone
+                        if (depthP == 0 && aux.depth[q] == 0) {
+                            normalWeight = 1;
+                        }
+
+                        float weight = kernel[dx + 2] * kernel[dy + 2] * normalWeight * exp(-lumWeight - depthWeight - albedoWeight);
+                        sum += current[q] * weight;
+                        sumVariance += weight * weight * variance[q];
+                        sumWeight += weight;
+                    }
+                }
+                if (sumWeight > 0) {
+                    next[p] = sum / sumWeight;
+                    nextVariance[p] = sumVariance / (sumWeight * sumWeight);
+                }
+                else {
+                    next[p] = current[p];
+                    nextVariance[p] = variance[p];
+                }
+            }
+        });
+        std::swap(current, next);
+        std::swap(variance, nextVariance);
+    }
+
+    FrameBuffer result(width, height);
+    for (int i = 0; i < width * height; i++) {
+        result.pixels[i] = current[i] * demodulationFactor(aux.albedo.pixels[i]);
+    }
+    return result;
+}
+
+#endif /* DENOISE_HPP_*/
@@ -0,0 +1,564 @@
+#ifndef DISTRIBUTED_HPP_
+#define DISTRIBUTED_HPP_
+
+#include "./rtCommon.hpp"
+#include "./frameBuffer.hpp"
+#include "./scenes.hpp"
+#include "./lights.hpp"
+#include "./render.hpp"
+#include "./threading.hpp"
+#include "./bake.hpp"
+
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//rendering one frame on several worker processes: a coordinator listens on a socket, every worker that
+//connects is sent the job once, rebuilds the scene from it and then pulls tiles until none are left
+//addresses are "unix:/path/to/socket" or "host:port" (host may be left out when listening)
+//messages are sent in host byte order, so workers must run on the same architecture as the coordinator
+
+enum class MessageType : uint32_t {
+    //coordinator to worker: RenderJob
+    Job = 1,
+    //worker to coordinator: scene built, ready for tiles
+    Ready,
+    //coordinator to worker: TileRequest
+    Tile,
+    //worker to coordinator: TileRequest followed by the tile's floats
+    TileResult,
+    //coordinator to worker: no tiles left, disconnect
+    Done,
+    //client to daemon (daemon.hpp): RenderJob, answered with JobAccepted carrying the job's id
+    Submit,
+    JobAccepted,
+    //client to daemon: job id, answered with StatusReply
+    Status,
+    StatusReply,
+    //client to daemon: job id, answered with Image (width, height, then rgb floats) or Error if it isn't done
+    Fetch,
+    Image,
+    //daemon to client: a message explaining why the request failed
+    Error,
+    //client to daemon: finish the queued jobs and exit
+    Shutdown
+};
+
+struct MessageHeader {
+    uint32_t type;
+    //payload bytes following the header
+    uint32_t size;
+};
+
+//everything a worker needs to rebuild the scene and render tiles of it exactly as the coordinator would
+struct RenderJob {
+    int32_t sceneNumber;
+    int32_t lightCount;
+    //seed of the thread building the scene, random scenes come out identical on every worker
+    uint32_t seed;
+    //0 takes the scene's own image width, height (from its aspect ratio) and sample count
+    int32_t width;
+    int32_t height;
+    int32_t samplesPerPixel;
+    int32_t maxDepth;
+    int32_t samplerType;
+    int32_t integrator;
+    int32_t heuristic;
+    int32_t lightSelection;
+    //1 if tiles carry the denoiser's auxiliary buffers too
+    int32_t aux;
+    //1 to place the camera at lookfrom, aimed at lookat, instead of where the scene puts it
+    int32_t customCamera;
+    float lookfrom[3];
+    float lookat[3];
+    float vfov;
+    //texels per world unit to bake procedural textures at before rendering, 0 leaves them procedural
+    float bakeDensity;
+    //1 to trace a FlatScene instead of the object BVH
+    int32_t flat;
+    //1 to render a wave of paths at a time, and 1 to shade them sorted by material, only the daemon renders whole
+    //frames, tiles are always traced path by path
+    int32_t wavefront;
+    int32_t sortByMaterial;
+};
+
+//why a job that came off a socket can't be rendered, empty if it can: enums out of range, images the camera
+//mapping can't divide by (it needs two pixels each way) or that wouldn't fit in a message, and so on
+std::string jobError(const RenderJob& job) {
+    const int32_t maxSide = 16384;
+    auto inRange = [](float value, float low, float high) { return value >= low && value <= high; };
+    if (job.width != 0 && !inRange(job.width, 2, maxSide)) {
+        return "width must be 0 (the scene's) or 2 to " + std::to_string(maxSide);
+    }
+    if (job.height != 0 && !inRange(job.height, 2, maxSide)) {
+        return "height must be 0 (from the width) or 2 to " + std::to_string(maxSide);
+    }
+    if (!inRange(job.samplesPerPixel, 0, 1 << 16)) {
+        return "samples per pixel must be 0 (the scene's) to 65536";
+    }
+    if (!inRange(job.maxDepth, 1, 1024)) {
+        return "depth must be 1 to 1024";
+    }
+    if (!inRange(job.lightCount, 0, 1 << 24)) {
+        return "light count must be 0 to 16777216";
+    }
+    if (!inRange(job.samplerType, 0, static_cast<int32_t>(SamplerType::BlueNoise))
+        || !inRange(job.integrator, 0, static_cast<int32_t>(Integrator::ReSTIR))
+        || !inRange(job.heuristic, 0, static_cast<int32_t>(MISHeuristic::Power))
+        || !inRange(job.lightSelection, 0, static_cast<int32_t>(LightSelection::Tree))) {
+        return "unknown sampler, integrator, heuristic or light selection";
+    }
+    if (job.customCamera && !(inRange(job.vfov, 1, 179) && inRange(job.lookfrom[0], -1e6f, 1e6f)
+        && inRange(job.lookfrom[1], -1e6f, 1e6f) && inRange(job.lookfrom[2], -1e6f, 1e6f)
+        && inRange(job.lookat[0], -1e6f, 1e6f) && inRange(job.lookat[1], -1e6f, 1e6f) && inRange(job.lookat[2], -1e6f, 1e6f))) {
+        return "camera field of view must be 1 to 179 degrees and its position and target finite";
+    }
+    if (!inRange(job.bakeDensity, 0, 1024)) {
+        return "bake density must be 0 to 1024 texels per unit";
+    }
+    return "";
+}
+
+//the settings a job renders scene with
+RenderSettings jobSettings(const RenderJob& job, const Scene& scene) {
+    RenderSettings settings;
+    settings.width = job.width > 0 ? job.width : scene.width;
+    //at least two rows, the camera mapping divides by height - 1
+    settings.height = job.height > 0 ? job.height : std::max(2, static_cast<int>(settings.width / scene.aspectRatio));
+    settings.samplesPerPixel = job.samplesPerPixel > 0 ? job.samplesPerPixel : scene.samplesPerPixel;
+    settings.maxDepth = job.maxDepth;
+    settings.samplerType = static_cast<SamplerType>(job.samplerType);
+    settings.integrator = static_cast<Integrator>(job.integrator);
+    settings.heuristic = static_cast<MISHeuristic>(job.heuristic);
+    settings.backgroundColor = scene.backgroundColor;
+    settings.wavefront = job.wavefront;
+    settings.sortByMaterial = job.sortByMaterial;
+    return settings;
+}
+
+Camera jobCamera(const RenderJob& job, const Scene& scene) {
+    if (!job.customCamera) {
+        return scene.camera();
+    }
+    return scene.camera(Vector3(job.lookfrom[0], job.lookfrom[1], job.lookfrom[2]),
+        Vector3(job.lookat[0], job.lookat[1], job.lookat[2]), job.vfov);
+}
+
+struct TileRequest {
+    int32_t index;
+    int32_t x0, y0, x1, y1;
+};
+
+//floats per pixel in a TileResult: color, then albedo, normal, depth and variance if the job wants them
+inline int tileChannels(const RenderJob& job) {
+    return job.aux ? 11 : 3;
+}
+
+inline bool sendAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        //MSG_NOSIGNAL: a worker that went away is an error to handle, not a reason to die
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+inline bool recvAll(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+inline bool sendMessage(int fd, MessageType type, const void* payload = nullptr, uint32_t size = 0,
+    const void* extra = nullptr, uint32_t extraSize = 0) {
+    MessageHeader header{static_cast<uint32_t>(type), size + extraSize};
+    return sendAll(fd, &header, sizeof(header)) && sendAll(fd, payload, size) && sendAll(fd, extra, extraSize);
+}
+
+//false if the connection closed or the peer announced a payload over maxSize, the largest message the caller
+//can expect, so a garbage header is a dropped connection instead of a multi-gigabyte allocation
+inline bool recvMessage(int fd, MessageType& type, std::vector<char>& payload, uint32_t maxSize) {
+    MessageHeader header;
+    if (!recvAll(fd, &header, sizeof(header)) || header.size > maxSize) {
+        return false;
+    }
+    type = static_cast<MessageType>(header.type);
+    payload.resize(header.size);
+    return recvAll(fd, payload.data(), header.size);
+}
+
+//open a listening or connected socket for address, -1 on failure
+int openSocket(const std::string& address, bool listening) {
+    if (address.compare(0, 5, "unix:") == 0) {
+        std::string path = address.substr(5);
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            return -1;
+        }
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (listening) {
+            unlink(path.c_str());
+        }
+        int result = listening ? bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))
+                               : connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        if (result < 0 || (listening && listen(fd, 64) < 0)) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return -1;
+    }
+    std::string host = address.substr(0, colon);
+    std::string port = address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    addrinfo* results;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* ai = results; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        int result = listening ? bind(fd, ai->ai_addr, ai->ai_addrlen) : connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (result < 0 || (listening && listen(fd, 64) < 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    return fd;
+}
+
+//render the pixels of one tile into data, tileChannels(job) floats per pixel, rows from y0 down
+void renderTile(const Geometry& world, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    const RenderJob& job, const Sampler& prototype, AuxBuffers* aux, const TileRequest& tile, std::vector<float>& data) {
+    TraceScope trace("tile");
+    trace.arg("x", tile.x0);
+    trace.arg("y", tile.y0);
+    trace.arg("samples", int64_t(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * settings.samplesPerPixel);
+    int tileWidth = tile.x1 - tile.x0;
+    int channels = tileChannels(job);
+    data.assign(tileWidth * (tile.y1 - tile.y0) * channels, 0);
+    forEachRow(tile.y1 - tile.y0, renderThreadCount(settings), [&](int row) {
+        auto sampler = prototype.clone();
+        int y = tile.y0 + row;
+        for (int x = tile.x0; x < tile.x1; x++) {
+            Vector3 col = renderPixel(world, lights, cam, settings, x, y, *sampler, aux);
+            float* pixel = &data[(row * tileWidth + x - tile.x0) * channels];
+            pixel[0] = col.getX();
+            pixel[1] = col.getY();
+            pixel[2] = col.getZ();
+            if (aux) {
+                int index = y * settings.width + x;
+                const Vector3& albedo = aux->albedo.pixels[index];
+                const Vector3& normal = aux->normal.pixels[index];
+                pixel[3] = albedo.getX();
+                pixel[4] = albedo.getY();
+                pixel[5] = albedo.getZ();
+                pixel[6] = normal.getX();
+                pixel[7] = normal.getY();
+                pixel[8] = normal.getZ();
+                pixel[9] = aux->depth[index];
+                pixel[10] = aux->variance[index];
+            }
+        }
+    });
+}
+
+//worker side: connect to the coordinator, build the scene it describes, render tiles until told to stop
+//threads is how many threads render each tile, 0 uses every hardware thread
+int runWorker(const std::string& address, int threads) {
+    int fd = -1;
+    //the coordinator may still be starting up
+    for (int attempt = 0; attempt < 50 && fd < 0; attempt++) {
+        fd = openSocket(address, false);
+        if (fd < 0) {
+            usleep(200000);
+        }
+    }
+    if (fd < 0) {
+        std::cerr << "Worker could not connect to " << address << "\n";
+        return 1;
+    }
+
+    MessageType type;
+    std::vector<char> payload;
+    if (!recvMessage(fd, type, payload, sizeof(RenderJob)) || type != MessageType::Job || payload.size() != sizeof(RenderJob)) {
+        close(fd);
+        return 1;
+    }
+    RenderJob job;
+    memcpy(&job, payload.data(), sizeof(job));
+
+    seedRandom(job.seed);
+    Scene scene = loadScene(job.sceneNumber, job.lightCount);
+    //the coordinator baked its own copy, this one has to match it
+    if (job.bakeDensity > 0) {
+        BakeSettings bakeSettings;
+        bakeSettings.texelsPerUnit = job.bakeDensity;
+        bakeSettings.threads = threads;
+        bakeTextures(scene, bakeSettings);
+    }
+    RenderSettings settings = jobSettings(job, scene);
+    settings.threads = threads;
+    LightList lights(scene.objects, static_cast<LightSelection>(job.lightSelection));
+    shared_ptr<Geometry> world = sceneHierarchy(scene, job.flat, threads);
+    Camera cam = jobCamera(job, scene);
+    auto prototype = makeSampler(settings.samplerType, settings.samplesPerPixel);
+    AuxBuffers aux;
+    if (job.aux) {
+        aux = AuxBuffers(settings.width, settings.height);
+    }
+
+    if (!sendMessage(fd, MessageType::Ready)) {
+        close(fd);
+        return 1;
+    }
+    std::vector<float> data;
+    while (recvMessage(fd, type, payload, sizeof(TileRequest)) && type == MessageType::Tile && payload.size() == sizeof(TileRequest)) {
+        TileRequest tile;
+        memcpy(&tile, payload.data(), sizeof(tile));
+        renderTile(*world, lights, cam, settings, job, *prototype, job.aux ? &aux : nullptr, tile, data);
+        if (!sendMessage(fd, MessageType::TileResult, &tile, sizeof(tile), data.data(), data.size() * sizeof(float))) {
+            break;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+//start a worker process on this machine that connects back to address, -1 if it can't be started
+pid_t spawnLocalWorker(const std::string& address, int threads) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Could not start a local worker: " << strerror(errno) << "\n";
+    } else if (pid == 0) {
+        std::string threadCount = std::to_string(threads);
+        execl("/proc/self/exe", "main", "--worker", address.c_str(), "--threads", threadCount.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+//the tiles of a frame, handed out to whichever worker asks next
+//tiles a lost worker had are put back for the others
+class TileQueue {
+    public:
+    TileQueue(int width, int height, int tileSize) {
+        for (int y0 = 0; y0 < height; y0 += tileSize) {
+            for (int x0 = 0; x0 < width; x0 += tileSize) {
+                int index = pending.size();
+                pending.push_back(TileRequest{index, x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height)});
+            }
+        }
+        total = pending.size();
+    }
+
+    //wait for a tile, false once every tile is finished
+    bool take(TileRequest& tile) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return !pending.empty() || finished == total; });
+        if (pending.empty()) {
+            return false;
+        }
+        tile = pending.front();
+        pending.pop_front();
+        return true;
+    }
+
+    void giveBack(const TileRequest& tile) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_front(tile);
+        changed.notify_one();
+    }
+
+    //returns how many tiles are still unfinished
+    int finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished++;
+        if (finished == total) {
+            changed.notify_all();
+        }
+        return total - finished;
+    }
+
+    bool done() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return finished == total;
+    }
+
+    private:
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<TileRequest> pending;
+    int total = 0;
+    int finished = 0;
+};
+
+//coordinator side: listen on address, optionally start localWorkers worker processes, and collect every
+//tile of the frame from whoever connects, returns false if the socket can't be opened or every local worker
+//exited before the frame was done
+bool renderDistributed(const RenderJob& job, const std::string& address, int localWorkers, int tileSize,
+    bool showProgress, FrameBuffer& image, AuxBuffers* aux) {
+    int listenFd = openSocket(address, true);
+    if (listenFd < 0) {
+        std::cerr << "Could not listen on " << address << "\n";
+        return false;
+    }
+    image = FrameBuffer(job.width, job.height);
+    if (aux) {
+        *aux = AuxBuffers(job.width, job.height);
+    }
+
+    std::vector<pid_t> children;
+    for (int i = 0; i < localWorkers; i++) {
+        //split this machine's threads between the local workers
+        int threads = std::max(1u, std::thread::hardware_concurrency() / localWorkers);
+        pid_t child = spawnLocalWorker(address, threads);
+        if (child > 0) {
+            children.push_back(child);
+        }
+    }
+
+    TileQueue queue(job.width, job.height, tileSize);
+    std::mutex outputMutex;
+    std::atomic<int> workers(0);
+    int channels = tileChannels(job);
+
+    auto serveWorker = [&](int fd) {
+        MessageType type;
+        std::vector<char> payload;
+        if (!sendMessage(fd, MessageType::Job, &job, sizeof(job)) || !recvMessage(fd, type, payload, 0)
+            || type != MessageType::Ready) {
+            close(fd);
+            return;
+        }
+        workers++;
+        TileRequest tile;
+        while (queue.take(tile)) {
+            size_t expected = sizeof(TileRequest) + (tile.x1 - tile.x0) * (tile.y1 - tile.y0) * channels * sizeof(float);
+            if (!sendMessage(fd, MessageType::Tile, &tile, sizeof(tile)) || !recvMessage(fd, type, payload, expected)
+                || type != MessageType::TileResult || payload.size() != expected) {
+                //the worker died or misbehaved, someone else renders its tile
+                queue.giveBack(tile);
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cerr << "\nLost a worker, tile " << tile.index << " reassigned\n";
+                workers--;
+                close(fd);
+                return;
+            }
+            const float* data = reinterpret_cast<const float*>(payload.data() + sizeof(TileRequest));
+            int tileWidth = tile.x1 - tile.x0;
+            for (int y = tile.y0; y < tile.y1; y++) {
+                for (int x = tile.x0; x < tile.x1; x++) {
+                    const float* pixel = data + ((y - tile.y0) * tileWidth + x - tile.x0) * channels;
+                    int index = y * job.width + x;
+                    image.pixels[index] = Vector3(pixel[0], pixel[1], pixel[2]);
+                    if (aux) {
+                        aux->albedo.pixels[index] = Vector3(pixel[3], pixel[4], pixel[5]);
+                        aux->normal.pixels[index] = Vector3(pixel[6], pixel[7], pixel[8]);
+                        aux->depth[index] = pixel[9];
+                        aux->variance[index] = pixel[10];
+                    }
+                }
+            }
+            int remaining = queue.finish();
+            if (showProgress) {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cerr << "\rTiles remaining: " << remaining << " (" << workers << " workers) " << std::flush;
+            }
+        }
+        sendMessage(fd, MessageType::Done);
+        workers--;
+        close(fd);
+    };
+
+    //keep accepting until the frame is done, workers may join (or rejoin) at any time
+    std::vector<std::thread> threads;
+    //connections being served, counted from accept() so a worker still handing over its Ready counts too
+    std::atomic<int> serving(0);
+    bool abandoned = false;
+    while (!queue.done()) {
+        pollfd listening{listenFd, POLLIN, 0};
+        if (poll(&listening, 1, 200) <= 0) {
+            //local workers that exited are reaped, once none are left and nobody else is connected the
+            //frame would never finish
+            for (auto it = children.begin(); it != children.end();) {
+                it = waitpid(*it, nullptr, WNOHANG) == *it ? children.erase(it) : it + 1;
+            }
+            if (localWorkers > 0 && children.empty() && serving == 0 && !queue.done()) {
+                abandoned = true;
+                break;
+            }
+            continue;
+        }
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd >= 0) {
+            serving++;
+            threads.emplace_back([&, fd]() {
+                serveWorker(fd);
+                serving--;
+            });
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    close(listenFd);
+    if (address.compare(0, 5, "unix:") == 0) {
+        unlink(address.substr(5).c_str());
+    }
+    for (pid_t child : children) {
+        waitpid(child, nullptr, 0);
+    }
+    if (abandoned) {
+        std::cerr << "\nEvery local worker exited and no other worker is connected, the frame can't be finished\n";
+        return false;
+    }
+    return true;
+}
+
+#endif /* DISTRIBUTED_HPP_*/
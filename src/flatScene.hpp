@@ -0,0 +1,540 @@
+#ifndef FLATSCENE_HPP_
+#define FLATSCENE_HPP_
+
+#include "./rtCommon.hpp"
+#include "./geometry.hpp"
+#include "./logeometry.hpp"
+#include "./bvh.hpp"
+#include "./sphere.hpp"
+#include "./movingSphere.hpp"
+#include "./XYRect.hpp"
+#include "./stats.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+//a data oriented copy of a scene for tracing rays against: every primitive type is kept in its own array of plain
+//structs, the BVH is an array of nodes whose leaves point at (type, index) pairs, and intersection switches on
+//the type instead of calling through a vtable
+//the scene is still built from the Geometry classes, which also stay what hit records point at, so lights,
+//materials and everything after the hit work as before
+
+enum class PrimitiveType : uint32_t { Sphere, MovingSphere, XYRect, XZRect, ZYRect,
+    //any other Geometry, hit through its virtual function
+    Other };
+
+struct SphereData {
+    Vector3 center;
+    float radius;
+};
+
+struct MovingSphereData {
+    Vector3 center0;
+    Vector3 center1;
+    float time0;
+    float time1;
+    float radius;
+};
+
+//an axis aligned rectangle at k along one axis, spanning [a0, a1] and [b0, b1] along the other two
+struct RectData {
+    float a0, a1, b0, b1, k;
+};
+
+//(type, index) of a primitive, packed into 32 bits: the type in the top 3, the index into its array below
+struct PrimitiveRef {
+    uint32_t bits;
+
+    PrimitiveRef(PrimitiveType type, uint32_t index) : bits(static_cast<uint32_t>(type) << 29 | index) {}
+    PrimitiveType type() const { return static_cast<PrimitiveType>(bits >> 29); }
+    uint32_t index() const { return bits & ((1u << 29) - 1); }
+};
+
+//32 bytes, two to a cache line
+struct FlatNode {
+    float boundsMin[3];
+    float boundsMax[3];
+    //interior nodes: index of the second child, the first one follows its parent
+    //leaves: index of the first primitive in FlatScene::refs
+    uint32_t offset;
+    //primitives in a leaf, 0 for interior nodes
+    uint16_t count;
+    //axis the node's children were split along
+    uint16_t axis;
+};
+
+//an array of plain structs that is either filled in here or points into memory owned elsewhere, like a mapped
+//scene cache (sceneCache.hpp), tracing reads both the same way
+template <typename T>
+class FlatArray {
+    public:
+    void push_back(const T& item) {
+        owned.push_back(item);
+        items = owned.data();
+        count = owned.size();
+    }
+    void reserve(size_t size) {
+        owned.reserve(size);
+        items = owned.data();
+    }
+    void clear() {
+        owned.clear();
+        count = 0;
+    }
+    //only for arrays filled in here
+    void set(size_t i, const T& item) {
+        owned[i] = item;
+    }
+    //read size items at data instead, which has to outlive this array
+    void view(const T* data, size_t size) {
+        owned = std::vector<T>();
+        items = data;
+        count = size;
+    }
+
+    const T& operator[](size_t i) const { return items[i]; }
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    private:
+    std::vector<T> owned;
+    const T* items = nullptr;
+    size_t count = 0;
+};
+
+//the primitives of one type, with the objects they were copied from
+template <typename Data>
+struct PrimitiveArray {
+    FlatArray<Data> data;
+    //what hit records point at, and the material they carry
+    std::vector<const Geometry*> sources;
+    std::vector<shared_ptr<Material>> materials;
+
+    uint32_t add(const Data& d, const Geometry* source) {
+        data.push_back(d);
+        sources.push_back(source);
+        materials.push_back(source->material());
+        return data.size() - 1;
+    }
+};
+
+//nearest root of the sphere's quadratic in (tMin, tMax), written exactly as Sphere::hit computes it
+inline bool sphereRoot(const Ray& ray, const Vector3& center, float radius, float tMin, float tMax, float& t) {
+    Vector3 A = ray.origin();
+    Vector3 B = ray.direction();
+    float a = B.dotProduct(B);
+    float b = (A - center).dotProduct(B) * 2.0;
+    float c = (A - center).dotProduct(A - center) - radius * radius;
+    float discriminant = b * b - 4 * a * c;
+    if (discriminant <= 0) {
+        return false;
+    }
+    float root = (-b - sqrt(discriminant)) / (2.0*a);
+    if (root < tMax && root > tMin) {
+        t = root;
+        return true;
+    }
+    root = (-b + sqrt(discriminant)) / (2.0*a);
+    if (root < tMax && root > tMin) {
+        t = root;
+        return true;
+    }
+    return false;
+}
+
+//rectangle on the plane where axis K is k, spanning axes A and B, as the XYRect classes compute it
+template <int K, int A, int B>
+inline bool rectHit(const Ray& ray, const RectData& rect, float tMin, float tMax, float& t) {
+    Vector3 origin = ray.origin();
+    Vector3 direction = ray.direction();
+    t = (rect.k - component(origin, K)) / component(direction, K);
+    if (t < tMin || t > tMax) {
+        return false;
+    }
+    float a = component(origin, A) + t*component(direction, A);
+    float b = component(origin, B) + t*component(direction, B);
+    return !(a < rect.a0 || a > rect.a1 || b < rect.b0 || b > rect.b1);
+}
+
+template <int K, int A, int B>
+inline void rectRecord(const Ray& ray, const RectData& rect, float t, hitRecord& rec) {
+    Vector3 origin = ray.origin();
+    Vector3 direction = ray.direction();
+    float a = component(origin, A) + t*component(direction, A);
+    float b = component(origin, B) + t*component(direction, B);
+    rec.u = (a - rect.a0) / (rect.a1 - rect.a0);
+    rec.v = (b - rect.b0) / (rect.b1 - rect.b0);
+    rec.t = t;
+    rec.setFaceNormal(ray, Vector3(K == 0, K == 1, K == 2));
+    rec.p = ray.pointAtParameter(t);
+}
+
+class FlatScene : public Geometry {
+    public:
+    //empty, for a scene cache to fill in
+    FlatScene() {}
+
+    //copy every primitive of objects (looking through lists and BVH nodes) into typed arrays and build a BVH over them
+    //with BVHBuilder on threads threads, 0 for every hardware thread
+    FlatScene(const LoGeometry& objects, int threads = 0) {
+        for (const auto& object : objects.objects) {
+            addObject(object.get());
+        }
+        BVHBuilder builder(refs.size(), threads, [&](size_t i, AABB& box) {
+            buildSources[i]->boundingBox(0, 1, box);
+        });
+        //a handful of primitives is tested fastest as one list, as sceneHierarchy does for the Geometry objects
+        leafSize = refs.size() <= 16 ? 16 : 4;
+        builder.build(leafSize);
+        std::vector<PrimitiveRef> unordered(refs.data(), refs.data() + refs.size());
+        refs.clear();
+        buildSources.clear();
+        if (!unordered.empty()) {
+            nodes.reserve(2 * unordered.size() / leafSize + 1);
+            refs.reserve(unordered.size());
+            addNode(builder, unordered, 0, 0, unordered.size());
+        }
+    }
+
+    //the hit record is filled from the typed arrays, without a virtual call for the built in primitives
+    virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const override;
+    //the candidate's object is the source primitive, for callers that want only t and what was hit
+    virtual bool closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const override;
+    //returns at the first primitive hit, children are taken in stored order with tMax never shrinking
+    virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+
+    virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+        const FlatNode& root = nodes[0];
+        outputBox = AABB(Vector3(root.boundsMin[0], root.boundsMin[1], root.boundsMin[2]),
+            Vector3(root.boundsMax[0], root.boundsMax[1], root.boundsMax[2]));
+        return true;
+    }
+
+    PrimitiveArray<SphereData> spheres;
+    PrimitiveArray<MovingSphereData> movingSpheres;
+    //one array per plane orientation, so the kernel for each knows its axes at compile time
+    PrimitiveArray<RectData> xyRects;
+    PrimitiveArray<RectData> xzRects;
+    PrimitiveArray<RectData> zyRects;
+    std::vector<const Geometry*> others;
+    FlatArray<FlatNode> nodes;
+    //leaf primitives, in BVH order
+    FlatArray<PrimitiveRef> refs;
+    //what the arrays point into when they were mapped from a scene cache
+    shared_ptr<const void> storage;
+
+    private:
+    //most primitives a leaf holds
+    size_t leafSize = 4;
+
+    //walk the tree for the closest hit, only its t and ref are kept, and otherCandidate if it is an Other
+    bool findClosest(const Ray& ray, float tMin, float tMax, float& closest, PrimitiveRef& closestRef,
+        HitCandidate& otherCandidate) const;
+
+    //t of ref's hit in (tMin, tMax), otherCandidate is set for an Other
+    bool primitiveHit(PrimitiveRef ref, const Ray& ray, float tMin, float tMax, float& t, HitCandidate& otherCandidate) const {
+        uint32_t index = ref.index();
+        switch (ref.type()) {
+            case PrimitiveType::Sphere:
+                RT_COUNT(SphereTests);
+                return sphereRoot(ray, spheres.data[index].center, spheres.data[index].radius, tMin, tMax, t);
+            case PrimitiveType::MovingSphere: {
+                RT_COUNT(MovingSphereTests);
+                const MovingSphereData& s = movingSpheres.data[index];
+                Vector3 center = s.center0 + (s.center1 - s.center0)*((ray.getTime() - s.time0) / (s.time1 - s.time0));
+                return sphereRoot(ray, center, s.radius, tMin, tMax, t);
+            }
+            case PrimitiveType::XYRect:
+                RT_COUNT(XYRectTests);
+                return rectHit<2, 0, 1>(ray, xyRects.data[index], tMin, tMax, t);
+            case PrimitiveType::XZRect:
+                RT_COUNT(XZRectTests);
+                return rectHit<1, 0, 2>(ray, xzRects.data[index], tMin, tMax, t);
+            case PrimitiveType::ZYRect:
+                RT_COUNT(ZYRectTests);
+                return rectHit<0, 1, 2>(ray, zyRects.data[index], tMin, tMax, t);
+            default:
+                if (!others[index]->closestHit(ray, tMin, tMax, otherCandidate)) {
+                    return false;
+                }
+                t = otherCandidate.t;
+                return true;
+        }
+    }
+
+    const Geometry* source(PrimitiveRef ref) const {
+        switch (ref.type()) {
+            case PrimitiveType::Sphere:
+                return spheres.sources[ref.index()];
+            case PrimitiveType::MovingSphere:
+                return movingSpheres.sources[ref.index()];
+            case PrimitiveType::XYRect:
+                return xyRects.sources[ref.index()];
+            case PrimitiveType::XZRect:
+                return xzRects.sources[ref.index()];
+            case PrimitiveType::ZYRect:
+                return zyRects.sources[ref.index()];
+            default:
+                return others[ref.index()];
+        }
+    }
+
+    void addObject(const Geometry* object) {
+        if (auto list = dynamic_cast<const LoGeometry*>(object)) {
+            for (const auto& child : list->objects) {
+                addObject(child.get());
+            }
+            return;
+        }
+        if (auto node = dynamic_cast<const BVHNode*>(object)) {
+            addObject(node->left.get());
+            //one-object nodes hold it on both sides
+            if (node->right != node->left) {
+                addObject(node->right.get());
+            }
+            return;
+        }
+        if (auto sphere = dynamic_cast<const Sphere*>(object)) {
+            addRef(PrimitiveType::Sphere, spheres.add(SphereData{sphere->center, sphere->radius}, object), object);
+        } else if (auto moving = dynamic_cast<const MovingSphere*>(object)) {
+            addRef(PrimitiveType::MovingSphere, movingSpheres.add(MovingSphereData{moving->center0, moving->center1,
+                moving->time0, moving->time1, moving->radius}, object), object);
+        } else if (auto rect = dynamic_cast<const XYRect*>(object)) {
+            addRef(PrimitiveType::XYRect, xyRects.add(RectData{rect->x0, rect->x1, rect->y0, rect->y1, rect->k}, object), object);
+        } else if (auto rect = dynamic_cast<const XZRect*>(object)) {
+            addRef(PrimitiveType::XZRect, xzRects.add(RectData{rect->x0, rect->x1, rect->z0, rect->z1, rect->k}, object), object);
+        } else if (auto rect = dynamic_cast<const ZYRect*>(object)) {
+            addRef(PrimitiveType::ZYRect, zyRects.add(RectData{rect->y0, rect->y1, rect->z0, rect->z1, rect->k}, object), object);
+        } else {
+            others.push_back(object);
+            addRef(PrimitiveType::Other, others.size() - 1, object);
+        }
+    }
+
+    void addRef(PrimitiveType type, uint32_t index, const Geometry* source) {
+        refs.push_back(PrimitiveRef(type, index));
+        buildSources.push_back(source);
+    }
+
+    //lay out the builder's subtree over its primitives [start, end), rooted in slot if it isn't a leaf, depth first
+    //with every node's first child right after it, and return the index of its node
+    uint32_t addNode(const BVHBuilder& builder, const std::vector<PrimitiveRef>& unordered, size_t slot, size_t start, size_t end) {
+        uint32_t index = nodes.size();
+        nodes.push_back(FlatNode());
+        FlatNode node;
+        BVHBuilder::Bounds bounds;
+        if (end - start <= leafSize) {
+            const auto& order = builder.order();
+            node.offset = refs.size();
+            node.count = end - start;
+            node.axis = 0;
+            for (size_t i = start; i < end; i++) {
+                bounds.grow(order[i].low, order[i].high);
+                refs.push_back(unordered[order[i].index]);
+            }
+        } else {
+            const BVHBuilder::Node& split = builder.tree()[slot];
+            bounds = split.bounds;
+            addNode(builder, unordered, slot + 1, start, split.mid);
+            node.offset = addNode(builder, unordered, slot + (split.mid - start), split.mid, end);
+            node.count = 0;
+            node.axis = split.axis;
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            node.boundsMin[axis] = bounds.low[axis];
+            node.boundsMax[axis] = bounds.high[axis];
+        }
+        nodes.set(index, node);
+        return index;
+    }
+
+    //objects the refs were made from, only needed while building
+    std::vector<const Geometry*> buildSources;
+};
+
+//slab test against a node's box with a precomputed inverse direction
+inline bool nodeHit(const FlatNode& node, const float origin[3], const float inverseDirection[3], float tMin, float tMax) {
+    for (int axis = 0; axis < 3; axis++) {
+        float t0 = (node.boundsMin[axis] - origin[axis]) * inverseDirection[axis];
+        float t1 = (node.boundsMax[axis] - origin[axis]) * inverseDirection[axis];
+        if (inverseDirection[axis] < 0) {
+            std::swap(t0, t1);
+        }
+        tMin = t0 > tMin ? t0 : tMin;
+        tMax = t1 < tMax ? t1 : tMax;
+        if (tMax < tMin) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FlatScene::findClosest(const Ray& ray, float tMin, float tMax, float& closest, PrimitiveRef& closestRef,
+    HitCandidate& otherCandidate) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    Vector3 direction = ray.direction();
+    float origin[3] = {ray.origin().getX(), ray.origin().getY(), ray.origin().getZ()};
+    float inverseDirection[3] = {1 / direction.getX(), 1 / direction.getY(), 1 / direction.getZ()};
+
+    //only the closest primitive gets a full hit record, the rest just report t
+    closest = tMax;
+    bool found = false;
+
+    uint32_t stack[64];
+    int stackSize = 0;
+    uint32_t current = 0;
+    while (true) {
+        const FlatNode& node = nodes[current];
+        RT_COUNT(BVHNodeVisits);
+        RT_COUNT(AABBTests);
+        if (nodeHit(node, origin, inverseDirection, tMin, closest)) {
+            if (node.count == 0) {
+                //visit the child on the ray's side of the split first, it is more likely to hold the closest hit
+                if (inverseDirection[node.axis] < 0) {
+                    stack[stackSize++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                PrimitiveRef ref = refs[i];
+                float t;
+                bool hitThis = primitiveHit(ref, ray, tMin, closest, t, otherCandidate);
+                if (hitThis) {
+                    found = true;
+                    closest = t;
+                    closestRef = ref;
+                }
+            }
+        }
+        if (stackSize == 0) {
+            break;
+        }
+        current = stack[--stackSize];
+    }
+    return found;
+}
+
+bool FlatScene::occluded(const Ray& ray, float tMin, float tMax) const {
+    if (nodes.empty()) {
+        return false;
+    }
+    Vector3 direction = ray.direction();
+    float origin[3] = {ray.origin().getX(), ray.origin().getY(), ray.origin().getZ()};
+    float inverseDirection[3] = {1 / direction.getX(), 1 / direction.getY(), 1 / direction.getZ()};
+    HitCandidate otherCandidate;
+
+    uint32_t stack[64];
+    int stackSize = 0;
+    uint32_t current = 0;
+    while (true) {
+        const FlatNode& node = nodes[current];
+        RT_COUNT(BVHNodeVisits);
+        RT_COUNT(AABBTests);
+        if (nodeHit(node, origin, inverseDirection, tMin, tMax)) {
+            if (node.count == 0) {
+                stack[stackSize++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                float t;
+                if (primitiveHit(refs[i], ray, tMin, tMax, t, otherCandidate)) {
+                    return true;
+                }
+            }
+        }
+        if (stackSize == 0) {
+            break;
+        }
+        current = stack[--stackSize];
+    }
+    return false;
+}
+
+bool FlatScene::closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const {
+    float closest;
+    PrimitiveRef ref(PrimitiveType::Other, 0);
+    HitCandidate otherCandidate;
+    if (!findClosest(ray, tMin, tMax, closest, ref, otherCandidate)) {
+        return false;
+    }
+    if (ref.type() == PrimitiveType::Other) {
+        candidate = otherCandidate;
+    } else {
+        candidate.t = closest;
+        candidate.object = source(ref);
+    }
+    return true;
+}
+
+bool FlatScene::hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const {
+    float closest;
+    PrimitiveRef closestRef(PrimitiveType::Other, 0);
+    HitCandidate otherCandidate;
+    if (!findClosest(ray, tMin, tMax, closest, closestRef, otherCandidate)) {
+        return false;
+    }
+
+    uint32_t index = closestRef.index();
+    switch (closestRef.type()) {
+        case PrimitiveType::Sphere: {
+            const SphereData& s = spheres.data[index];
+            rec.t = closest;
+            rec.p = ray.pointAtParameter(closest);
+            rec.normal = (rec.p - s.center) / s.radius;
+            rec.setFaceNormal(ray, rec.normal);
+            if (spheres.materials[index]->needsUV()) {
+                getSphereUV((rec.p - s.center) / s.radius, rec.u, rec.v);
+            } else {
+                rec.u = 0;
+                rec.v = 0;
+            }
+            rec.matPtr = spheres.materials[index];
+            rec.object = spheres.sources[index];
+            break;
+        }
+        case PrimitiveType::MovingSphere: {
+            const MovingSphereData& s = movingSpheres.data[index];
+            Vector3 center = s.center0 + (s.center1 - s.center0)*((ray.getTime() - s.time0) / (s.time1 - s.time0));
+            rec.t = closest;
+            rec.p = ray.pointAtParameter(closest);
+            rec.normal = (rec.p - center) / s.radius;
+            rec.setFaceNormal(ray, rec.normal);
+            rec.matPtr = movingSpheres.materials[index];
+            rec.object = movingSpheres.sources[index];
+            break;
+        }
+        case PrimitiveType::XYRect:
+            rectRecord<2, 0, 1>(ray, xyRects.data[index], closest, rec);
+            rec.matPtr = xyRects.materials[index];
+            rec.object = xyRects.sources[index];
+            break;
+        case PrimitiveType::XZRect:
+            rectRecord<1, 0, 2>(ray, xzRects.data[index], closest, rec);
+            rec.matPtr = xzRects.materials[index];
+            rec.object = xzRects.sources[index];
+            break;
+        case PrimitiveType::ZYRect:
+            rectRecord<0, 1, 2>(ray, zyRects.data[index], closest, rec);
+            rec.matPtr = zyRects.materials[index];
+            rec.object = zyRects.sources[index];
+            break;
+        case PrimitiveType::Other:
+            otherCandidate.object->surfaceHit(ray, otherCandidate, rec);
+            break;
+    }
+    return true;
+}
+
+#endif /* FLATSCENE_HPP_*/
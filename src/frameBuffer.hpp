@@ -0,0 +1,77 @@
+#ifndef FRAMEBUFFER_HPP_
+#define FRAMEBUFFER_HPP_
+
+#include "./rtCommon.hpp"
+#include <vector>
+
+//holds the final (sample averaged, linear) color of every pixel in a frame
+//row 0 is the top of the image, matching the order pixels are written to file
+class FrameBuffer {
+    public:
+    FrameBuffer() : width(0), height(0) {}
+    FrameBuffer(int w, int h) : width(w), height(h), pixels(w*h, Vector3(0, 0, 0)) {}
+
+    Vector3& at(int x, int y) {
+        return pixels[y*width + x];
+    }
+
+    const Vector3& at(int x, int y) const {
+        return pixels[y*width + x];
+    }
+
+    int width;
+    int height;
+    std::vector<Vector3> pixels;
+};
+
+//first hit surface information gathered alongside the color of each pixel, averaged over its samples
+//the denoiser uses these to tell noise apart from real edges
+class AuxBuffers {
+    public:
+    AuxBuffers(){}
+    AuxBuffers(int w, int h)
+    : albedo(w, h), normal(w, h), depth(w*h, 0), variance(w*h, 0) {}
+
+    FrameBuffer albedo;
+    FrameBuffer normal;
+    //distance from the camera to the first hit, 0 where the ray escaped
+    std::vector<float> depth;
+    //variance of the pixel's mean luminance, estimated from its samples
+    std::vector<float> variance;
+};
+
+//what each pixel cost to render, for finding the expensive parts of a scene
+class CostBuffers {
+    public:
+    CostBuffers(){}
+    CostBuffers(int w, int h)
+    : width(w), height(h), seconds(w*h, 0), bounces(w*h, 0), nodes(w*h, 0) {}
+
+    int width = 0;
+    int height = 0;
+    //wall time spent on the pixel
+    std::vector<float> seconds;
+    //bounces per sample, averaged over the pixel's samples
+    std::vector<float> bounces;
+    //BVH nodes visited by all of the pixel's rays, only counted when built with RT_STATS
+    std::vector<float> nodes;
+};
+
+inline float luminance(const Vector3& c) {
+    return 0.2126*c.getX() + 0.7152*c.getY() + 0.0722*c.getZ();
+}
+
+//root mean square error between two images of the same size, over all color channels
+//colors are clamped to the displayable range first, since that is all a reference ppm holds
+float imageRMSE(const FrameBuffer& image, const FrameBuffer& reference) {
+    auto clamp = [](const Vector3& c) {
+        return Vector3(restrictColor(c.getX(), 0, 1), restrictColor(c.getY(), 0, 1), restrictColor(c.getZ(), 0, 1));
+    };
+    double sum = 0;
+    for (size_t i = 0; i < image.pixels.size(); i++) {
+        sum += (clamp(image.pixels[i]) - clamp(reference.pixels[i])).vecLengthSquared();
+    }
+    return sqrt(sum / (3.0 * image.pixels.size()));
+}
+
+#endif /* FRAMEBUFFER_HPP_*/
@@ -0,0 +1,146 @@
+#ifndef GBUFFER_HPP_
+#define GBUFFER_HPP_
+
+#include "./rtCommon.hpp"
+#include "./geometry.hpp"
+#include "./logeometry.hpp"
+#include "./bvh.hpp"
+#include "./scenes.hpp"
+#include "./render.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//the first vertex of every sample of a frame, kept on disk so that after editing materials or textures the frame
+//can be shaded again without tracing its camera rays or the shadow rays at their first hits
+//primitives are stored by their position in the scene's object list (nested lists flattened in order), and a
+//file is only used for the geometry (every primitive's bounding box), view and sample pattern it was made with
+class GBufferCache {
+    public:
+    GBufferCache(const Scene& scene, const RenderSettings& settings) {
+        collect(scene.objects);
+        header.version = version;
+        header.width = settings.width;
+        header.height = settings.height;
+        header.samplesPerPixel = settings.samplesPerPixel;
+        header.samplerType = static_cast<int32_t>(settings.samplerType);
+        header.primitiveCount = static_cast<int32_t>(primitives.size());
+        for (const Geometry* primitive : primitives) {
+            AABB box;
+            primitive->boundingBox(0, 1, box);
+            Vector3 corners[2] = {box.min(), box.max()};
+            header.geometryHash = hashBytes(header.geometryHash, corners, sizeof(corners));
+        }
+        float view[] = {scene.lookfrom.getX(), scene.lookfrom.getY(), scene.lookfrom.getZ(),
+            scene.lookat.getX(), scene.lookat.getY(), scene.lookat.getZ(), scene.vfov, scene.aperture, scene.aspectRatio};
+        header.viewHash = hashBytes(header.viewHash, view, sizeof(view));
+        vertices.resize(size_t(settings.width) * settings.height * settings.samplesPerPixel);
+    }
+
+    //replace vertices with the ones in fileName, false if there is no such file or it was made for a different
+    //scene, view or sample pattern, in which case rendering records them afresh
+    bool load(const std::string& fileName) {
+        std::ifstream file(fileName, std::ios::binary);
+        Header stored;
+        if (!file || !file.read(reinterpret_cast<char*>(&stored), sizeof(stored)) || memcmp(&stored, &header, sizeof(header))) {
+            return false;
+        }
+        std::vector<int32_t> ids(vertices.size() * 3);
+        if (!file.read(reinterpret_cast<char*>(ids.data()), ids.size() * sizeof(int32_t))) {
+            return false;
+        }
+        for (size_t i = 0; i < vertices.size(); i++) {
+            PrimaryVertex& vertex = vertices[i];
+            vertex.recorded = true;
+            vertex.object = primitive(ids[3*i]);
+            vertex.light = primitive(ids[3*i + 1]);
+            vertex.shadowObject = primitive(ids[3*i + 2]);
+        }
+        return true;
+    }
+
+    //write the vertices a render recorded to fileName
+    bool save(const std::string& fileName) const {
+        std::vector<int32_t> ids(vertices.size() * 3);
+        for (size_t i = 0; i < vertices.size(); i++) {
+            ids[3*i] = id(vertices[i].object);
+            ids[3*i + 1] = id(vertices[i].light);
+            ids[3*i + 2] = id(vertices[i].shadowObject);
+        }
+        std::ofstream file(fileName, std::ios::binary);
+        if (!file) {
+            std::cerr << "Error: could not open " << fileName << " for writing\n";
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(int32_t));
+        return static_cast<bool>(file);
+    }
+
+    //one per sample, for RenderSettings::primaryVertices
+    std::vector<PrimaryVertex> vertices;
+
+    private:
+    static const uint32_t version = 1;
+
+    struct Header {
+        char magic[4] = {'R', 'T', 'G', 'B'};
+        uint32_t version = 0;
+        uint64_t geometryHash = 14695981039346656037ull;
+        uint64_t viewHash = 14695981039346656037ull;
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t samplesPerPixel = 0;
+        int32_t samplerType = 0;
+        int32_t primitiveCount = 0;
+        int32_t padding = 0;
+    };
+
+    //FNV-1a
+    static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void collect(const Geometry& object) {
+        if (auto list = dynamic_cast<const LoGeometry*>(&object)) {
+            for (const auto& child : list->objects) {
+                collect(*child);
+            }
+            return;
+        }
+        if (auto node = dynamic_cast<const BVHNode*>(&object)) {
+            collect(*node->left);
+            //one-object nodes hold it on both sides
+            if (node->right != node->left) {
+                collect(*node->right);
+            }
+            return;
+        }
+        ids.emplace(&object, static_cast<int32_t>(primitives.size()));
+        primitives.push_back(&object);
+    }
+
+    const Geometry* primitive(int32_t id) const {
+        return id >= 0 && id < static_cast<int32_t>(primitives.size()) ? primitives[id] : nullptr;
+    }
+
+    int32_t id(const Geometry* object) const {
+        auto found = ids.find(object);
+        return found == ids.end() ? -1 : found->second;
+    }
+
+    Header header;
+    std::vector<const Geometry*> primitives;
+    std::unordered_map<const Geometry*, int32_t> ids;
+};
+
+#endif /* GBUFFER_HPP_*/
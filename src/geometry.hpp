@@ -4,6 +4,7 @@
 #include "./AABB.hpp"
 
 class Material; //alert compiler that pointer is to a class
+class Geometry;
 
 //contains necessary arguments and info
 struct hitRecord {
@@ -19,6 +20,8 @@ struct hitRecord {
     Vector3 normal;
     //Materials
     shared_ptr<Material> matPtr;
+    //the primitive that was hit
+    const Geometry* object = nullptr;
 
     bool frontFace;
 
@@ -30,12 +33,74 @@ struct hitRecord {
     }
 };
 
+//the closest hit a search through the scene found, before any of its surface attributes are worked out
+struct HitCandidate {
+    //t of the hit
+    float t;
+    //the primitive that was hit, whose surfaceHit() fills in the rest
+    const Geometry* object = nullptr;
+};
+
 //Geometry represents either a single piece of geometry like a sphere, or a list of multiple geometry.
 class Geometry {
     public:
+    //the closest hit in (tMin, tMax) and the primitive it is on, without its point, normal, uv or material, so
+    //hits that a closer one replaces cost only their t, candidate is only written when it returns true
     //virtual function ensures we always override the function 
-    virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const=0;
+    virtual bool closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const=0;
+    //fill rec for a candidate closestHit() found on this primitive, lists and trees are never a candidate
+    virtual void surfaceHit(const Ray& ray, const HitCandidate& candidate, hitRecord& rec) const {}
+    //the closest hit in (tMin, tMax) with all of its surface attributes
+    virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const {
+        HitCandidate candidate;
+        if (!closestHit(ray, tMin, tMax, candidate)) {
+            return false;
+        }
+        candidate.object->surfaceHit(ray, candidate, rec);
+        return true;
+    }
+    //true if anything is hit in (tMin, tMax), for shadow and visibility rays that only need a yes or no
+    //lists and trees stop at the first hit they find, in whatever order, a primitive's closestHit is already that
+    virtual bool occluded(const Ray& ray, float tMin, float tMax) const {
+        HitCandidate candidate;
+        return closestHit(ray, tMin, tMax, candidate);
+    }
     virtual bool boundingBox(float t0, float t1, AABB& outputBox) const = 0;
+
+    //material of a single primitive, lists and trees have none
+    virtual shared_ptr<Material> material() const { return nullptr; }
+
+    //light sampling, for shapes that can be used as lights
+    //pick a unit direction from origin towards a point on the shape, returning false if the shape can't be sampled from there
+    virtual bool sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const {
+        return false;
+    }
+    //solid angle pdf of sampleDirection choosing direction from origin
+    virtual float directionPdf(const Vector3& origin, const Vector3& direction) const {
+        return 0;
+    }
+    //surface area, used to estimate how much power a light emits
+    virtual float surfaceArea() const {
+        return 0;
+    }
+    //texture baking: the point at surface coordinates (u, v), false for shapes whose u, v don't pin one down
+    virtual bool surfacePoint(float u, float v, Vector3& p) const {
+        return false;
+    }
+    //texture baking: how long the surface is along u and along v in world units, and whether u wraps around
+    virtual void surfaceExtent(float& uLength, float& vLength, bool& wrapU) const {
+        uLength = vLength = 0;
+        wrapU = false;
+    }
+    //swap the primitive's material, for shapes that have one
+    virtual void setMaterial(shared_ptr<Material> m) {}
+    //the cone around axis that holds every surface normal, cosTheta -1 if the normals face every way
+    //twoSided shapes emit along -axis as well
+    virtual void normalCone(Vector3& axis, float& cosTheta, bool& twoSided) const {
+        axis = Vector3(0, 0, 1);
+        cosTheta = -1;
+        twoSided = false;
+    }
 };
 
 
@@ -0,0 +1,323 @@
+#ifndef IMAGESTREAM_HPP_
+#define IMAGESTREAM_HPP_
+
+#include "./rtCommon.hpp"
+#include "./color.hpp"
+#include "./trace.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//writing a frame out band by band as its tiles finish, so an image far too big to hold (a 32k x 32k poster is
+//12GB of floats) only ever has a few bands of rows in memory
+
+//the [0, 255] value writeColor stores for a linear color channel
+inline int displayByte(float linear) {
+    float c = sqrt(1.0 * linear);
+    return static_cast<int>(256 * restrictColor(c, 0.0, 0.999));
+}
+
+//encodes bands of rows into one file, given in order from the top of the image down
+class BandEncoder {
+    public:
+    virtual ~BandEncoder() {}
+    //false if the file couldn't be opened
+    virtual bool begin(const std::string& fileName, int width, int height) = 0;
+    virtual void writeBand(const Vector3* pixels, int y, int rows) = 0;
+    //false if anything failed to write
+    virtual bool finish() = 0;
+};
+
+//P3, the same text writeImage produces
+class PPMEncoder : public BandEncoder {
+    public:
+    virtual bool begin(const std::string& fileName, int w, int h) override {
+        width = w;
+        file.open(fileName);
+        file << "P3\n" << w << " " << h << "\n255\n";
+        return static_cast<bool>(file);
+    }
+
+    virtual void writeBand(const Vector3* pixels, int y, int rows) override {
+        std::ostringstream out;
+        for (int i = 0; i < width * rows; i++) {
+            writeColor(out, pixels[i], 1);
+        }
+        file << out.str();
+    }
+
+    virtual bool finish() override {
+        file.close();
+        return static_cast<bool>(file);
+    }
+
+    private:
+    std::ofstream file;
+    int width = 0;
+};
+
+//8 bit RGB, each band one IDAT chunk of stored (uncompressed) deflate blocks, which needs no zlib
+class PNGEncoder : public BandEncoder {
+    public:
+    virtual bool begin(const std::string& fileName, int w, int h) override {
+        width = w;
+        file.open(fileName, std::ios::binary);
+        const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+        std::vector<unsigned char> header;
+        putBigEndian(header, w);
+        putBigEndian(header, h);
+        //8 bits per channel, truecolor, deflate, adaptive filtering, no interlace
+        header.insert(header.end(), {8, 2, 0, 0, 0});
+        writeChunk("IHDR", header);
+        return static_cast<bool>(file);
+    }
+
+    virtual void writeBand(const Vector3* pixels, int y, int rows) override {
+        //each row starts with its filter type, 0 for none
+        std::vector<unsigned char> raw;
+        raw.reserve(size_t(rows) * (1 + 3*width));
+        for (int row = 0; row < rows; row++) {
+            raw.push_back(0);
+            for (int x = 0; x < width; x++) {
+                const Vector3& pixel = pixels[size_t(row) * width + x];
+                raw.push_back(displayByte(pixel.getX()));
+                raw.push_back(displayByte(pixel.getY()));
+                raw.push_back(displayByte(pixel.getZ()));
+            }
+        }
+        std::vector<unsigned char> data;
+        if (!started) {
+            //zlib header: deflate with a 32k window, no dictionary
+            data.insert(data.end(), {0x78, 0x01});
+            started = true;
+        }
+        for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+            size_t length = std::min<size_t>(65535, raw.size() - offset);
+            storedBlock(data, &raw[offset], length, false);
+        }
+        for (unsigned char byte : raw) {
+            adlerA = (adlerA + byte) % 65521;
+            adlerB = (adlerB + adlerA) % 65521;
+        }
+        writeChunk("IDAT", data);
+    }
+
+    virtual bool finish() override {
+        std::vector<unsigned char> data;
+        storedBlock(data, nullptr, 0, true);
+        putBigEndian(data, adlerB << 16 | adlerA);
+        writeChunk("IDAT", data);
+        writeChunk("IEND", std::vector<unsigned char>());
+        file.close();
+        return static_cast<bool>(file);
+    }
+
+    private:
+    static void putBigEndian(std::vector<unsigned char>& out, uint32_t value) {
+        out.insert(out.end(), {static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+            static_cast<unsigned char>(value >> 8), static_cast<unsigned char>(value)});
+    }
+
+    static void storedBlock(std::vector<unsigned char>& out, const unsigned char* bytes, size_t length, bool last) {
+        out.push_back(last ? 1 : 0);
+        out.insert(out.end(), {static_cast<unsigned char>(length), static_cast<unsigned char>(length >> 8),
+            static_cast<unsigned char>(~length), static_cast<unsigned char>(~length >> 8)});
+        out.insert(out.end(), bytes, bytes + length);
+    }
+
+    static uint32_t crc32(uint32_t crc, const unsigned char* bytes, size_t length) {
+        static uint32_t table[256];
+        static bool tableReady = false;
+        if (!tableReady) {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                }
+                table[n] = c;
+            }
+            tableReady = true;
+        }
+        for (size_t i = 0; i < length; i++) {
+            crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    void writeChunk(const char* type, const std::vector<unsigned char>& data) {
+        std::vector<unsigned char> length;
+        putBigEndian(length, data.size());
+        file.write(reinterpret_cast<const char*>(length.data()), 4);
+        file.write(type, 4);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        uint32_t crc = crc32(0xffffffffu, reinterpret_cast<const unsigned char*>(type), 4);
+        crc = crc32(crc, data.data(), data.size()) ^ 0xffffffffu;
+        std::vector<unsigned char> check;
+        putBigEndian(check, crc);
+        file.write(reinterpret_cast<const char*>(check.data()), 4);
+    }
+
+    std::ofstream file;
+    int width = 0;
+    bool started = false;
+    uint32_t adlerA = 1;
+    uint32_t adlerB = 0;
+};
+
+//little endian PFM, linear floats with no gamma or clamping
+//PFM stores rows bottom to top, the file's size is known up front so each band is written at its place in it
+class PFMEncoder : public BandEncoder {
+    public:
+    virtual bool begin(const std::string& fileName, int w, int h) override {
+        width = w;
+        height = h;
+        file.open(fileName, std::ios::binary);
+        std::ostringstream header;
+        header << "PF\n" << w << " " << h << "\n-1.0\n";
+        file << header.str();
+        dataStart = header.str().size();
+        return static_cast<bool>(file);
+    }
+
+    virtual void writeBand(const Vector3* pixels, int y, int rows) override {
+        std::vector<float> row(3 * width);
+        for (int r = 0; r < rows; r++) {
+            for (int x = 0; x < width; x++) {
+                const Vector3& pixel = pixels[size_t(r) * width + x];
+                row[3*x] = pixel.getX();
+                row[3*x + 1] = pixel.getY();
+                row[3*x + 2] = pixel.getZ();
+            }
+            file.seekp(dataStart + std::streamoff(height - 1 - (y + r)) * width * 3 * sizeof(float));
+            file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+        }
+    }
+
+    virtual bool finish() override {
+        file.close();
+        return static_cast<bool>(file);
+    }
+
+    private:
+    std::ofstream file;
+    int width = 0;
+    int height = 0;
+    std::streamoff dataStart = 0;
+};
+
+//the encoder for fileName's extension: .png, .pfm, anything else is a ppm
+inline std::unique_ptr<BandEncoder> makeBandEncoder(const std::string& fileName) {
+    auto endsWith = [&](const char* extension) {
+        size_t length = strlen(extension);
+        return fileName.size() >= length && fileName.compare(fileName.size() - length, length, extension) == 0;
+    };
+    if (endsWith(".png")) {
+        return std::unique_ptr<BandEncoder>(new PNGEncoder());
+    }
+    if (endsWith(".pfm")) {
+        return std::unique_ptr<BandEncoder>(new PFMEncoder());
+    }
+    return std::unique_ptr<BandEncoder>(new PPMEncoder());
+}
+
+//takes the tiles of a frame in whatever order threads finish them and writes each band of rows once all of its
+//tiles are in, in order from the top down
+//only bandsInFlight bands are held at once, a thread about to start a tile further down waits for the oldest band
+//to be written, so memory stays at bandsInFlight * bandHeight rows whatever the image's size
+//bandHeight should be a multiple of the tile size, so no tile straddles two bands
+class ImageStream {
+    public:
+    ImageStream(const std::string& fileName, int width, int height, int bandHeight, int bandsInFlight = 2)
+    : width(width), height(height), bandHeight(bandHeight), slots(bandsInFlight),
+      bandCount((height + bandHeight - 1) / bandHeight), encoder(makeBandEncoder(fileName)),
+      pixels(size_t(bandsInFlight) * bandHeight * width), done(bandsInFlight, 0) {
+        ok = encoder->begin(fileName, width, height);
+        if (!ok) {
+            std::cerr << "Error: could not open " << fileName << " for writing\n";
+        }
+    }
+
+    //wait until the band holding row y has room, before rendering a tile that starts there
+    void beginTile(int y) {
+        std::unique_lock<std::mutex> lock(mutex);
+        int band = y / bandHeight;
+        bandFree.wait(lock, [&]() { return band < firstBand + slots; });
+    }
+
+    //where pixel (x, y) of a tile between beginTile and endTile goes
+    Vector3& at(int x, int y) {
+        return pixels[(size_t((y / bandHeight) % slots) * bandHeight + y % bandHeight) * width + x];
+    }
+
+    //hand over the finished tile [x0, x1) x [y0, y1), writing out every band it completes
+    void endTile(int x0, int y0, int x1, int y1) {
+        std::unique_lock<std::mutex> lock(mutex);
+        done[(y0 / bandHeight) % slots] += size_t(x1 - x0) * (y1 - y0);
+        //one thread writes at a time, any bands that complete meanwhile it writes too
+        if (writing) {
+            return;
+        }
+        writing = true;
+        while (firstBand < bandCount && done[firstBand % slots] == bandPixels(firstBand)) {
+            int band = firstBand;
+            lock.unlock();
+            {
+                TraceScope trace("write band", "output");
+                trace.arg("y", band * bandHeight);
+                encoder->writeBand(&pixels[size_t(band % slots) * bandHeight * width], band * bandHeight, bandRows(band));
+            }
+            lock.lock();
+            done[band % slots] = 0;
+            firstBand++;
+            bandFree.notify_all();
+        }
+        writing = false;
+    }
+
+    //close the file once every tile is in, false if it didn't all get written
+    bool finish() {
+        return ok && firstBand == bandCount && encoder->finish();
+    }
+
+    //bytes of pixels held, the most this frame ever needs
+    size_t bufferBytes() const {
+        return pixels.size() * sizeof(Vector3);
+    }
+
+    bool ok = false;
+
+    private:
+    int bandRows(int band) const {
+        return std::min(bandHeight, height - band * bandHeight);
+    }
+
+    size_t bandPixels(int band) const {
+        return size_t(bandRows(band)) * width;
+    }
+
+    int width;
+    int height;
+    int bandHeight;
+    int slots;
+    int bandCount;
+    std::unique_ptr<BandEncoder> encoder;
+    //slots bands, band b in slot b % slots
+    std::vector<Vector3> pixels;
+    //pixels finished in each slot's band
+    std::vector<size_t> done;
+    //oldest band not written yet
+    int firstBand = 0;
+    bool writing = false;
+    std::mutex mutex;
+    std::condition_variable bandFree;
+};
+
+#endif /* IMAGESTREAM_HPP_*/
@@ -5,6 +5,7 @@
 #include "./rtSTBImage.h"
 #include "./perlinNoise.hpp"
 #include "./texture.hpp"
+#include "./trace.hpp"
 #include <string>
 
 #include <iostream>
@@ -13,8 +14,9 @@ class ImageTexture : public Texture {
     public:
         const static int bytesPerPixel = 3;
 
-        ImageTexture(const char* fileName) {
+        ImageTexture(const char* fileName) : fileName(fileName) {
             auto componentsPerPixel = bytesPerPixel;
+            TraceScope trace("decode texture", "setup");
 
             std::cout << fileName;
         
@@ -68,6 +70,9 @@ class ImageTexture : public Texture {
         delete data;
     }
 
+    //where the image was loaded from
+    std::string fileName;
+
     private:
     unsigned char *data;
     int width;
@@ -0,0 +1,330 @@
+#ifndef LIGHTS_HPP_
+#define LIGHTS_HPP_
+
+#include "./rtCommon.hpp"
+#include "./geometry.hpp"
+#include "./logeometry.hpp"
+#include "./material.hpp"
+#include "./sampler.hpp"
+#include "./frameBuffer.hpp"
+#include "./trace.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+//a direction towards one light, chosen by LightList::sample
+struct LightSample {
+    //unit direction from the shading point
+    Vector3 direction;
+    //solid angle pdf, including the probability of having picked this light
+    float pdf;
+    const Geometry* light;
+};
+
+//a cone of directions, cosTheta -1 is the whole sphere
+struct DirectionCone {
+    Vector3 axis = Vector3(0, 0, 1);
+    float cosTheta = 1;
+};
+
+//smallest cone holding both a and b (pbrt-v4's DirectionCone::Union)
+inline DirectionCone coneUnion(const DirectionCone& a, const DirectionCone& b) {
+    float thetaA = acos(restrictColor(a.cosTheta, -1, 1));
+    float thetaB = acos(restrictColor(b.cosTheta, -1, 1));
+    float thetaD = acos(restrictColor(a.axis.dotProduct(b.axis), -1, 1));
+    if (fmin(thetaD + thetaB, pi) <= thetaA) {
+        return a;
+    }
+    if (fmin(thetaD + thetaA, pi) <= thetaB) {
+        return b;
+    }
+    float thetaO = (thetaA + thetaD + thetaB) / 2;
+    Vector3 rotationAxis = a.axis.crossProduct(b.axis);
+    if (thetaO >= pi || rotationAxis.vecLengthSquared() == 0) {
+        return DirectionCone{Vector3(0, 0, 1), -1};
+    }
+    //rotate a's axis towards b's until the cone just holds both (Rodrigues' rotation formula)
+    rotationAxis.normalize();
+    float thetaR = thetaO - thetaA;
+    Vector3 axis = a.axis*cos(thetaR) + rotationAxis.crossProduct(a.axis)*sin(thetaR)
+        + rotationAxis*(rotationAxis.dotProduct(a.axis)*(1 - cos(thetaR)));
+    return DirectionCone{unitVector(axis), cos(thetaO)};
+}
+
+//what a group of lights looks like from far away: where they are, which way they face and how bright they are
+struct LightBounds {
+    AABB bounds;
+    //surface normals lie within this cone
+    DirectionCone normals;
+    //light leaves a surface at most this far (as a cosine) from its normal, 0 for diffuse emitters
+    float cosThetaE = 0;
+    //total emitted power
+    float power = 0;
+    bool twoSided = false;
+};
+
+inline LightBounds lightBoundsUnion(const LightBounds& a, const LightBounds& b) {
+    if (a.power == 0) {
+        return b;
+    }
+    if (b.power == 0) {
+        return a;
+    }
+    LightBounds result;
+    result.bounds = surroundingBox(a.bounds, b.bounds);
+    result.normals = coneUnion(a.normals, b.normals);
+    result.cosThetaE = fmin(a.cosThetaE, b.cosThetaE);
+    result.power = a.power + b.power;
+    result.twoSided = a.twoSided || b.twoSided;
+    return result;
+}
+
+//conservative estimate of how much light a group sends towards point (pbrt-v4's LightBounds::Importance):
+//power over squared distance, times the cosine at the emitter once the normal cone and the
+//cone the box subtends from point are both used up, zero if no normal can face point
+inline float lightImportance(const LightBounds& light, const Vector3& point) {
+    Vector3 center = (light.bounds.min() + light.bounds.max()) * 0.5;
+    Vector3 toPoint = point - center;
+    float distanceSquared = toPoint.vecLengthSquared();
+    float radiusSquared = (light.bounds.max() - center).vecLengthSquared();
+    //inside the bounding sphere every direction is possible and the distance means little
+    if (distanceSquared <= radiusSquared) {
+        return light.power / fmax(radiusSquared, 1e-8f);
+    }
+
+    //cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+    auto cosSubClamped = [](float sinA, float cosA, float sinB, float cosB) {
+        return cosA > cosB ? 1.0f : cosA*cosB + sinA*sinB;
+    };
+    auto sinSubClamped = [](float sinA, float cosA, float sinB, float cosB) {
+        return cosA > cosB ? 0.0f : sinA*cosB - cosA*sinB;
+    };
+
+    float cosThetaW = toPoint.dotProduct(light.normals.axis) / sqrt(distanceSquared);
+    if (light.twoSided) {
+        cosThetaW = fabs(cosThetaW);
+    }
+    float sinThetaW = sqrt(fmax(0.0f, 1 - cosThetaW*cosThetaW));
+    float cosThetaO = light.normals.cosTheta;
+    float sinThetaO = sqrt(fmax(0.0f, 1 - cosThetaO*cosThetaO));
+    float cosThetaB = sqrt(1 - radiusSquared / distanceSquared);
+    float sinThetaB = sqrt(radiusSquared / distanceSquared);
+
+    float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+    float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= light.cosThetaE) {
+        return 0;
+    }
+    return light.power * cosThetaP / distanceSquared;
+}
+
+//how lights are picked for next event estimation
+enum class LightSelection {
+    //every light is equally likely
+    Uniform,
+    //walk a tree of light bounds, picking the child that contributes more to the shading point more often
+    Tree
+};
+
+//every primitive in the scene with an emissive material, for next event estimation
+class LightList {
+    public:
+    LightList(){}
+
+    LightList(const LoGeometry& scene, LightSelection s = LightSelection::Tree) : selection(s) {
+        TraceScope trace("build light list", "setup");
+        std::vector<LightBounds> bounds;
+        for (const auto& object : scene.objects) {
+            auto material = object->material();
+            if (!material || !material->isEmissive()) {
+                continue;
+            }
+            LightBounds light;
+            if (!object->boundingBox(0, 1, light.bounds)) {
+                continue;
+            }
+            Vector3 center = (light.bounds.min() + light.bounds.max()) * 0.5;
+            light.power = pi * object->surfaceArea() * luminance(material->emitted(0.5, 0.5, center));
+            object->normalCone(light.normals.axis, light.normals.cosTheta, light.twoSided);
+            if (light.twoSided) {
+                light.power *= 2;
+            }
+            //a light with no power, or no area to sample, can never be picked by the tree
+            if (selection == LightSelection::Tree && light.power <= 0) {
+                continue;
+            }
+            trails[object.get()] = 0;
+            lights.push_back(object);
+            bounds.push_back(light);
+        }
+        if (selection == LightSelection::Tree && !lights.empty()) {
+            std::vector<int> order(lights.size());
+            for (size_t i = 0; i < order.size(); i++) {
+                order[i] = i;
+            }
+            nodes.reserve(2 * lights.size());
+            buildTree(bounds, order, 0, order.size(), 0, 0);
+        }
+    }
+
+    bool empty() const { return lights.empty(); }
+
+    //pick a light with u, then a direction towards it with u1, u2
+    bool sample(const Vector3& origin, float u, float u1, float u2, LightSample& lightSample) const {
+        if (lights.empty()) {
+            return false;
+        }
+        const Geometry* light;
+        float selectionPdf;
+        if (selection == LightSelection::Uniform) {
+            size_t index = std::min(static_cast<size_t>(u * lights.size()), lights.size() - 1);
+            light = lights[index].get();
+            selectionPdf = 1.0f / lights.size();
+        }
+        else if (!sampleTree(origin, u, light, selectionPdf)) {
+            return false;
+        }
+
+        float pdf;
+        if (!light->sampleDirection(origin, u1, u2, lightSample.direction, pdf)) {
+            return false;
+        }
+        lightSample.pdf = pdf * selectionPdf;
+        lightSample.light = light;
+        return true;
+    }
+
+    //pdf of sample() choosing direction from origin, where the direction first hits light
+    float pdf(const Vector3& origin, const Vector3& direction, const Geometry* light) const {
+        auto trail = trails.find(light);
+        if (trail == trails.end()) {
+            return 0;
+        }
+        float selectionPdf = selection == LightSelection::Uniform
+            ? 1.0f / lights.size() : treePdf(origin, trail->second);
+        if (selectionPdf == 0) {
+            return 0;
+        }
+        return light->directionPdf(origin, direction) * selectionPdf;
+    }
+
+    LightSelection selection = LightSelection::Tree;
+    std::vector<shared_ptr<Geometry>> lights;
+    //the way down the tree to each light, bit i set means the second child at depth i
+    std::unordered_map<const Geometry*, uint64_t> trails;
+
+    private:
+    struct LightNode {
+        LightBounds bounds;
+        //leaf: index into lights, interior: index of the second child, the first one directly follows this node
+        int index;
+        bool isLeaf;
+    };
+
+    //median split of order[start, end) along the widest axis of the light centers, nodes are stored depth first
+    void buildTree(const std::vector<LightBounds>& bounds, std::vector<int>& order, size_t start, size_t end, uint64_t trail, int depth) {
+        int nodeIndex = nodes.size();
+        nodes.push_back(LightNode());
+        //median splits keep the tree log2(lights) deep, so the 64 bit trails never run out
+        if (end - start == 1) {
+            nodes[nodeIndex] = LightNode{bounds[order[start]], order[start], true};
+            trails[lights[order[start]].get()] = trail;
+            return;
+        }
+
+        auto centerOf = [&](int light) {
+            return (bounds[light].bounds.min() + bounds[light].bounds.max()) * 0.5;
+        };
+        Vector3 low = centerOf(order[start]);
+        Vector3 high = low;
+        for (size_t i = start + 1; i < end; i++) {
+            Vector3 center = centerOf(order[i]);
+            low = Vector3(fmin(low.getX(), center.getX()), fmin(low.getY(), center.getY()), fmin(low.getZ(), center.getZ()));
+            high = Vector3(fmax(high.getX(), center.getX()), fmax(high.getY(), center.getY()), fmax(high.getZ(), center.getZ()));
+        }
+        Vector3 extent = high - low;
+        int axis = extent.getX() > extent.getY() && extent.getX() > extent.getZ() ? 0 : (extent.getY() > extent.getZ() ? 1 : 2);
+        auto coordinate = [&](int light) {
+            Vector3 center = centerOf(light);
+            return axis == 0 ? center.getX() : (axis == 1 ? center.getY() : center.getZ());
+        };
+        size_t mid = (start + end) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+            [&](int a, int b) { return coordinate(a) < coordinate(b); });
+
+        buildTree(bounds, order, start, mid, trail, depth + 1);
+        int second = nodes.size();
+        buildTree(bounds, order, mid, end, trail | (uint64_t(1) << depth), depth + 1);
+        nodes[nodeIndex] = LightNode{lightBoundsUnion(nodes[nodeIndex + 1].bounds, nodes[second].bounds), second, false};
+    }
+
+    //probability of walking into the first child of an interior node, -1 if neither child lights origin
+    float firstChildProbability(const LightNode& node, int nodeIndex, const Vector3& origin) const {
+        float first = lightImportance(nodes[nodeIndex + 1].bounds, origin);
+        float second = lightImportance(nodes[node.index].bounds, origin);
+        if (first + second <= 0) {
+            return -1;
+        }
+        return first / (first + second);
+    }
+
+    bool sampleTree(const Vector3& origin, float u, const Geometry*& light, float& selectionPdf) const {
+        int nodeIndex = 0;
+        selectionPdf = 1;
+        //a single light is still skipped when it can't light origin at all
+        if (nodes[0].isLeaf && lightImportance(nodes[0].bounds, origin) <= 0) {
+            return false;
+        }
+        while (!nodes[nodeIndex].isLeaf) {
+            const LightNode& node = nodes[nodeIndex];
+            float p = firstChildProbability(node, nodeIndex, origin);
+            if (p < 0) {
+                return false;
+            }
+            //reuse u for the next level, rescaled to [0, 1) within the chosen side
+            if (u < p) {
+                u = fmin(u / p, 0.99999994f);
+                selectionPdf *= p;
+                nodeIndex = nodeIndex + 1;
+            }
+            else {
+                u = fmin((u - p) / (1 - p), 0.99999994f);
+                selectionPdf *= 1 - p;
+                nodeIndex = node.index;
+            }
+        }
+        light = lights[nodes[nodeIndex].index].get();
+        return true;
+    }
+
+    float treePdf(const Vector3& origin, uint64_t trail) const {
+        int nodeIndex = 0;
+        float selectionPdf = 1;
+        if (nodes[0].isLeaf && lightImportance(nodes[0].bounds, origin) <= 0) {
+            return 0;
+        }
+        for (int depth = 0; !nodes[nodeIndex].isLeaf; depth++) {
+            const LightNode& node = nodes[nodeIndex];
+            float p = firstChildProbability(node, nodeIndex, origin);
+            if (p < 0) {
+                return 0;
+            }
+            if (trail & (uint64_t(1) << depth)) {
+                selectionPdf *= 1 - p;
+                nodeIndex = node.index;
+            }
+            else {
+                selectionPdf *= p;
+                nodeIndex = nodeIndex + 1;
+            }
+        }
+        return selectionPdf;
+    }
+
+    std::vector<LightNode> nodes;
+};
+
+#endif /* LIGHTS_HPP_*/
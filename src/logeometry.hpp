@@ -23,30 +23,36 @@ class LoGeometry: public Geometry {
         //add object to end of this list of geometry
         void add(shared_ptr<Geometry> object) { objects.push_back(object); }
         //return if ray hit anything in this list of geometry
-        virtual bool hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const;
+        virtual bool closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const override;
+        virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
         virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override;
         //std::vector automatically grows as more values are added
         std::vector<shared_ptr<Geometry>> objects;
 };
 
-bool LoGeometry::hit(const Ray& ray, float tMin, float tMax, hitRecord& rec) const{
-    hitRecord tempRec;
+bool LoGeometry::closestHit(const Ray& ray, float tMin, float tMax, HitCandidate& candidate) const{
     bool didHitSomething = false;
     //t of the closest hit (keep track of lowest t value)
-    double closestSoFar = tMax;
-    //iterate through each object in list
+    float closestSoFar = tMax;
+    //iterate through each object in list, each hit is closer than the last
     for (const auto& object : objects) {
-        //if the object at list[i] was hit
-        if(object->hit(ray, tMin, closestSoFar, tempRec)) {
+        if(object->closestHit(ray, tMin, closestSoFar, candidate)) {
             didHitSomething = true;
-            closestSoFar = tempRec.t;
-            //record the hit record of the closest object
-            rec = tempRec;
+            closestSoFar = candidate.t;
         }
     }
 return didHitSomething;
 }
 
+bool LoGeometry::occluded(const Ray& ray, float tMin, float tMax) const{
+    for (const auto& object : objects) {
+        if(object->occluded(ray, tMin, tMax)) {
+            return true;
+        }
+    }
+return false;
+}
+
 bool LoGeometry::boundingBox(float t0, float t1, AABB& outputBox) const{
     if(objects.empty()){
         return false;
@@ -11,106 +11,40 @@
 #include "./movingSphere.hpp"
 #include "./imageTexture.hpp"
 #include "./XYRect.hpp"
+#include "./scenes.hpp"
+#include "./bvh.hpp"
+#include "./lights.hpp"
+#include "./render.hpp"
+#include "./restir.hpp"
+#include "./wavefront.hpp"
+#include "./animation.hpp"
+#include "./denoise.hpp"
+#include "./distributed.hpp"
+#include "./daemon.hpp"
+#include "./bake.hpp"
+#include "./gbuffer.hpp"
+#include "./sceneCache.hpp"
+#include "./budget.hpp"
+#include "./stats.hpp"
+#include "./trace.hpp"
+#include "./perfCounters.hpp"
+#include <chrono>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string>
+#include <cstring>
 
 
 using namespace std;
 
-//calculate color at the set max depth
-Vector3 color(const Ray& r, const Vector3 backgroundColor, const Geometry& scene, int depth) {
-    hitRecord rec;
-    if(depth <= 0) { 
-        //no lightßS
-        return Vector3(0, 0, 0);
+//parse "x,y,z" into v
+inline bool parseVector(const char* text, Vector3& v) {
+    float x, y, z;
+    if (sscanf(text, "%f,%f,%f", &x, &y, &z) != 3) {
+        return false;
     }
-    if(!scene.hit(r, 0.01, infinity, rec)) {
-        //ray didn't hit any object, return background color
-        return backgroundColor;
-    }
-        Ray scattered;
-        Vector3 attenuation;
-        Vector3 emitted = rec.matPtr->emitted(rec.u, rec.v, rec.p);
-
-        //just light, not scattered on any object
-        if (!rec.matPtr->scatter(r, rec, attenuation, scattered)){
-            return emitted;
-        }
-    //object under light recursively find color
-    return emitted + attenuation * color(scattered, backgroundColor, scene, depth-1);
-}
-
-
-//A random scene of spheres with different materials 
-LoGeometry randomScene() {
-    LoGeometry world;
-
-    auto groundMaterial = make_shared<Lambertian>(Vector3(0.5, 0.5, 0.5));
-    
-    //checkered ground with constructor taking in the 2 colors 
-    auto checkeredGround = make_shared<CheckerTexture>(Vector3(0.2, 0.3, 0.1), Vector3(0.9, 0.9, 0.9));
-    world.add(make_shared<Sphere>(Vector3(0,-1000,0), 1000, make_shared<Lambertian>(checkeredGround)));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto chooseMat = randomNum();
-            Vector3 center(a + 0.9*randomNum(), 0.2, b + 0.9*randomNum());
-
-            if ((center - Vector3(4, 0.2, 0)).magnitude() > 0.9) {
-                shared_ptr<Material> sphereMaterial;
-
-                if (chooseMat < 0.8) {
-                    // diffuse
-                    auto albedo = randomVec() * randomVec();
-                    sphereMaterial = make_shared<Lambertian>(albedo);
-                    auto center2 = center + Vector3(0, randomNum(0, 0.5), 0);
-                    world.add(make_shared<MovingSphere>(center, center2, 0.0, 1.0, 0.2, sphereMaterial));
-                } else if (chooseMat < 0.95) {
-                    // metal
-                    auto albedo = randomVec(0.5, 1);
-                    auto fuzz = randomNum(0, 0.5);
-                    sphereMaterial = make_shared<Metal>(albedo, fuzz);
-                    world.add(make_shared<Sphere>(center, 0.2, sphereMaterial));
-                } else {
-                    // glass
-                    sphereMaterial = make_shared<Dielectric>(1.5);
-                    world.add(make_shared<Sphere>(center, 0.2, sphereMaterial));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<Dielectric>(1.5);
-    world.add(make_shared<Sphere>(Vector3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<Lambertian>(Vector3(0.4, 0.2, 0.1));
-    world.add(make_shared<Sphere>(Vector3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<Metal>(Vector3(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<Sphere>(Vector3(4, 1, 0), 1.0, material3));
-
-    return world;
-}
-
-//A scene with 2 checkered Spheres
-LoGeometry checkeredSpheres(){
-    LoGeometry objects;
-
-    auto checkerTexture = make_shared<CheckerTexture>(Vector3(0.2, 0.3, 0.1), Vector3(0.9, 0.9, 0.9));
-    objects.add(make_shared<Sphere>(Vector3(0, -10, 0), 10, make_shared<Lambertian>(checkerTexture)));
-    objects.add(make_shared<Sphere>(Vector3(0, 10, 0), 10, make_shared<Lambertian>(checkerTexture)));
-    return objects;
-}
-
-//A scene with two spheres
-LoGeometry perlinSpheres(){
-    LoGeometry objects;
-    auto perlinTexture = make_shared<noiseTexture>(4);
-
-    objects.add(make_shared<Sphere>(Vector3(0, -1000, 0), 1000, make_shared<Lambertian>(perlinTexture)));
-    objects.add(make_shared<Sphere>(Vector3(0, 2, 0), 2, make_shared<Lambertian>(perlinTexture)));
-    return objects;
+    v = Vector3(x, y, z);
+    return true;
 }
 
 //debugging file existence
@@ -119,146 +53,513 @@ inline bool exists_test3 (const std::string& name) {
   return (stat (name.c_str(), &buffer) == 0); 
 }
 
-//A scene with projected image textures
-LoGeometry planetsTextures(){
-    auto jupiterTexture = make_shared<ImageTexture>("src/imageTextures/jupiter.jpg");
-    auto jupiterSurface = make_shared<Lambertian>(jupiterTexture);
-    auto sphere = make_shared<Sphere>(Vector3(0, 0, 0), 2, jupiterSurface);
-
-    return LoGeometry(sphere);
-}
-
-//A scene with a rectangle acting as a light
-LoGeometry rectLight(){
-    LoGeometry objects;
-    auto perlinTexture = make_shared<noiseTexture>(4);
-    objects.add(make_shared<Sphere>(Vector3(0,-1000,0), 1000, make_shared<Lambertian>(perlinTexture)));
-    objects.add(make_shared<Sphere>(Vector3(0,2,0), 2, make_shared<Lambertian>(perlinTexture)));
-
-    auto difflight = make_shared<DiffuseLight>(Vector3(4,4,4));
-    objects.add(make_shared<XYRect>(3, 5, 1, 3, -2, difflight));
-
-    return objects;
+//compare a render against a reference image, if one was given
+void reportRMSE(const FrameBuffer& image, const string& reference) {
+    FrameBuffer referenceImage;
+    if (reference.empty() || !readImage(reference, referenceImage)) {
+        return;
+    }
+    if (referenceImage.width != image.width || referenceImage.height != image.height) {
+        cerr << "\nReference image is " << referenceImage.width << "x" << referenceImage.height << ", not comparing\n";
+        return;
+    }
+    cerr << "\nRMSE against " << reference << ": " << imageRMSE(image, referenceImage);
 }
 
-LoGeometry cornellBox() {
-    LoGeometry objects;
-
-    auto red   = make_shared<Lambertian>(Vector3(.65, .05, .05));
-    auto white = make_shared<Lambertian>(Vector3(.73, .73, .73));
-    auto green = make_shared<Lambertian>(Vector3(.12, .45, .15));
-    auto light = make_shared<DiffuseLight>(Vector3(15, 15, 15));
-
-    objects.add(make_shared<ZYRect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<ZYRect>(0, 555, 0, 555, 0, red));
-    objects.add(make_shared<XZRect>(213, 343, 227, 332, 554, light));
-    objects.add(make_shared<XZRect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<XZRect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-    return objects;
+//render a numbered sequence: the camera orbits the scene and every moving sphere bounces
+void renderSequence(Scene& scene, const RenderSettings& settings, const SequenceSettings& sequence) {
+    SequenceRenderer renderer(scene);
+    for (auto& object : scene.objects.objects) {
+        auto sphere = dynamic_pointer_cast<MovingSphere>(object);
+        if (!sphere) {
+            continue;
+        }
+        Vector3 base = sphere->center0;
+        float phase = randomNum(0, 2*pi);
+        float frames = sequence.frames;
+        renderer.addTrack(make_shared<MovingSphereTrack>(sphere, [base, phase, frames](float frame) {
+            return base + Vector3(0, 0.5*fabs(sin(phase + 4*pi*frame / frames)), 0);
+        }));
+    }
+    renderer.render(orbitPath(scene.lookfrom, scene.lookat, scene.vfov, sequence.frames), settings, sequence);
 }
 
 //main!
-int main() {
+//usage: main [--scene N] [--width W] [--spp N] [--depth N] [--threads N] [--output file] [--sequence FRAMES]
+//            [--denoise] [--sampler independent|stratified|sobol|bluenoise] [--reference file]
+//            [--integrator path|mis|restir] [--heuristic balance|power] [--lights N] [--light-sampler uniform|tree]
+//            [--restir-history N] [--seed N] [--listen ADDRESS [--spawn N]] [--worker ADDRESS]
+//            [--lookfrom X,Y,Z] [--lookat X,Y,Z] [--vfov DEGREES]
+//            [--trace FILE] [--heatmap] [--perf] [--bake-textures TEXELS_PER_UNIT]
+//            [--gbuffer FILE] [--scene-cache FILE] [--stream-bands ROWS] [--time-budget SECONDS] [--no-arena] [--flat] [--wavefront [--no-material-sort]] [--daemon ADDRESS] [--submit ADDRESS [--detach]] [--status ADDRESS ID] [--fetch ADDRESS ID] [--shutdown ADDRESS]
+//addresses are unix:/path or host:port, --listen renders the frame on the workers that connect to it
+//--daemon keeps built scenes in memory and renders the jobs --submit sends it, --submit waits for the image
+//unless --detach is given, in which case it prints the job id for --status and --fetch, the daemon keeps the last
+//16 unfetched images for up to an hour, jobs take --flat, --bake-textures
+//and --wavefront along but not the options about this process, such as --threads or --heatmap
+//--heatmap writes false color images of the time, bounces and (with RT_STATS) BVH nodes each pixel cost
+//--bake-textures evaluates checker and noise textures once into a uv grid per primitive instead of on every hit
+//--gbuffer records the first hit and first shadow ray of every sample into FILE, and while the geometry, view and
+//samples stay the same later runs shade from it instead of tracing them, for quick material edits (the sobol and
+//bluenoise samplers only, the others jitter camera rays with randomNum() so a replay would trace different rays)
+//--scene-cache loads the built scene and its BVH from FILE if it was made from the same scene, light count, seed
+//and texture baking by this build of the program, or writes them there for the next run, it implies --flat
+//--stream-bands writes the image out in bands of ROWS rows as its tiles finish instead of keeping the whole frame,
+//as a ppm, or a png or pfm (floats) by the output's extension
+//--time-budget renders in passes until SECONDS have gone by instead of a fixed --spp, giving noisier pixels more
+//samples, and writes how many each pixel got as <base>_spp
+//--perf reports cycles, IPC and cache and branch misses of each phase, where the kernel allows perf_event_open
+//--trace writes a timeline of scene building, every thread's tiles and image output for chrome://tracing
+int main(int argc, char* argv[]) {
     int sceneNumber = 6;
-    //black background
-    Vector3 backgroundColor(0,0,0);
-    ofstream MyFile("myImage6.ppm");
-    //new
-    auto aspectRatio = 16.0 / 9.0;
-    //image width
-    int width = 400;
-    int samplesPerPixel = 100;
-    const int maxDepth = 50;
-
-    //Create geometry
-    LoGeometry scene;
-    Vector3 lookfrom(13,2,3);
-    Vector3 lookat(0,0,0);
-    float vfov = 40.0;
-    auto aperture = 0.0;
-
-    //switch case to determine what scene to render
-    switch(sceneNumber){
-        case 1:
-            scene = randomScene();
-            backgroundColor = Vector3(0.70, 0.80, 1.00);
-            lookfrom = Vector3(13, 2, 3);
-            lookat = Vector3(0, 0, 0);
-            vfov = 20.0;
-            aperture = 0.1;
-            break;
-        case 2: 
-            scene = checkeredSpheres();
-            backgroundColor = Vector3(0.70, 0.80, 1.00);
-            lookfrom = Vector3(13, 2, 3);
-            lookat = Vector3(0, 0, 0);
-            vfov = 20.0;
-            break;
-        case 3:
-            scene = perlinSpheres();
-            backgroundColor = Vector3(0.70, 0.80, 1.00);
-            lookfrom = Vector3(13, 2, 3);
-            lookat = Vector3(0, 0, 0);
-            vfov = 20.0;
-            break;
-        case 4: 
-            scene = planetsTextures();
-            lookfrom = Vector3(13, 2, 3);
-            lookat = Vector3(0, 0, 0);
-            vfov = 20.0;
-            backgroundColor = Vector3(0.70, 0.80, 1.00);
-            break;
-        case 5:
-            scene = rectLight();
-            samplesPerPixel = 800;
-            backgroundColor = Vector3(0, 0, 0);
-            lookfrom = Vector3(26, 3, 6);
-            lookat = Vector3(0,2,0);
-            vfov = 20.0;
-            break;
-        case 6:
-            scene = cornellBox();
-            aspectRatio = 1.0;
-            width = 600;
-            samplesPerPixel = 200;
-            backgroundColor = Vector3(0, 0, 0);
-            lookfrom = Vector3(278, 278, -800);
-            lookat = Vector3(278, 278, 0);
-            vfov = 40.0;
-            break;
+    int width = 0;
+    int samplesPerPixel = 0;
+    string output;
+    //image to report the render's RMSE against
+    string reference;
+    RenderSettings settings;
+    SequenceSettings sequence;
+    bool renderAnimation = false;
+    int lightCount = 1000;
+    LightSelection lightSelection = LightSelection::Tree;
+    //seed of the random numbers that build the scene
+    unsigned seed = 1;
+    //distributed rendering: where the coordinator listens, and how many local workers it starts
+    string listenAddress;
+    int spawnCount = 0;
+    //camera placement replacing the scene's, if given
+    bool customCamera = false;
+    Vector3 lookfrom, lookat;
+    float vfov = 0;
+    //render daemon: the address to serve or send a request to, the request, and the job it is about
+    string daemonAddress;
+    string daemonRequest;
+    int32_t jobId = 0;
+    bool detach = false;
+    //allocate the scene's objects one by one, to compare against the arena
+    bool useArena = true;
+    //trace against the data oriented copy of the scene instead of the Geometry objects
+    bool flatScene = false;
+    //Chrome trace of the run, written once it is done
+    string traceFile;
+    //write what each pixel cost next to the image
+    bool heatmap = false;
+    //hardware counters per phase
+    bool perfCounters = false;
+    //bake procedural textures before rendering, at this many texels per world unit
+    float bakeDensity = 0;
+    //first vertices of every sample, recorded or replayed
+    string gbufferFile;
+    //built scene and BVH, loaded or saved
+    string sceneCacheFile;
+    //rows per band the image is streamed out in, 0 keeps the whole frame
+    int streamBands = 0;
+    //seconds the frame may take, 0 renders a fixed number of samples
+    double timeBudget = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--scene") && hasValue) {
+            sceneNumber = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--width") && hasValue) {
+            width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--spp") && hasValue) {
+            samplesPerPixel = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--depth") && hasValue) {
+            settings.maxDepth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && hasValue) {
+            settings.threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--output") && hasValue) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "--sampler") && hasValue) {
+            if (!parseSamplerType(argv[++i], settings.samplerType)) {
+                cerr << "Unknown sampler " << argv[i] << "\n";
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--integrator") && hasValue) {
+            string name = argv[++i];
+            if (name == "path") {
+                settings.integrator = Integrator::Path;
+            } else if (name == "mis") {
+                settings.integrator = Integrator::MIS;
+            } else if (name == "restir") {
+                settings.integrator = Integrator::ReSTIR;
+            } else {
+                cerr << "Unknown integrator " << name << "\n";
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--heuristic") && hasValue) {
+            string name = argv[++i];
+            if (name != "balance" && name != "power") {
+                cerr << "Unknown heuristic " << name << "\n";
+                return 1;
+            }
+            settings.heuristic = name == "balance" ? MISHeuristic::Balance : MISHeuristic::Power;
+        } else if (!strcmp(argv[i], "--restir-history") && hasValue) {
+            settings.restirHistory = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--lights") && hasValue) {
+            lightCount = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--light-sampler") && hasValue) {
+            string name = argv[++i];
+            if (name != "uniform" && name != "tree") {
+                cerr << "Unknown light sampler " << name << "\n";
+                return 1;
+            }
+            lightSelection = name == "uniform" ? LightSelection::Uniform : LightSelection::Tree;
+        } else if (!strcmp(argv[i], "--seed") && hasValue) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--listen") && hasValue) {
+            listenAddress = argv[++i];
+        } else if (!strcmp(argv[i], "--spawn") && hasValue) {
+            spawnCount = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--worker") && hasValue) {
+            //everything else comes from the coordinator
+            string address = argv[++i];
+            for (int k = i + 1; k + 1 < argc; k++) {
+                if (!strcmp(argv[k], "--threads")) {
+                    settings.threads = atoi(argv[k + 1]);
+                }
+            }
+            return runWorker(address, settings.threads);
+        } else if ((!strcmp(argv[i], "--lookfrom") || !strcmp(argv[i], "--lookat")) && hasValue) {
+            customCamera = true;
+            if (!parseVector(argv[i + 1], !strcmp(argv[i], "--lookfrom") ? lookfrom : lookat)) {
+                cerr << "Expected X,Y,Z after " << argv[i] << "\n";
+                return 1;
+            }
+            i++;
+        } else if (!strcmp(argv[i], "--vfov") && hasValue) {
+            customCamera = true;
+            vfov = atof(argv[++i]);
+        } else if ((!strcmp(argv[i], "--daemon") || !strcmp(argv[i], "--submit") || !strcmp(argv[i], "--shutdown")) && hasValue) {
+            daemonRequest = argv[i] + 2;
+            daemonAddress = argv[++i];
+        } else if ((!strcmp(argv[i], "--status") || !strcmp(argv[i], "--fetch")) && i + 2 < argc) {
+            daemonRequest = argv[i] + 2;
+            daemonAddress = argv[++i];
+            jobId = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--wavefront")) {
+            settings.wavefront = true;
+        } else if (!strcmp(argv[i], "--no-material-sort")) {
+            settings.sortByMaterial = false;
+        } else if (!strcmp(argv[i], "--flat")) {
+            flatScene = true;
+        } else if (!strcmp(argv[i], "--trace") && hasValue) {
+            traceFile = argv[++i];
+        } else if (!strcmp(argv[i], "--bake-textures") && hasValue) {
+            bakeDensity = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--gbuffer") && hasValue) {
+            gbufferFile = argv[++i];
+        } else if (!strcmp(argv[i], "--scene-cache") && hasValue) {
+            sceneCacheFile = argv[++i];
+            flatScene = true;
+        } else if (!strcmp(argv[i], "--stream-bands") && hasValue) {
+            streamBands = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--time-budget") && hasValue) {
+            timeBudget = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--perf")) {
+            perfCounters = true;
+        } else if (!strcmp(argv[i], "--heatmap")) {
+            heatmap = true;
+        } else if (!strcmp(argv[i], "--no-arena")) {
+            useArena = false;
+        } else if (!strcmp(argv[i], "--detach")) {
+            detach = true;
+        } else if (!strcmp(argv[i], "--reference") && hasValue) {
+            reference = argv[++i];
+        } else if (!strcmp(argv[i], "--denoise")) {
+            settings.denoise = true;
+        } else if (!strcmp(argv[i], "--sequence") && hasValue) {
+            renderAnimation = true;
+            sequence.frames = atoi(argv[++i]);
+        } else {
+            cerr << "Unknown argument " << argv[i] << "\n";
+            return 1;
+        }
     }
 
+    auto makeJob = [&](int jobWidth, int jobHeight, int jobSamples, bool aux) {
+        RenderJob job{sceneNumber, lightCount, seed, jobWidth, jobHeight, jobSamples, settings.maxDepth,
+            static_cast<int32_t>(settings.samplerType), static_cast<int32_t>(settings.integrator),
+            static_cast<int32_t>(settings.heuristic), static_cast<int32_t>(lightSelection), aux, customCamera,
+            {lookfrom.getX(), lookfrom.getY(), lookfrom.getZ()}, {lookat.getX(), lookat.getY(), lookat.getZ()}, vfov,
+            bakeDensity, flatScene, settings.wavefront, settings.sortByMaterial};
+        return job;
+    };
+    string defaultOutput = "myImage" + to_string(sceneNumber) + ".ppm";
+    if (!traceFile.empty()) {
+        startTrace();
+    }
+    if (perfCounters) {
+        enablePerfCounters();
+    }
+    auto finishTrace = [&]() {
+        if (!traceFile.empty() && writeTrace(traceFile)) {
+            std::cerr << "Trace written to " << traceFile << "\n";
+        }
+    };
+
+    //the render daemon and its clients don't build a scene here
+    if (daemonRequest == "daemon") {
+        RenderDaemon daemon;
+        bool ok = daemon.serve(daemonAddress);
+        finishTrace();
+        return ok ? 0 : 1;
+    }
+    if (!daemonRequest.empty()) {
+        if (output.empty()) {
+            output = defaultOutput;
+        }
+        int fd = openSocket(daemonAddress, false);
+        if (fd < 0) {
+            cerr << "Could not connect to " << daemonAddress << "\n";
+            return 1;
+        }
+        FrameBuffer image;
+        bool ok = true;
+        if (daemonRequest == "shutdown") {
+            ok = sendMessage(fd, MessageType::Shutdown);
+        } else if (daemonRequest == "status") {
+            JobStatus status;
+            ok = daemonStatus(fd, jobId, status);
+            if (ok) {
+                const char* states[] = {"queued", "rendering", "done"};
+                //the state comes off the socket, a daemon from another build may send one this one doesn't know
+                bool known = status.state >= 0 && status.state < 3;
+                cout << "Job " << jobId << ": " << (known ? states[status.state] : "unknown") << ", "
+                    << static_cast<int>(status.progress * 100) << "%\n";
+            }
+        } else if (daemonRequest == "fetch") {
+            ok = daemonFetch(fd, jobId, image) && writeImage(output, image);
+        } else {
+            //the job carries the scene, camera, sampling and integrator, the rest is up to the daemon
+            if (settings.threads > 0 || timeBudget > 0 || heatmap || !gbufferFile.empty() || streamBands > 0
+                || !sceneCacheFile.empty() || renderAnimation || !listenAddress.empty()) {
+                cerr << "--threads, --time-budget, --heatmap, --gbuffer, --stream-bands, --scene-cache, --sequence and --listen "
+                    "aren't sent to the daemon, they are ignored\n";
+            }
+            jobId = daemonSubmit(fd, makeJob(width, 0, samplesPerPixel, settings.denoise));
+            ok = jobId >= 0;
+            if (ok && detach) {
+                cout << jobId << "\n";
+            } else if (ok) {
+                ok = daemonWait(fd, jobId, settings.showProgress, image) && writeImage(output, image);
+                if (ok) {
+                    reportRMSE(image, reference);
+                    std::cerr << "\nFinished!\n";
+                }
+            }
+        }
+        close(fd);
+        return ok ? 0 : 1;
+    }
 
-    //Add camera to scene
-    Vector3 vup(0,1,0);
-    auto distToFocus = 10.0;
+    //Create geometry
+    seedRandom(seed);
+    auto buildStart = chrono::steady_clock::now();
+    Scene scene;
+    shared_ptr<Geometry> world;
+    SceneCacheKey cacheKey{sceneNumber, lightCount, seed, bakeDensity};
+    if (renderAnimation && !sceneCacheFile.empty()) {
+        cerr << "--scene-cache is only used for single frames, it is ignored\n";
+        sceneCacheFile.clear();
+    }
+    bool cachedScene = !sceneCacheFile.empty() && loadSceneCache(sceneCacheFile, cacheKey, useArena, scene, world);
+    if (!cachedScene) {
+        scene = loadScene(sceneNumber, lightCount, useArena);
+    }
+    if (customCamera) {
+        scene.lookfrom = lookfrom;
+        scene.lookat = lookat;
+        scene.vfov = vfov;
+    }
+    //a cached scene was baked before it was saved
+    if (bakeDensity > 0 && !cachedScene) {
+        BakeSettings bakeSettings;
+        bakeSettings.texelsPerUnit = bakeDensity;
+        bakeSettings.threads = settings.threads;
+        auto bakeStart = chrono::steady_clock::now();
+        BakeReport baked = bakeTextures(scene, bakeSettings);
+        chrono::duration<double> bakeTime = chrono::steady_clock::now() - bakeStart;
+        std::cerr << "Baked " << baked.baked << " textures (" << baked.texels << " texels) in " << bakeTime.count() * 1000
+            << "ms, " << baked.skipped << " left procedural\n";
+    }
+    settings.width = width > 0 ? width : scene.width;
     //image height
-    const int height = static_cast<int>(width / aspectRatio);
-
-    std::cout <<"P3\n" << width << " " << height << "\n255\n";
-     MyFile <<"P3\n" << width << " " << height << "\n255\n";
+    settings.height = static_cast<int>(settings.width / scene.aspectRatio);
+    settings.samplesPerPixel = samplesPerPixel > 0 ? samplesPerPixel : scene.samplesPerPixel;
+    settings.backgroundColor = scene.backgroundColor;
 
+    if (renderAnimation) {
+        if (!output.empty()) {
+            sequence.outputPrefix = output;
+        }
+        renderSequence(scene, settings, sequence);
+        finishTrace();
+        return 0;
+    }
 
-    Camera cam(lookfrom, lookat, vup, vfov, aspectRatio, aperture, distToFocus, 0.0, 1.0);
-
-    for (int j = height - 1; j >= 0; j--){
-         std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush; 
-        for(int i = 0; i < width; i++){
-            //color of this pixel
-            Vector3 col(0,0,0);
-            for(int s = 0; s < samplesPerPixel; s++) {
-                //antialiasing, blur edges by generating pixels w multiple samples
-                auto u = (i + randomNum()) / (width - 1);
-                auto v = (j + randomNum()) / (height - 1);
-                Ray r = cam.getRay(u, v);
-                col += color(r, backgroundColor, scene, maxDepth);
-            }
-            //print colors and write to ppm file
-            writeColor(std::cout, MyFile, col, samplesPerPixel);
+    if (output.empty()) {
+        output = defaultOutput;
+    }
+    FrameBuffer image;
+    LightList lights(scene.objects, lightSelection);
+    if (!cachedScene) {
+        world = sceneHierarchy(scene, flatScene, settings.threads);
+    }
+    chrono::duration<double> buildTime = chrono::steady_clock::now() - buildStart;
+    if (!sceneCacheFile.empty() && !cachedScene && saveSceneCache(sceneCacheFile, scene, static_cast<const FlatScene&>(*world), cacheKey)) {
+        std::cerr << "Saved scene to " << sceneCacheFile << "\n";
+    }
+    std::cerr << (cachedScene ? "Loaded scene from " + sceneCacheFile : string("Built scene")) << " in " << buildTime.count() * 1000 << "ms";
+    if (scene.arena) {
+        std::cerr << " (" << scene.arena->allocations() << " objects in " << scene.arena->chunks() << " arena chunks, "
+            << scene.arena->bytes() / 1024 << "KB)";
+    }
+    std::cerr << "\n";
+    auto renderStart = chrono::steady_clock::now();
+    auto reportRenderTime = [&]() {
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - renderStart;
+        std::cerr << "\nRendered in " << elapsed.count() << "s";
+#ifdef RT_STATS
+        printStats(std::cerr);
+#endif
+        if (perfCounters) {
+            printPerfCounters(std::cerr);
+        }
+    };
+    //progressive passes over the whole frame, in the tiled renderer's integrators
+    if (timeBudget > 0 && (settings.wavefront || settings.integrator == Integrator::ReSTIR || !listenAddress.empty()
+        || heatmap || !gbufferFile.empty() || streamBands > 0)) {
+        cerr << "--time-budget can't be combined with --wavefront, restir, --listen, --heatmap, --gbuffer or --stream-bands, "
+            "rendering " << settings.samplesPerPixel << " samples per pixel\n";
+        timeBudget = 0;
+    }
+    BudgetSettings budget;
+    budget.seconds = timeBudget;
+    vector<float> samplesTaken;
+    //streaming needs tiles, and nothing else that holds on to the whole frame
+    if (streamBands > 0 && (settings.wavefront || settings.integrator == Integrator::ReSTIR || !listenAddress.empty()
+        || settings.denoise || heatmap || !gbufferFile.empty() || !reference.empty())) {
+        cerr << "--stream-bands needs the local tiled renderer without --denoise, --heatmap, --gbuffer or --reference, "
+            "the whole frame is kept\n";
+        streamBands = 0;
+    }
+    unique_ptr<ImageStream> stream;
+    if (streamBands > 0) {
+        //whole rows of tiles, so no tile straddles two bands
+        int bandHeight = (streamBands + settings.tileSize - 1) / settings.tileSize * settings.tileSize;
+        stream.reset(new ImageStream(output, settings.width, settings.height, bandHeight));
+        if (!stream->ok) {
+            return 1;
         }
+        settings.stream = stream.get();
+        cerr << "Streaming " << output << " in bands of " << bandHeight << " rows (" << stream->bufferBytes() / 1024 << "KB)\n";
+    }
+    //only the tiled renderer goes pixel by pixel
+    CostBuffers cost;
+    if (heatmap && (settings.wavefront || settings.integrator == Integrator::ReSTIR || !listenAddress.empty())) {
+        cerr << "--heatmap needs the local tiled renderer, no heatmap is written\n";
+        heatmap = false;
     }
-     MyFile.close();
-     std::cerr << "\nFinished!\n";
-}
\ No newline at end of file
+    if (heatmap) {
+        settings.cost = &cost;
+    }
+    //the first vertices are kept by the tiled renderer's light sampling integrators
+    unique_ptr<GBufferCache> gbuffer;
+    bool recordGBuffer = false;
+    if (!gbufferFile.empty() && (settings.wavefront || settings.integrator != Integrator::MIS || !listenAddress.empty())) {
+        cerr << "--gbuffer needs the local tiled renderer and the mis integrator, it is ignored\n";
+    } else if (!gbufferFile.empty() && (settings.samplerType == SamplerType::Independent
+        || settings.samplerType == SamplerType::Stratified)) {
+        //their jitter comes from randomNum(), so a replayed camera ray isn't the one that was recorded
+        cerr << "--gbuffer needs a deterministic sampler (sobol or bluenoise), it is ignored\n";
+    } else if (!gbufferFile.empty()) {
+        gbuffer.reset(new GBufferCache(scene, settings));
+        recordGBuffer = !gbuffer->load(gbufferFile);
+        cerr << (recordGBuffer ? "Recording first hits into " : "Shading from the first hits in ") << gbufferFile << "\n";
+        settings.primaryVertices = gbuffer->vertices.data();
+    }
+    auto saveGBuffer = [&]() {
+        if (recordGBuffer) {
+            gbuffer->save(gbufferFile);
+        }
+    };
+    //tiles rendered elsewhere, either by every worker that connects or by this process's threads
+    auto render = [&](AuxBuffers* aux) {
+        if (listenAddress.empty() && timeBudget > 0) {
+            BudgetReport report = renderWithBudget(*world, lights, scene.camera(), settings, budget, image, samplesTaken, aux);
+            std::cerr << "\n" << report.passes << " passes, " << report.samples << " samples in " << report.seconds
+                << "s of a " << timeBudget << "s budget";
+            return true;
+        }
+        if (listenAddress.empty()) {
+            renderFrame(*world, lights, scene.camera(), settings, image, aux);
+            return true;
+        }
+        if (settings.integrator == Integrator::ReSTIR) {
+            //reservoirs are shared across the whole frame, tiles can't be rendered on their own
+            cerr << "ReSTIR can't be split into tiles, distributed rendering uses MIS instead\n";
+            settings.integrator = Integrator::MIS;
+        }
+        //workers place the camera exactly where this process did
+        customCamera = true;
+        lookfrom = scene.lookfrom;
+        lookat = scene.lookat;
+        vfov = scene.vfov;
+        RenderJob job = makeJob(settings.width, settings.height, settings.samplesPerPixel, aux != nullptr);
+        return renderDistributed(job, listenAddress, spawnCount, settings.tileSize, settings.showProgress, image, aux);
+    };
+    if (!settings.denoise) {
+        if (!render(nullptr)) {
+            return 1;
+        }
+        reportRenderTime();
+        if (stream) {
+            bool written = stream->finish();
+            std::cerr << (written ? "\nFinished!\n" : "\nError: " + output + " was not completely written\n");
+            finishTrace();
+            return written ? 0 : 1;
+        }
+        saveGBuffer();
+        writeImage(output, image);
+        if (heatmap) {
+            writeCostImages(imageBaseName(output), cost);
+        }
+        if (timeBudget > 0) {
+            writeCostImage(imageBaseName(output) + "_spp.ppm", "samples per pixel", samplesTaken, settings.width, settings.height, 1);
+        }
+        reportRMSE(image, reference);
+        std::cerr << "\nFinished!\n";
+        finishTrace();
+        return 0;
+    }
+
+    //keep the noisy render and the guide buffers next to the denoised image
+    AuxBuffers aux;
+    if (!render(&aux)) {
+        return 1;
+    }
+    reportRenderTime();
+    saveGBuffer();
+    string base = imageBaseName(output);
+    writeImage(base + "_noisy.ppm", image);
+    writeAuxImages(base, aux);
+    if (heatmap) {
+        writeCostImages(base, cost);
+    }
+    if (timeBudget > 0) {
+        writeCostImage(base + "_spp.ppm", "samples per pixel", samplesTaken, settings.width, settings.height, 1);
+    }
+
+    DenoiseSettings denoiseSettings;
+    denoiseSettings.threads = settings.threads;
+    auto start = chrono::steady_clock::now();
+    FrameBuffer denoised = denoise(image, aux, denoiseSettings);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    std::cerr << "\nDenoised in " << elapsed.count() * 1000 << "ms";
+    writeImage(output, denoised);
+    reportRMSE(denoised, reference);
+    std::cerr << "\nFinished!\n";
+    finishTrace();
+}
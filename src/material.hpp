@@ -4,39 +4,109 @@
 
 #include "./geometry.hpp"
 #include "./texture.hpp"
+#include "./sampler.hpp"
+#include "./stats.hpp"
 
 
+//one direction chosen by Material::sample
+struct BSDFSample {
+    //unit length scattered direction
+    Vector3 direction;
+    //throughput of the path through this bounce: bsdf * cos / pdf, or the lobe's reflectance for delta lobes
+    Vector3 weight;
+    //solid angle pdf of direction, meaningless for delta lobes
+    float pdf;
+    //perfectly specular: only the sampled direction carries light, so eval() and pdf() of it return 0
+    bool isDelta;
+};
+
+//the concrete type of a material, so batches of hits can be shaded without a virtual call per hit
+enum class MaterialKind { Other, Lambertian, Metal, Dielectric, DiffuseLight };
+
 class Material {
     public:
-    virtual bool scatter(const Ray& rayIn, const hitRecord& rec, 
-    Vector3& attenuation, Ray& scattered) const=0;
+    virtual MaterialKind kind() const {
+        return MaterialKind::Other;
+    }
+    //choose a scattered direction for a ray arriving at rec, random decisions are drawn from sampler
+    //(at most 4 numbers per call), returns false if the ray is absorbed
+    virtual bool sample(const Ray& rayIn, const hitRecord& rec, Sampler& sampler, BSDFSample& bsdfSample) const {
+        RT_COUNT(AbsorbingSamples);
+        return false;
+    }
+    //bsdf times the cosine to the normal, for light leaving the surface along the reversed ray and arriving from direction
+    //delta lobes are not included
+    virtual Vector3 eval(const Ray& rayIn, const hitRecord& rec, const Vector3& direction) const {
+        return Vector3(0, 0, 0);
+    }
+    //solid angle pdf of sample() choosing direction, 0 for delta lobes
+    virtual float pdf(const Ray& rayIn, const hitRecord& rec, const Vector3& direction) const {
+        return 0;
+    }
+    //true if every lobe at rec is a delta lobe, so light sampling can't help there
+    virtual bool isSpecular(const hitRecord& rec) const {
+        return false;
+    }
+    //true if emitted() can be non-zero, which makes the primitive a light
+    virtual bool isEmissive() const {
+        return false;
+    }
     //emissive material
     virtual Vector3 emitted(float u, float v, const Vector3& p) const {
             //return white
             return Vector3(0,0,0);
         }
+    //surface color at the hit, written to the denoiser's albedo buffer
+    virtual Vector3 surfaceColor(const hitRecord& rec) const {
+        return Vector3(1, 1, 1);
+    }
+    //false if nothing here reads the hit's u and v, so primitives can skip working them out
+    virtual bool needsUV() const {
+        return true;
+    }
 };
 
 //Diffuse
-class Lambertian : public Material {
+class Lambertian final : public Material {
     public:
-    Lambertian(const Vector3& a) : albedo(make_shared<SolidColor>(a)) {}
+    virtual MaterialKind kind() const override {
+        return MaterialKind::Lambertian;
+    }
+    Lambertian(const Vector3& a) : albedo(makeSceneObject<SolidColor>(a)) {}
     Lambertian(shared_ptr<Texture> a) : albedo(a) {}
 
-    virtual bool scatter(const Ray& rayIn, const hitRecord& rec, 
-    Vector3& attenuation, Ray& scattered) const override {
-        //Light scatter
-        //calculate object color
-        //diffuse method 1
-        // Vector3 scatterDirection = rec.p + rec.normal + randomInUnitSphere();
-        //diffuse method 2
-        Vector3 scatterDirection = rec.normal + randomUnitVec(); //Lambertian distribution
-        //diffuse method 3
-        //Vector3 scatterDirection = rec.p + randomInHemisphere(rec.normal);
-        scattered = Ray(rec.p, scatterDirection, rayIn.getTime());
+    //cosine weighted hemisphere sampling, so the cosine and the pdf cancel and the weight is just the albedo
+    virtual bool sample(const Ray& rayIn, const hitRecord& rec, Sampler& sampler, BSDFSample& bsdfSample) const override {
+        RT_COUNT(LambertianSamples);
+        float u1, u2;
+        sampler.get2D(u1, u2);
+        bsdfSample.direction = sampleCosinePowerLobe(rec.normal, 1, u1, u2);
+        bsdfSample.pdf = cosinePowerLobePdf(rec.normal, 1, bsdfSample.direction);
         //reduction or loss in the strength of the light with increasing distance from the light
-        attenuation = albedo->value(rec.u, rec.v, rec.p);
-        return true;
+        bsdfSample.weight = albedo->value(rec.u, rec.v, rec.p);
+        bsdfSample.isDelta = false;
+        return bsdfSample.pdf > 0;
+    }
+
+    //albedo / pi * cos
+    virtual Vector3 eval(const Ray& rayIn, const hitRecord& rec, const Vector3& direction) const override {
+        float cosine = rec.normal.dotProduct(unitVector(direction));
+        if (cosine <= 0) {
+            return Vector3(0, 0, 0);
+        }
+        return albedo->value(rec.u, rec.v, rec.p) * (cosine / pi);
+    }
+
+    virtual float pdf(const Ray& rayIn, const hitRecord& rec, const Vector3& direction) const override {
+        return cosinePowerLobePdf(rec.normal, 1, unitVector(direction));
+    }
+
+    virtual Vector3 surfaceColor(const hitRecord& rec) const override {
+        return albedo->value(rec.u, rec.v, rec.p);
+    }
+
+    virtual bool needsUV() const override {
+        return albedo->needsUV();
     }
     
     public:
@@ -46,19 +116,90 @@ class Lambertian : public Material {
 
 
 //Metal
-class Metal : public Material {
+//fuzz 0 is a perfect mirror (a delta lobe), otherwise reflections spread over a Phong lobe around the mirror direction
+class Metal final : public Material {
     public:
-    Metal(const Vector3& a, float f) : albedo(a), fuzz(f < 1 ? f : 1) {}
-    virtual bool scatter(const Ray& rayIn, const hitRecord& rec, 
-    Vector3& attenuation, Ray& scattered) const {
+    virtual MaterialKind kind() const override {
+        return MaterialKind::Metal;
+    }
+    Metal(const Vector3& a, float f) : albedo(a), fuzz(f < 1 ? f : 1) {
+        //a lobe this narrow can't be told apart from a mirror, and its pdf would overflow
+        if (fuzz < 0.01) {
+            fuzz = 0;
+        }
+        //treat fuzz like a Beckmann roughness, which maps to this Phong exponent
+        exponent = fuzz > 0 ? fmax(0.0f, 2 / (fuzz*fuzz) - 2) : 0;
+    }
+
+    virtual bool sample(const Ray& rayIn, const hitRecord& rec, Sampler& sampler, BSDFSample& bsdfSample) const override {
+        RT_COUNT(MetalSamples);
         //Light reflected
         Vector3 reflected = reflect(unitVector(rayIn.direction()), rec.normal);
-        scattered = Ray(rec.p, randomInUnitSphere()*fuzz + reflected, rayIn.getTime());
-        attenuation = albedo;
-        return scattered.direction().dotProduct(rec.normal) > 0;
+        if (fuzz == 0) {
+            bsdfSample.direction = reflected;
+            bsdfSample.weight = albedo;
+            bsdfSample.pdf = 0;
+            bsdfSample.isDelta = true;
+            return true;
+        }
+
+        float u1, u2;
+        sampler.get2D(u1, u2);
+        Vector3 direction = sampleCosinePowerLobe(reflected, exponent, u1, u2);
+        //part of the lobe dips below the surface: fold it back up instead of throwing the path away
+        //pdf() accounts for both halves, so the estimate is unchanged
+        if (direction.dotProduct(rec.normal) <= 0) {
+            direction = mirrorAboveSurface(direction, rec.normal);
+        }
+        bsdfSample.direction = direction;
+        bsdfSample.pdf = pdf(rayIn, rec, direction);
+        bsdfSample.isDelta = false;
+        if (bsdfSample.pdf <= 0) {
+            return false;
+        }
+        bsdfSample.weight = eval(rayIn, rec, direction) / bsdfSample.pdf;
+        return true;
+    }
+
+    virtual bool isSpecular(const hitRecord& rec) const override {
+        return fuzz == 0;
+    }
+
+    //the lobe itself, so that a lobe fully above the surface reflects exactly albedo
+    virtual Vector3 eval(const Ray& rayIn, const hitRecord& rec, const Vector3& direction) const override {
+        Vector3 unitDirection = unitVector(direction);
+        if (fuzz == 0 || unitDirection.dotProduct(rec.normal) <= 0) {
+            return Vector3(0, 0, 0);
+        }
+        Vector3 reflected = reflect(unitVector(rayIn.direction()), rec.normal);
+        return albedo * cosinePowerLobePdf(reflected, exponent, unitDirection);
+    }
+
+    virtual float pdf(const Ray& rayIn, const hitRecord& rec, const Vector3& direction) const override {
+        Vector3 unitDirection = unitVector(direction);
+        if (fuzz == 0 || unitDirection.dotProduct(rec.normal) <= 0) {
+            return 0;
+        }
+        Vector3 reflected = reflect(unitVector(rayIn.direction()), rec.normal);
+        return cosinePowerLobePdf(reflected, exponent, unitDirection)
+            + cosinePowerLobePdf(reflected, exponent, mirrorAboveSurface(unitDirection, rec.normal));
+    }
+
+    virtual Vector3 surfaceColor(const hitRecord& rec) const override {
+        return albedo;
+    }
+
+    virtual bool needsUV() const override {
+        return false;
     }
     Vector3 albedo;
     float fuzz;
+    float exponent;
+
+    private:
+    static Vector3 mirrorAboveSurface(const Vector3& direction, const Vector3& normal) {
+        return direction - normal*(2*direction.dotProduct(normal));
+    }
 };
 
 //Schlick's approximation for fresnel equations
@@ -71,14 +212,20 @@ float schlick(float cosine, float indexofRefraction){
 }
 
 //Dielectric (water, glass, diamonds...)
-class Dielectric : public Material {
+class Dielectric final : public Material {
     public:
+    virtual MaterialKind kind() const override {
+        return MaterialKind::Dielectric;
+    }
     Dielectric(float ir) : indexOfRefraction(ir){}
 
-    virtual bool scatter(const Ray& rayIn, const hitRecord& rec, 
-    Vector3& attenuation, Ray& scattered) const {
+    //a delta lobe: either the mirror reflection or the refraction, picked by the fresnel reflectance
+    virtual bool sample(const Ray& rayIn, const hitRecord& rec, Sampler& sampler, BSDFSample& bsdfSample) const override {
+        RT_COUNT(DielectricSamples);
         //attenuation is always 1 because the glass absorbs nothing
-        attenuation = Vector3(1.0, 1.0, 1.0);
+        bsdfSample.weight = Vector3(1.0, 1.0, 1.0);
+        bsdfSample.pdf = 0;
+        bsdfSample.isDelta = true;
         float etaIOverEtaT;
         //if this is the outside face 
         if(rec.frontFace) {
@@ -91,42 +238,59 @@ class Dielectric : public Material {
         Vector3 unitDirection = unitVector(rayIn.direction());
         float cosTheta = fmin((unitDirection*(-1)).dotProduct(rec.normal), 1.0);
         float sinTheta = sqrt(1.0-cosTheta*cosTheta);
+        //always draw the fresnel choice, so the sampler's dimensions line up whichever branch is taken
+        float choice = sampler.get1D();
         if(etaIOverEtaT*sinTheta > 1.0) {
-            Vector3 reflected = reflect(unitDirection, rec.normal);
-            scattered = Ray(rec.p, reflected, rayIn.getTime());
+            bsdfSample.direction = reflect(unitDirection, rec.normal);
             return true;
         }
         //calculate reflectivity varying with angle 
         float reflectProb = schlick(cosTheta, etaIOverEtaT);
-        if(randomNum() < reflectProb) {
-            Vector3 reflected = reflect(unitDirection, rec.normal);
-            scattered = Ray(rec.p, reflected, rayIn.getTime());
+        if(choice < reflectProb) {
+            bsdfSample.direction = reflect(unitDirection, rec.normal);
             return true;
         }
-        Vector3 refracted = refract(unitDirection, rec.normal, etaIOverEtaT);
-        scattered = Ray(rec.p, refracted, rayIn.getTime());
+        bsdfSample.direction = unitVector(refract(unitDirection, rec.normal, etaIOverEtaT));
+        return true;
+    }
+
+    virtual bool isSpecular(const hitRecord& rec) const override {
         return true;
     }
 
+    virtual bool needsUV() const override {
+        return false;
+    }
+
     //dimensionless number that describes how fast light travels through the material
     float indexOfRefraction;
 };
 
-class DiffuseLight : public Material {
+class DiffuseLight final : public Material {
     public:
+        virtual MaterialKind kind() const override {
+            return MaterialKind::DiffuseLight;
+        }
+
         DiffuseLight(shared_ptr<Texture> a) : emit(a) {}
-        DiffuseLight(Vector3 c) : emit(make_shared<SolidColor>(c)) {}
+        DiffuseLight(Vector3 c) : emit(makeSceneObject<SolidColor>(c)) {}
 
-        virtual bool scatter(
-            const Ray& r_in, const hitRecord& rec, Vector3& attenuation, Ray& scattered
-        ) const override {
-            return false;
+        virtual bool isEmissive() const override {
+            return true;
         }
 
         virtual Vector3 emitted(float u, float v, const Vector3& p) const override {
             return emit->value(u, v, p);
         }
 
+        virtual Vector3 surfaceColor(const hitRecord& rec) const override {
+            return emit->value(rec.u, rec.v, rec.p);
+        }
+
+        virtual bool needsUV() const override {
+            return emit->needsUV();
+        }
+
     public:
         shared_ptr<Texture> emit;
 };
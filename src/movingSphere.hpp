@@ -3,6 +3,7 @@
  
 #include "./logeometry.hpp"
 #include "./rtCommon.hpp"
+#include "./stats.hpp"
  
 //Represents moving spheres
 class MovingSphere : public Geometry {
@@ -11,8 +12,10 @@ class MovingSphere : public Geometry {
    MovingSphere(Vector3 c0, Vector3 c1, float t0, float t1, float r, shared_ptr<Material> m)
    :center0(c0), center1(c1), time0(t0), time1(t1), radius(r), mat_ptr(m){};
  
-  virtual bool hit(const Ray& r, float tmin, float tmax, hitRecord& rec) const override;
+  virtual bool closestHit(const Ray& r, float tmin, float tmax, HitCandidate& candidate) const override;
+  virtual void surfaceHit(const Ray& r, const HitCandidate& candidate, hitRecord& rec) const override;
   virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override;
+  virtual shared_ptr<Material> material() const override { return mat_ptr; }
 
   Vector3 center(float time) const;
  
@@ -29,10 +32,11 @@ Vector3 MovingSphere::center(float time) const {
    return center0 + (center1 - center0)*((time-time0) / (time1 - time0));
 }
 
-bool MovingSphere::hit(const Ray& r, float tmin, float tmax, hitRecord& rec) const{
+bool MovingSphere::closestHit(const Ray& r, float tmin, float tmax, HitCandidate& candidate) const{
+    RT_COUNT(MovingSphereTests);
     // return quadratic equation dot(B, B)*t^2 + 2*dot(B, A-C)*t + dot(A-C, A-C) - Radius*Radius = 0
     // where discriminant is b^2 - 4ac from form at^2 + bt + c = 0 
-    Vector3 A = r.origin() - center(r.getTime());
+    Vector3 A = r.origin();
     Vector3 B = r.direction();
     Vector3 C = center(r.getTime());
     float a = B.dotProduct(B);
@@ -46,32 +50,30 @@ bool MovingSphere::hit(const Ray& r, float tmin, float tmax, hitRecord& rec) con
         //quadratic equation is: (-b+-√b^2-4ac) / 2a
         //Let’s assume the closest hit point (smallest t), so we only subtract the discriminant
         float root = (-b - sqrt(discriminant)) / (2.0*a);
-        if (root < tmax && root > tmin) {
-            rec.t = root;
-            rec.p = r.pointAtParameter(rec.t);
-            //Add surface side determination 
-            rec.normal = (rec.p - center(r.getTime())) / radius;
-            rec.setFaceNormal(r, rec.normal);
-            //record material of this sphere
-            rec.matPtr = mat_ptr;
-            return true;
+        if (!(root < tmax && root > tmin)) {
+            //the second root based on quadratic equation
+            root = (-b + sqrt(discriminant)) / (2.0*a);
         }
-        //the second root based on quadratic equation
-        root = (-b + sqrt(discriminant)) / (2.0*a);
         if (root < tmax && root > tmin) {
-            rec.t = root;
-            rec.p = r.pointAtParameter(rec.t);
-            //Add surface side determination 
-            rec.normal = (rec.p - center(r.getTime())) / radius;
-            rec.setFaceNormal(r, rec.normal);
-            //record material of this sphere
-            rec.matPtr = mat_ptr;
+            candidate.t = root;
+            candidate.object = this;
             return true;
         }
     }
     return false;
 }
 
+void MovingSphere::surfaceHit(const Ray& r, const HitCandidate& candidate, hitRecord& rec) const{
+    rec.t = candidate.t;
+    rec.p = r.pointAtParameter(rec.t);
+    //Add surface side determination 
+    rec.normal = (rec.p - center(r.getTime())) / radius;
+    rec.setFaceNormal(r, rec.normal);
+    //record material of this sphere
+    rec.matPtr = mat_ptr;
+    rec.object = this;
+}
+
 bool MovingSphere::boundingBox(float t0, float t1, AABB& outputBox) const{
     AABB box0(center(t0) - Vector3(radius, radius, radius),
         center(t0) + Vector3(radius, radius, radius));
@@ -0,0 +1,231 @@
+#ifndef PERFCOUNTERS_HPP_
+#define PERFCOUNTERS_HPP_
+
+//hardware counters (cycles, instructions, cache misses, branch mispredicts) for each phase of a render,
+//read with Linux perf_event_open on every thread that works on the phase
+//off until enablePerfCounters(), and where the kernel won't hand out counters (a container without perf
+//access, a VM without a PMU, not Linux) only the wall time of each phase is kept
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum class PerfPhase {
+    SceneBuild,
+    BVHBuild,
+    //tracing and shading together, as the tiled and ReSTIR renderers interleave them per path
+    Render,
+    //the wavefront renderer's stages, which split traversal from shading
+    Intersect,
+    Shade,
+    Shadow,
+    Count
+};
+
+inline const char* perfPhaseName(PerfPhase phase) {
+    static const char* names[] = {"scene build", "BVH build", "render", "intersect", "shade", "shadow"};
+    return names[static_cast<int>(phase)];
+}
+
+const int perfEventCount = 4;
+
+struct PerfTotals {
+    //summed over every thread that worked on the phase
+    double seconds = 0;
+    //cycles, instructions, cache misses, branch misses
+    uint64_t counts[perfEventCount] = {};
+    int scopes = 0;
+};
+
+struct PerfState {
+    std::atomic<bool> enabled{false};
+    //cleared the first time a thread can't open its counters, the reason is kept for the report
+    std::atomic<bool> available{true};
+    std::string unavailableReason;
+    std::mutex mutex;
+    PerfTotals totals[static_cast<int>(PerfPhase::Count)];
+};
+
+inline PerfState& perfState() {
+    static PerfState state;
+    return state;
+}
+
+inline void enablePerfCounters() {
+    perfState().enabled = true;
+}
+
+//one group of counters on the calling thread, scheduled onto the PMU together so their ratios hold
+class ThreadPerfCounters {
+    public:
+    ThreadPerfCounters() {
+#ifdef __linux__
+        PerfState& state = perfState();
+        if (!state.available) {
+            return;
+        }
+        const uint64_t configs[perfEventCount] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < perfEventCount; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0) {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (state.available) {
+                    state.unavailableReason = std::string("perf_event_open: ") + strerror(errno);
+                    state.available = false;
+                }
+                close();
+                return;
+            }
+        }
+        open = true;
+#else
+        std::lock_guard<std::mutex> lock(perfState().mutex);
+        perfState().unavailableReason = "hardware counters are only read on Linux";
+        perfState().available = false;
+#endif
+    }
+    ThreadPerfCounters(const ThreadPerfCounters&) = delete;
+    ThreadPerfCounters& operator=(const ThreadPerfCounters&) = delete;
+
+    ~ThreadPerfCounters() {
+        close();
+    }
+
+    //the counts so far, scaled up for any time the group spent off the PMU, false if there are no counters
+    bool read(uint64_t counts[perfEventCount]) const {
+#ifdef __linux__
+        if (!open) {
+            return false;
+        }
+        //nr, time enabled, time running, then one value per counter
+        uint64_t data[3 + perfEventCount];
+        if (::read(fds[0], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[0] != perfEventCount) {
+            return false;
+        }
+        double scale = data[2] > 0 ? double(data[1]) / data[2] : 0;
+        for (int i = 0; i < perfEventCount; i++) {
+            counts[i] = static_cast<uint64_t>(data[3 + i] * scale);
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    private:
+    void close() {
+#ifdef __linux__
+        for (int i = perfEventCount - 1; i >= 0; i--) {
+            if (fds[i] >= 0) {
+                ::close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+#endif
+        open = false;
+    }
+
+    int fds[perfEventCount] = {-1, -1, -1, -1};
+    bool open = false;
+};
+
+//the calling thread's counters, opened the first time it measures a phase
+inline const ThreadPerfCounters& threadPerfCounters() {
+    thread_local ThreadPerfCounters counters;
+    return counters;
+}
+
+//adds the wall time and counter deltas between its construction and destruction to phase's totals
+class PerfScope {
+    public:
+    PerfScope(PerfPhase phase) : phase(phase) {
+        if (perfState().enabled.load(std::memory_order_relaxed)) {
+            active = true;
+            counted = threadPerfCounters().read(startCounts);
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+    ~PerfScope() {
+        if (!active) {
+            return;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        uint64_t endCounts[perfEventCount];
+        counted = counted && threadPerfCounters().read(endCounts);
+        PerfState& state = perfState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        PerfTotals& totals = state.totals[static_cast<int>(phase)];
+        totals.seconds += elapsed.count();
+        totals.scopes++;
+        if (counted) {
+            for (int i = 0; i < perfEventCount; i++) {
+                totals.counts[i] += endCounts[i] - startCounts[i];
+            }
+        }
+    }
+
+    private:
+    PerfPhase phase;
+    bool active = false;
+    bool counted = false;
+    uint64_t startCounts[perfEventCount];
+    std::chrono::steady_clock::time_point start;
+};
+
+//one line per phase that ran: thread seconds, then IPC and misses per thousand instructions if counted
+inline void printPerfCounters(std::ostream& out) {
+    PerfState& state = perfState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    out << "\nPhase counters";
+    if (!state.available) {
+        out << " (wall time only, " << state.unavailableReason << ")";
+    }
+    out << ":\n  " << std::left << std::setw(14) << "phase" << std::right << std::setw(12) << "thread s";
+    if (state.available) {
+        out << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(8) << "IPC"
+            << std::setw(14) << "cache MPKI" << std::setw(14) << "branch MPKI";
+    }
+    out << "\n";
+    for (int p = 0; p < static_cast<int>(PerfPhase::Count); p++) {
+        const PerfTotals& totals = state.totals[p];
+        if (totals.scopes == 0) {
+            continue;
+        }
+        out << "  " << std::left << std::setw(14) << perfPhaseName(static_cast<PerfPhase>(p)) << std::right
+            << std::setw(12) << std::fixed << std::setprecision(3) << totals.seconds;
+        uint64_t instructions = totals.counts[1];
+        if (state.available && instructions > 0 && totals.counts[0] > 0) {
+            out << std::setw(16) << totals.counts[0] << std::setw(16) << instructions
+                << std::setw(8) << std::setprecision(2) << double(instructions) / totals.counts[0]
+                << std::setw(14) << 1000.0 * totals.counts[2] / instructions
+                << std::setw(14) << 1000.0 * totals.counts[3] / instructions;
+        }
+        out << "\n";
+    }
+    out << std::defaultfloat << std::setprecision(6);
+}
+
+#endif /* PERFCOUNTERS_HPP_*/
@@ -36,6 +36,18 @@ class PerlinNoise{
         permZ = perlinGeneratePerm();
     }
 
+    //a copy of the noise another PerlinNoise made, from its vectors() and permutations()
+    PerlinNoise(const Vector3* vectors, const int* x, const int* y, const int* z) {
+        randomVector = new Vector3[pointCount];
+        permX = new int[pointCount];
+        permY = new int[pointCount];
+        permZ = new int[pointCount];
+        std::copy(vectors, vectors + pointCount, randomVector);
+        std::copy(x, x + pointCount, permX);
+        std::copy(y, y + pointCount, permY);
+        std::copy(z, z + pointCount, permZ);
+    }
+
     ~PerlinNoise() {
         delete[] randomVector;
         delete[] permX;
@@ -68,6 +80,17 @@ class PerlinNoise{
         return perlinInterpolation(grid3d, u, v, w);
     }
 
+    const Vector3* vectors() const {
+        return randomVector;
+    }
+
+    //axis 0, 1 or 2
+    const int* permutation(int axis) const {
+        return axis == 0 ? permX : axis == 1 ? permY : permZ;
+    }
+
+    static const int pointCount = 256;
+
     //a noise created from multiple frequencies added together
     float turbulence(const Vector3& p, int depth=7) const{
         float acc = 0.0;
@@ -102,7 +125,6 @@ class PerlinNoise{
     }
 
     private:
-        static const int pointCount = 256;
         Vector3* randomVector;
         int* permX;
         int* permY;
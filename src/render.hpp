@@ -0,0 +1,494 @@
+#ifndef RENDER_HPP_
+#define RENDER_HPP_
+
+#include "./rtCommon.hpp"
+#include "./geometry.hpp"
+#include "./material.hpp"
+#include "./camera.hpp"
+#include "./frameBuffer.hpp"
+#include "./imageStream.hpp"
+#include "./sampler.hpp"
+#include "./lights.hpp"
+#include "./stats.hpp"
+#include "./trace.hpp"
+#include "./perfCounters.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class Integrator {
+    //the original recursion: follow material samples until a light or the background is hit
+    Path,
+    //path tracing that also samples a light at every non-specular vertex and weights both strategies
+    MIS,
+    //MIS path tracing, with direct light at the camera ray's first hit resampled from many candidates
+    //and reused across neighbouring pixels and passes (ReSTIR)
+    ReSTIR
+};
+
+//how multiple importance sampling splits a contribution between light and material sampling
+enum class MISHeuristic { Balance, Power };
+
+//the first vertex of a path as the G-buffer cache (gbuffer.hpp) keeps it: what the camera ray hit, the light
+//sampled there and what that light's shadow ray hit, all independent of the materials
+//once recorded, colorMIS intersects the ray with just the kept primitive instead of the whole scene
+struct PrimaryVertex {
+    //false: trace the first vertex and fill this in, true: replay it
+    bool recorded = false;
+    //null where the camera ray escaped
+    const Geometry* object = nullptr;
+    //null where no light was sampled
+    const Geometry* light = nullptr;
+    //null where the shadow ray escaped
+    const Geometry* shadowObject = nullptr;
+};
+
+//settings shared by every frame of a render
+struct RenderSettings {
+    int width = 400;
+    int height = 225;
+    int samplesPerPixel = 100;
+    int maxDepth = 50;
+    Vector3 backgroundColor = Vector3(0, 0, 0);
+    //number of render threads, 0 uses every hardware thread
+    int threads = 0;
+    //edge length in pixels of the square tiles threads pull work in
+    int tileSize = 16;
+    //print a progress counter to stderr
+    bool showProgress = true;
+    //if set, the fraction of the frame finished so far is stored here as it renders
+    std::atomic<float>* progress = nullptr;
+    //if set, the time, bounces and BVH nodes each pixel took are stored here (tiled renderer only)
+    CostBuffers* cost = nullptr;
+    //if set, one entry per sample of the frame ((y * width + x) * samplesPerPixel + sample) that the first vertex
+    //of the sample's path is recorded into or replayed from (gbuffer.hpp), tiled renderer only
+    PrimaryVertex* primaryVertices = nullptr;
+    //if set, finished tiles go to it to be written out band by band and the frame buffer is left empty
+    //(tiled renderer only, without aux, cost or primary vertex buffers, which are kept for the whole frame)
+    ImageStream* stream = nullptr;
+    //gather auxiliary buffers and run the denoiser as the last stage of a frame
+    bool denoise = false;
+    //where pixel, lens, time and bounce sample values come from
+    SamplerType samplerType = SamplerType::Sobol;
+    Integrator integrator = Integrator::MIS;
+    MISHeuristic heuristic = MISHeuristic::Power;
+    //ReSTIR: light candidates streamed through each pixel's reservoir per pass
+    int restirCandidates = 32;
+    //ReSTIR: neighbouring reservoirs merged into each pixel's, and how far away (in pixels) they are picked
+    int restirNeighbours = 5;
+    int restirRadius = 20;
+    //ReSTIR: last pass's reservoir counts as at most this many passes' worth of candidates, 0 turns temporal reuse off
+    //the paper uses 20, which suits looking at every pass on its own, but makes the passes so alike that their
+    //average comes out noisier than without reuse (4spp scene 9 direct light RMSE 0.042 without, 0.053 with 20)
+    float restirHistory = 0;
+    //trace batches of paths stage by stage (wavefront.hpp) instead of one path at a time
+    bool wavefront = false;
+    //paths in flight at once in wavefront mode
+    int wavefrontPaths = 1 << 18;
+    //in wavefront mode, shade the hits of each kind of material together
+    bool sortByMaterial = true;
+};
+
+//what a camera ray hit first, for the denoiser's auxiliary buffers
+struct FirstHit {
+    Vector3 albedo;
+    Vector3 normal;
+    float distance;
+};
+
+inline void recordFirstHit(const Ray& r, const hitRecord& rec, FirstHit& firstHit) {
+    firstHit.albedo = rec.matPtr->surfaceColor(rec);
+    firstHit.normal = rec.normal;
+    firstHit.distance = rec.t * r.direction().magnitude();
+}
+
+inline void recordMiss(const Vector3& backgroundColor, FirstHit& firstHit) {
+    firstHit.albedo = backgroundColor;
+    firstHit.normal = Vector3(0, 0, 0);
+    firstHit.distance = 0;
+}
+
+//calculate color at the set max depth
+Vector3 color(const Ray& r, const Vector3 backgroundColor, const Geometry& scene, int depth, Sampler& sampler) {
+    hitRecord rec;
+    if(depth <= 0) { 
+        //no light
+        return Vector3(0, 0, 0);
+    }
+    if(!scene.hit(r, 0.01, infinity, rec)) {
+        //ray didn't hit any object, return background color
+        return backgroundColor;
+    }
+        BSDFSample bsdfSample;
+        Vector3 emitted = rec.matPtr->emitted(rec.u, rec.v, rec.p);
+
+        //just light, not scattered on any object
+        sampler.nextBounce();
+        if (!rec.matPtr->sample(r, rec, sampler, bsdfSample)){
+            return emitted;
+        }
+    //object under light recursively find color
+    Ray scattered(rec.p, bsdfSample.direction, r.getTime());
+    if (depth > 1) {
+        RT_COUNT(BounceRays);
+    }
+    return emitted + bsdfSample.weight * color(scattered, backgroundColor, scene, depth-1, sampler);
+}
+
+//same as color(), but also reports what the camera ray hit first
+Vector3 colorWithAux(const Ray& r, const Vector3 backgroundColor, const Geometry& scene, int depth,
+    Sampler& sampler, FirstHit& firstHit) {
+    RT_COUNT(CameraRays);
+    hitRecord rec;
+    if(depth <= 0 || !scene.hit(r, 0.01, infinity, rec)) {
+        recordMiss(backgroundColor, firstHit);
+        return depth <= 0 ? Vector3(0, 0, 0) : backgroundColor;
+    }
+    recordFirstHit(r, rec, firstHit);
+
+    BSDFSample bsdfSample;
+    Vector3 emitted = rec.matPtr->emitted(rec.u, rec.v, rec.p);
+    sampler.nextBounce();
+    if (!rec.matPtr->sample(r, rec, sampler, bsdfSample)){
+        return emitted;
+    }
+    Ray scattered(rec.p, bsdfSample.direction, r.getTime());
+    if (depth > 1) {
+        RT_COUNT(BounceRays);
+    }
+    return emitted + bsdfSample.weight * color(scattered, backgroundColor, scene, depth-1, sampler);
+}
+
+inline float misWeight(MISHeuristic heuristic, float pdf, float otherPdf) {
+    if (heuristic == MISHeuristic::Power) {
+        pdf *= pdf;
+        otherPdf *= otherPdf;
+    }
+    return pdf / (pdf + otherPdf);
+}
+
+//true if the light is the first thing shadowRay hits, with lightRec filled for its emission
+//only the light gets a closest hit, the rest of the scene is asked whether anything lies in front of it, which can
+//stop at the first blocker found, the far end is pulled in a little so the light's own surface isn't counted
+inline bool lightVisible(const Geometry& scene, const Geometry& light, const Ray& shadowRay, hitRecord& lightRec) {
+    HitCandidate lightHit;
+    if (!light.closestHit(shadowRay, 0.01, infinity, lightHit)
+        || scene.occluded(shadowRay, 0.01, lightHit.t * (1 - 1e-4f))) {
+        return false;
+    }
+    light.surfaceHit(shadowRay, lightHit, lightRec);
+    return true;
+}
+
+//path tracing with next event estimation: at every vertex that isn't purely specular, one light is sampled
+//and one material direction is sampled, and light reached either way is weighted by the MIS heuristic
+//(Veach 1997), so small bright lights come from light sampling and glossy highlights from material sampling
+//skipPrimaryDirect leaves out light reaching the first hit straight from a light through a non-delta lobe,
+//for when that is computed elsewhere
+//if primary is given, the first vertex is recorded into it or replayed from it
+//firstRecord gets the camera ray's full hit record, with a null object if it missed
+Vector3 colorMIS(const Ray& cameraRay, const Vector3 backgroundColor, const Geometry& scene, const LightList& lights,
+    int maxDepth, MISHeuristic heuristic, Sampler& sampler, FirstHit* firstHit = nullptr, bool skipPrimaryDirect = false,
+    PrimaryVertex* primary = nullptr, hitRecord* firstRecord = nullptr) {
+    Vector3 radiance(0, 0, 0);
+    Vector3 throughput(1, 1, 1);
+    Ray r = cameraRay;
+    //how the current ray was chosen, to weight any light it hits
+    bool fromDelta = true;
+    float bsdfPdf = 0;
+    Vector3 previousPoint;
+
+    for (int depth = 0; depth < maxDepth; depth++) {
+        if (depth == 0) {
+            RT_COUNT(CameraRays);
+        } else {
+            RT_COUNT(BounceRays);
+        }
+        RT_COUNT_DEPTH(depth, 1);
+        hitRecord rec;
+        bool hit;
+        if (depth == 0 && primary && primary->recorded) {
+            hit = primary->object && primary->object->hit(r, 0.01, infinity, rec);
+        } else {
+            hit = scene.hit(r, 0.01, infinity, rec);
+            if (depth == 0 && primary) {
+                primary->object = hit ? rec.object : nullptr;
+            }
+        }
+        if (!hit) {
+            if (depth == 0 && firstHit) {
+                recordMiss(backgroundColor, *firstHit);
+            }
+            if (depth == 0 && firstRecord) {
+                firstRecord->object = nullptr;
+            }
+            radiance += throughput * backgroundColor;
+            break;
+        }
+        if (depth == 0 && firstHit) {
+            recordFirstHit(r, rec, *firstHit);
+        }
+        if (depth == 0 && firstRecord) {
+            *firstRecord = rec;
+        }
+
+        const Material& material = *rec.matPtr;
+        if (material.isEmissive()) {
+            Vector3 emitted = material.emitted(rec.u, rec.v, rec.p);
+            if (fromDelta) {
+                radiance += throughput * emitted;
+            }
+            else if (!(skipPrimaryDirect && depth == 1)) {
+                float lightPdf = lights.pdf(previousPoint, r.direction(), rec.object);
+                radiance += throughput * emitted * misWeight(heuristic, bsdfPdf, lightPdf);
+            }
+        }
+
+        sampler.nextBounce();
+        //always draw the light sample's dimensions so the material's dimensions line up at every vertex
+        float lightChoice = lights.empty() ? 0 : sampler.get1D();
+        float lightU1 = 0, lightU2 = 0;
+        if (!lights.empty()) {
+            sampler.get2D(lightU1, lightU2);
+        }
+
+        LightSample lightSample;
+        bool sampleLight = !material.isSpecular(rec) && !(skipPrimaryDirect && depth == 0);
+        //a recording keeps the first shadow ray whatever the material, in case an edit makes it needed
+        bool recordShadow = depth == 0 && primary && !primary->recorded;
+        if ((sampleLight || recordShadow) && lights.sample(rec.p, lightChoice, lightU1, lightU2, lightSample)) {
+            Vector3 f = sampleLight ? material.eval(r, rec, lightSample.direction) : Vector3(0, 0, 0);
+            if (f.vecLengthSquared() > 0 || recordShadow) {
+                //the light is visible if the shadow ray's first hit is the light itself
+                hitRecord shadowRec;
+                Ray shadowRay(rec.p, lightSample.direction, r.getTime());
+                bool shadowHit;
+                if (depth == 0 && primary && primary->recorded && primary->light == lightSample.light) {
+                    shadowHit = primary->shadowObject && primary->shadowObject->hit(shadowRay, 0.01, infinity, shadowRec);
+                } else if (recordShadow) {
+                    //a recording keeps whatever the shadow ray hit, which takes its closest hit
+                    RT_COUNT(ShadowRays);
+                    shadowHit = scene.hit(shadowRay, 0.01, infinity, shadowRec);
+                    primary->light = lightSample.light;
+                    primary->shadowObject = shadowHit ? shadowRec.object : nullptr;
+                } else {
+                    RT_COUNT(ShadowRays);
+                    shadowHit = lightVisible(scene, *lightSample.light, shadowRay, shadowRec);
+                }
+                if (f.vecLengthSquared() > 0 && shadowHit && shadowRec.object == lightSample.light) {
+                    Vector3 emitted = shadowRec.matPtr->emitted(shadowRec.u, shadowRec.v, shadowRec.p);
+                    float weight = misWeight(heuristic, lightSample.pdf, material.pdf(r, rec, lightSample.direction));
+                    radiance += throughput * f * emitted * (weight / lightSample.pdf);
+                }
+            }
+        }
+
+        BSDFSample bsdfSample;
+        if (!material.sample(r, rec, sampler, bsdfSample)) {
+            break;
+        }
+        throughput *= bsdfSample.weight;
+        fromDelta = bsdfSample.isDelta;
+        bsdfPdf = bsdfSample.pdf;
+        previousPoint = rec.p;
+        r = Ray(rec.p, bsdfSample.direction, r.getTime());
+    }
+    return radiance;
+}
+
+//trace one camera sample with the integrator chosen in settings, filling firstHit if given
+//primary is recorded or replayed by the light sampling integrators, the path integrator ignores it
+Vector3 traceSample(const Ray& r, const Geometry& scene, const LightList& lights, const RenderSettings& settings,
+    Sampler& sampler, FirstHit* firstHit, PrimaryVertex* primary = nullptr) {
+    if (settings.integrator != Integrator::Path) {
+        return colorMIS(r, settings.backgroundColor, scene, lights, settings.maxDepth, settings.heuristic, sampler, firstHit,
+            false, primary);
+    }
+    if (firstHit) {
+        return colorWithAux(r, settings.backgroundColor, scene, settings.maxDepth, sampler, *firstHit);
+    }
+    RT_COUNT(CameraRays);
+    return color(r, settings.backgroundColor, scene, settings.maxDepth, sampler);
+}
+
+//start sample s of the pixel at column x, row y (row 0 at the top) and make its camera ray
+inline Ray cameraRay(const Camera& cam, const RenderSettings& settings, int x, int y, int s, Sampler& sampler) {
+    int j = settings.height - 1 - y;
+    //antialiasing, blur edges by generating pixels w multiple samples
+    sampler.startSample(x, y, s);
+    float jitterX, jitterY;
+    sampler.get2D(jitterX, jitterY);
+    auto u = (x + jitterX) / (settings.width - 1);
+    auto v = (j + jitterY) / (settings.height - 1);
+    return cam.getRay(u, v, sampler);
+}
+
+//average all the samples of the pixel at column x, row y (row 0 at the top)
+//if aux is given, the pixel's first hit albedo, normal, depth and variance are written to it too
+//if bounces is given, the average number of bounces of the pixel's paths is written to it
+Vector3 renderPixel(const Geometry& scene, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    int x, int y, Sampler& sampler, AuxBuffers* aux = nullptr, float* bounces = nullptr) {
+    Vector3 col(0, 0, 0);
+    Vector3 albedo(0, 0, 0);
+    Vector3 normal(0, 0, 0);
+    float depth = 0;
+    float lumSquared = 0;
+    int bounceCount = 0;
+    for(int s = 0; s < settings.samplesPerPixel; s++) {
+        Ray r = cameraRay(cam, settings, x, y, s, sampler);
+        PrimaryVertex* primary = nullptr;
+        if (settings.primaryVertices) {
+            primary = &settings.primaryVertices[(size_t(y) * settings.width + x) * settings.samplesPerPixel + s];
+        }
+        if (!aux) {
+            col += traceSample(r, scene, lights, settings, sampler, nullptr, primary);
+            bounceCount += sampler.bounces();
+            continue;
+        }
+        FirstHit firstHit;
+        Vector3 sample = traceSample(r, scene, lights, settings, sampler, &firstHit, primary);
+        bounceCount += sampler.bounces();
+        col += sample;
+        albedo += firstHit.albedo;
+        normal += firstHit.normal;
+        depth += firstHit.distance;
+        lumSquared += luminance(sample) * luminance(sample);
+    }
+
+    int n = settings.samplesPerPixel;
+    col /= n;
+    if (bounces) {
+        *bounces = float(bounceCount) / n;
+    }
+    if (aux) {
+        int index = y * settings.width + x;
+        aux->albedo.pixels[index] = albedo / n;
+        aux->normal.pixels[index] = normal / n;
+        aux->depth[index] = depth / n;
+        //variance of the mean is the sample variance divided by the sample count
+        float meanLum = luminance(col);
+        aux->variance[index] = n > 1 ? std::max(0.0f, lumSquared / n - meanLum*meanLum) / (n - 1) : 0;
+    }
+    return col;
+}
+
+inline int renderThreadCount(const RenderSettings& settings) {
+    if (settings.threads > 0) {
+        return settings.threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//renders a whole frame with the ReSTIR integrator, in restir.hpp
+void renderFrameReSTIR(const Geometry& scene, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    FrameBuffer& image, AuxBuffers* aux);
+
+//renders a whole frame a wave of paths at a time, in wavefront.hpp
+void renderFrameWavefront(const Geometry& scene, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    FrameBuffer& image, AuxBuffers* aux);
+
+//render a frame into image, splitting it into tiles that worker threads pull until none are left
+//if aux is given it is filled with the first hit buffers the denoiser needs
+void renderFrame(const Geometry& scene, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    FrameBuffer& image, AuxBuffers* aux = nullptr) {
+    TraceScope trace("render frame");
+    trace.arg("width", settings.width);
+    trace.arg("height", settings.height);
+    trace.arg("samplesPerPixel", settings.samplesPerPixel);
+    //reservoirs are shared between pixels, so ReSTIR renders pass by pass instead of tile by tile
+    if (settings.integrator == Integrator::ReSTIR) {
+        renderFrameReSTIR(scene, lights, cam, settings, image, aux);
+        return;
+    }
+    if (settings.wavefront) {
+        renderFrameWavefront(scene, lights, cam, settings, image, aux);
+        return;
+    }
+    ImageStream* stream = settings.stream;
+    if (!stream && (image.width != settings.width || image.height != settings.height)) {
+        image = FrameBuffer(settings.width, settings.height);
+    }
+    if (aux && (aux->albedo.width != settings.width || aux->albedo.height != settings.height)) {
+        *aux = AuxBuffers(settings.width, settings.height);
+    }
+    CostBuffers* cost = settings.cost;
+    if (cost && (cost->width != settings.width || cost->height != settings.height)) {
+        *cost = CostBuffers(settings.width, settings.height);
+    }
+
+    int tilesX = (settings.width + settings.tileSize - 1) / settings.tileSize;
+    int tilesY = (settings.height + settings.tileSize - 1) / settings.tileSize;
+    int tileCount = tilesX * tilesY;
+    std::atomic<int> nextTile(0);
+    std::atomic<int> tilesDone(0);
+    std::mutex progressMutex;
+
+    auto prototype = makeSampler(settings.samplerType, settings.samplesPerPixel);
+    auto worker = [&]() {
+        auto sampler = prototype->clone();
+        PerfScope perf(PerfPhase::Render);
+        for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+            int x0 = (tile % tilesX) * settings.tileSize;
+            int y0 = (tile / tilesX) * settings.tileSize;
+            int x1 = std::min(x0 + settings.tileSize, settings.width);
+            int y1 = std::min(y0 + settings.tileSize, settings.height);
+            TraceScope trace("tile");
+            trace.arg("x", x0);
+            trace.arg("y", y0);
+            trace.arg("samples", int64_t(x1 - x0) * (y1 - y0) * settings.samplesPerPixel);
+            if (stream) {
+                stream->beginTile(y0);
+            }
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    if (stream) {
+                        stream->at(x, y) = renderPixel(scene, lights, cam, settings, x, y, *sampler, aux);
+                        continue;
+                    }
+                    if (!cost) {
+                        image.at(x, y) = renderPixel(scene, lights, cam, settings, x, y, *sampler, aux);
+                        continue;
+                    }
+                    int index = y * settings.width + x;
+                    auto pixelStart = std::chrono::steady_clock::now();
+#ifdef RT_STATS
+                    uint64_t nodesBefore = threadStats().stats[StatCounter::BVHNodeVisits];
+#endif
+                    image.at(x, y) = renderPixel(scene, lights, cam, settings, x, y, *sampler, aux, &cost->bounces[index]);
+                    cost->seconds[index] = std::chrono::duration<float>(std::chrono::steady_clock::now() - pixelStart).count();
+#ifdef RT_STATS
+                    cost->nodes[index] = threadStats().stats[StatCounter::BVHNodeVisits] - nodesBefore;
+#endif
+                }
+            }
+            if (stream) {
+                stream->endTile(x0, y0, x1, y1);
+            }
+
+            int remaining = tileCount - ++tilesDone;
+            if (settings.progress) {
+                settings.progress->store(float(tilesDone) / tileCount);
+            }
+            if (settings.showProgress) {
+                std::lock_guard<std::mutex> lock(progressMutex);
+                std::cerr << "\rTiles remaining: " << remaining << ' ' << std::flush;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < renderThreadCount(settings); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+#endif /* RENDER_HPP_*/
@@ -0,0 +1,280 @@
+#ifndef RESTIR_HPP_
+#define RESTIR_HPP_
+
+#include "./rtCommon.hpp"
+#include "./geometry.hpp"
+#include "./material.hpp"
+#include "./camera.hpp"
+#include "./frameBuffer.hpp"
+#include "./sampler.hpp"
+#include "./lights.hpp"
+#include "./render.hpp"
+#include "./threading.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+//reservoir-based spatiotemporal importance resampling of direct light (Bitterli et al. 2020)
+//every pass, each pixel streams cheap light candidates through a reservoir that keeps one of them,
+//merges in its reservoir from the previous pass and a few of its neighbours', and traces a single
+//shadow ray to the light point that survived
+
+//a point on a light, which is what reservoirs keep and pass between pixels
+struct LightPoint {
+    const Geometry* light = nullptr;
+    Vector3 point;
+    Vector3 normal;
+    Vector3 emitted;
+};
+
+struct Reservoir {
+    LightPoint sample;
+    //sum of the resampling weights of every candidate streamed through
+    float weightSum = 0;
+    //number of candidates the reservoir stands for
+    float count = 0;
+    //contribution weight of sample, weightSum / (count * target(sample)), 0 if it can't contribute
+    float W = 0;
+
+    //keep candidate with probability weight / weightSum
+    void update(const LightPoint& candidate, float weight, float u) {
+        weightSum += weight;
+        count += 1;
+        if (weight > 0 && u * weightSum < weight) {
+            sample = candidate;
+        }
+    }
+};
+
+//what a pixel's camera ray hit during the current pass
+struct ShadingPoint {
+    //false for misses and purely specular surfaces, which have no direct light to resample
+    bool valid = false;
+    Ray ray;
+    hitRecord rec;
+    float distance = 0;
+};
+
+//light from y reflected towards the camera at surface, ignoring whether anything is in the way
+//its luminance is the target function resampling aims for
+inline Vector3 unshadowedContribution(const ShadingPoint& surface, const LightPoint& y) {
+    Vector3 toLight = y.point - surface.rec.p;
+    float distanceSquared = toLight.vecLengthSquared();
+    if (!y.light || distanceSquared == 0) {
+        return Vector3(0, 0, 0);
+    }
+    Vector3 direction = toLight / sqrt(distanceSquared);
+    float cosLight = fabs(direction.dotProduct(y.normal));
+    Vector3 f = surface.rec.matPtr->eval(surface.ray, surface.rec, direction);
+    return f * y.emitted * (cosLight / distanceSquared);
+}
+
+inline bool lightPointVisible(const Geometry& scene, const ShadingPoint& surface, const LightPoint& y) {
+    Vector3 toLight = y.point - surface.rec.p;
+    float epsilon = 0.01 / toLight.magnitude();
+    RT_COUNT(ShadowRays);
+    //the light point sits at t = 1, anything hit before it (including the far side of the light itself) blocks it
+    return !scene.occluded(Ray(surface.rec.p, toLight, surface.ray.getTime()), epsilon, 1 - epsilon);
+}
+
+inline void finalizeReservoir(Reservoir& reservoir, const ShadingPoint& surface) {
+    float target = luminance(unshadowedContribution(surface, reservoir.sample));
+    reservoir.W = target > 0 && reservoir.count > 0 ? reservoir.weightSum / (reservoir.count * target) : 0;
+}
+
+//resampled importance sampling of count candidates drawn from the light list
+Reservoir initialCandidates(const ShadingPoint& surface, const LightList& lights, int count) {
+    Reservoir reservoir;
+    for (int i = 0; i < count; i++) {
+        LightSample lightSample;
+        hitRecord lightRec;
+        if (!lights.sample(surface.rec.p, randomNum(), randomNum(), randomNum(), lightSample)
+            || !lightSample.light->hit(Ray(surface.rec.p, lightSample.direction, surface.ray.getTime()), 0.001, infinity, lightRec)) {
+            reservoir.count += 1;
+            continue;
+        }
+        LightPoint candidate{lightSample.light, lightRec.p, lightRec.normal, lightRec.matPtr->emitted(lightRec.u, lightRec.v, lightRec.p)};
+        //the list samples by solid angle, the target is per unit light area
+        float sourcePdf = lightSample.pdf * fabs(lightSample.direction.dotProduct(lightRec.normal)) / (lightRec.t * lightRec.t);
+        float target = luminance(unshadowedContribution(surface, candidate));
+        reservoir.update(candidate, sourcePdf > 0 ? target / sourcePdf : 0, randomNum());
+    }
+    finalizeReservoir(reservoir, surface);
+    return reservoir;
+}
+
+//a reservoir to merge, and the shading point it was built for
+struct ReservoirSource {
+    const Reservoir* reservoir;
+    const ShadingPoint* surface;
+};
+
+//merge reservoirs built at other shading points (or passes) into one for surface
+//the result's weight only counts the candidates of reservoirs whose own shading point could have picked the
+//surviving light (algorithm 6 of the paper, without its visibility test), plain 1/M weights darken wherever
+//neighbours face differently
+Reservoir combineReservoirs(const ShadingPoint& surface, const std::vector<ReservoirSource>& sources) {
+    Reservoir result;
+    float count = 0;
+    for (const auto& source : sources) {
+        const Reservoir& reservoir = *source.reservoir;
+        float target = luminance(unshadowedContribution(surface, reservoir.sample));
+        result.update(reservoir.sample, target * reservoir.W * reservoir.count, randomNum());
+        count += reservoir.count;
+    }
+    result.count = count;
+
+    float target = luminance(unshadowedContribution(surface, result.sample));
+    float possibleCount = 0;
+    for (const auto& source : sources) {
+        if (luminance(unshadowedContribution(*source.surface, result.sample)) > 0) {
+            possibleCount += source.reservoir->count;
+        }
+    }
+    result.W = target > 0 && possibleCount > 0 ? result.weightSum / (possibleCount * target) : 0;
+    return result;
+}
+
+//reuse is limited to pixels that see about the same surface, otherwise their lights are a poor match
+inline bool similarSurfaces(const ShadingPoint& a, const ShadingPoint& b) {
+    return b.valid && a.rec.normal.dotProduct(b.rec.normal) > 0.9 && fabs(a.distance - b.distance) < 0.1 * a.distance;
+}
+
+//one pass per sample per pixel: camera rays, initial candidates and temporal reuse, then spatial reuse and shading
+//visibility is only tested for the surviving light, so reuse still darkens soft shadows a little
+void renderFrameReSTIR(const Geometry& scene, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    FrameBuffer& image, AuxBuffers* aux) {
+    int width = settings.width;
+    int height = settings.height;
+    if (image.width != width || image.height != height) {
+        image = FrameBuffer(width, height);
+    }
+    if (aux && (aux->albedo.width != width || aux->albedo.height != height)) {
+        *aux = AuxBuffers(width, height);
+    }
+
+    int pixelCount = width * height;
+    int threadCount = renderThreadCount(settings);
+    int passes = settings.samplesPerPixel;
+    float maxHistory = settings.restirHistory * settings.restirCandidates;
+
+    std::vector<Vector3> sum(pixelCount, Vector3(0, 0, 0));
+    std::vector<Vector3> passRadiance(pixelCount);
+    std::vector<float> lumSquared(pixelCount, 0);
+    std::vector<FirstHit> firstHitSum(pixelCount, FirstHit{Vector3(0, 0, 0), Vector3(0, 0, 0), 0});
+    std::vector<ShadingPoint> surfaces(pixelCount);
+    std::vector<ShadingPoint> previousSurfaces(pixelCount);
+    std::vector<Reservoir> reservoirs(pixelCount);
+    std::vector<Reservoir> reused(pixelCount);
+
+    auto prototype = makeSampler(settings.samplerType, settings.samplesPerPixel);
+    for (int pass = 0; pass < passes; pass++) {
+        TraceScope trace("ReSTIR pass");
+        trace.arg("pass", pass);
+        forEachRow(height, threadCount, [&](int y) {
+            PerfScope perf(PerfPhase::Render);
+            auto sampler = prototype->clone();
+            std::vector<ReservoirSource> sources;
+            int j = height - 1 - y;
+            for (int x = 0; x < width; x++) {
+                int p = y * width + x;
+                sampler->startSample(x, y, pass);
+                float jitterX, jitterY;
+                sampler->get2D(jitterX, jitterY);
+                Ray r = cam.getRay((x + jitterX) / (width - 1), (j + jitterY) / (height - 1), *sampler);
+
+                //everything but the direct light at the first hit comes from the path tracer
+                FirstHit firstHit;
+                ShadingPoint& surface = surfaces[p];
+                passRadiance[p] = colorMIS(r, settings.backgroundColor, scene, lights, settings.maxDepth,
+                    settings.heuristic, *sampler, &firstHit, true, nullptr, &surface.rec);
+                firstHitSum[p].albedo += firstHit.albedo;
+                firstHitSum[p].normal += firstHit.normal;
+                firstHitSum[p].distance += firstHit.distance;
+
+                surface.ray = r;
+                surface.distance = firstHit.distance;
+                surface.valid = !lights.empty() && surface.rec.object && !surface.rec.matPtr->isSpecular(surface.rec);
+                if (!surface.valid) {
+                    reservoirs[p] = Reservoir();
+                    continue;
+                }
+
+                Reservoir reservoir = initialCandidates(surface, lights, settings.restirCandidates);
+                //visibility reuse: a candidate this pixel can't see isn't worth handing to anyone
+                if (reservoir.W > 0 && !lightPointVisible(scene, surface, reservoir.sample)) {
+                    reservoir.weightSum = 0;
+                    reservoir.W = 0;
+                }
+                //temporal reuse: the camera holds still between passes, so last pass's reservoir for this pixel still fits
+                if (pass > 0 && maxHistory > 0 && similarSurfaces(surface, previousSurfaces[p])) {
+                    Reservoir history = reused[p];
+                    history.count = std::min(history.count, maxHistory);
+                    sources.clear();
+                    sources.push_back(ReservoirSource{&reservoir, &surface});
+                    sources.push_back(ReservoirSource{&history, &previousSurfaces[p]});
+                    reservoir = combineReservoirs(surface, sources);
+                }
+                reservoirs[p] = reservoir;
+            }
+        });
+
+        //spatial reuse and shading
+        forEachRow(height, threadCount, [&](int y) {
+            PerfScope perf(PerfPhase::Render);
+            std::vector<ReservoirSource> sources;
+            for (int x = 0; x < width; x++) {
+                int p = y * width + x;
+                const ShadingPoint& surface = surfaces[p];
+                Reservoir reservoir = reservoirs[p];
+                if (surface.valid) {
+                    sources.clear();
+                    sources.push_back(ReservoirSource{&reservoirs[p], &surface});
+                    for (int k = 0; k < settings.restirNeighbours; k++) {
+                        float angle = randomNum(0, 2*pi);
+                        float radius = settings.restirRadius * sqrt(randomNum());
+                        int qx = x + static_cast<int>(radius * cos(angle));
+                        int qy = y + static_cast<int>(radius * sin(angle));
+                        if (qx < 0 || qx >= width || qy < 0 || qy >= height || (qx == x && qy == y)) {
+                            continue;
+                        }
+                        int q = qy * width + qx;
+                        if (similarSurfaces(surface, surfaces[q])) {
+                            sources.push_back(ReservoirSource{&reservoirs[q], &surfaces[q]});
+                        }
+                    }
+                    reservoir = combineReservoirs(surface, sources);
+                    if (reservoir.W > 0 && lightPointVisible(scene, surface, reservoir.sample)) {
+                        passRadiance[p] += unshadowedContribution(surface, reservoir.sample) * reservoir.W;
+                    }
+                }
+                reused[p] = reservoir;
+                sum[p] += passRadiance[p];
+                lumSquared[p] += luminance(passRadiance[p]) * luminance(passRadiance[p]);
+            }
+        });
+        std::swap(surfaces, previousSurfaces);
+        if (settings.progress) {
+            settings.progress->store(float(pass + 1) / passes);
+        }
+
+        if (settings.showProgress) {
+            std::cerr << "\rPasses remaining: " << passes - pass - 1 << ' ' << std::flush;
+        }
+    }
+
+    for (int p = 0; p < pixelCount; p++) {
+        image.pixels[p] = sum[p] / passes;
+        if (aux) {
+            aux->albedo.pixels[p] = firstHitSum[p].albedo / passes;
+            aux->normal.pixels[p] = firstHitSum[p].normal / passes;
+            aux->depth[p] = firstHitSum[p].distance / passes;
+            //variance of the mean, as in renderPixel
+            float meanLum = luminance(image.pixels[p]);
+            aux->variance[p] = passes > 1 ? std::max(0.0f, lumSquared[p] / passes - meanLum*meanLum) / (passes - 1) : 0;
+        }
+    }
+}
+
+#endif /* RESTIR_HPP_*/
@@ -8,6 +8,8 @@
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include <random>
+#include <atomic>
 
 // Usings:
 using std::shared_ptr;
@@ -23,9 +25,23 @@ inline float degreesToRadians(float degrees) {
     return degrees * pi / 180;
 }
 
+//each thread owns its own generator so render threads never contend on rand()
+//the main thread always starts from the same seed, so scene construction stays reproducible
+inline std::mt19937& randomGenerator() {
+    static std::atomic<unsigned> nextSeed(1);
+    thread_local std::mt19937 generator(nextSeed.fetch_add(1));
+    return generator;
+}
+
+//reseed the calling thread's generator
+inline void seedRandom(unsigned seed) {
+    randomGenerator().seed(seed);
+}
+
 //return a random number 0 <= x < 1
 inline float randomNum() {
-    return rand() / (RAND_MAX + 1.0);
+    //keep the top 24 bits so the result is exactly representable and never rounds up to 1
+    return (randomGenerator()() >> 8) * (1.0f / 16777216.0f);
 }
 
 //return a random number min <= x < max
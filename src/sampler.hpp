@@ -0,0 +1,415 @@
+#ifndef SAMPLER_HPP_
+#define SAMPLER_HPP_
+
+#include "./rtCommon.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Hash helpers shared by the samplers
+inline uint32_t hashUint(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hashCombine(uint32_t seed, uint32_t v) {
+    return hashUint(seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2)));
+}
+
+//map 32 random bits to a float in [0, 1)
+inline float toUnitFloat(uint32_t x) {
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+inline uint32_t reverseBits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+//Owen scrambling by hashing (Burley 2020, "Practical Hash-based Owen Scrambling")
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    //Laine-Karras permutation
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return reverseBits(x);
+}
+
+//first two dimensions of the Sobol sequence, as 32 bit fixed point
+inline uint32_t sobol(uint32_t index, int dimension) {
+    if (dimension == 0) {
+        return reverseBits(index);
+    }
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+//position of i in a pseudo random permutation of [0, l) chosen by p (Kensler 2013, "Correlated Multi-Jittered Sampling")
+inline uint32_t permuteIndex(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p; i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8; i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1; i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11; i *= 0x74dcb303;
+        i ^= (i & w) >> 2; i *= 0x9e501cc3;
+        i ^= (i & w) >> 2; i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+//Hands out the uniform numbers a camera sample and its path consume, one dimension at a time
+//A sample draws the pixel jitter, lens position and shutter time first, then each bounce draws from
+//its own block of dimensions, so dimension d means the same thing in every sample of a pixel.
+//That is what lets the low-discrepancy samplers stratify each decision across a pixel's samples.
+class Sampler {
+    public:
+    //pixel jitter (2), lens position (2), shutter time (1)
+    static const int cameraDimensions = 5;
+    //light sampling draws 3 numbers per bounce and no material draws more than 4
+    static const int dimensionsPerBounce = 8;
+
+    virtual ~Sampler(){}
+
+    //begin sample sampleIndex of the pixel at column px, row py
+    void startSample(int px, int py, int index) {
+        x = px;
+        y = py;
+        sampleIndex = index;
+        dimension = 0;
+        bounce = 0;
+    }
+
+    //pick sample index of the pixel at column px, row py back up at the start of bounce bounceIndex,
+    //where a path traced one bounce at a time (wavefront.hpp) left off
+    void resumeSample(int px, int py, int index, int bounceIndex) {
+        startSample(px, py, index);
+        bounce = bounceIndex;
+        nextBounce();
+    }
+
+    //bounces the current sample's path has made so far
+    int bounces() const {
+        return bounce;
+    }
+
+    //move to the dimensions of the next bounce along the path
+    void nextBounce() {
+        dimension = cameraDimensions + bounce++ * dimensionsPerBounce;
+    }
+
+    float get1D() {
+        return sample1D(dimension++);
+    }
+
+    void get2D(float& u, float& v) {
+        sample2D(dimension, u, v);
+        dimension += 2;
+    }
+
+    //every render thread needs its own sampler
+    virtual shared_ptr<Sampler> clone() const = 0;
+
+    protected:
+    virtual float sample1D(int dim) = 0;
+    virtual void sample2D(int dim, float& u, float& v) = 0;
+
+    //a seed unique to this pixel and dimension
+    uint32_t pixelSeed(int dim) const {
+        return hashCombine(hashCombine(hashUint(x), y), dim);
+    }
+
+    int x = 0;
+    int y = 0;
+    int sampleIndex = 0;
+    int dimension = 0;
+    int bounce = 0;
+};
+
+//independent uniform random numbers, the plain Monte Carlo baseline
+class IndependentSampler : public Sampler {
+    public:
+    virtual shared_ptr<Sampler> clone() const override {
+        return make_shared<IndependentSampler>(*this);
+    }
+
+    protected:
+    virtual float sample1D(int dim) override {
+        return randomNum();
+    }
+
+    virtual void sample2D(int dim, float& u, float& v) override {
+        u = randomNum();
+        v = randomNum();
+    }
+};
+
+//jittered strata, one per sample, with the strata visited in a different order for every pixel and dimension
+//so dimensions stay uncorrelated (padding)
+class StratifiedSampler : public Sampler {
+    public:
+    StratifiedSampler(int spp) : samplesPerPixel(spp) {
+        columns = static_cast<int>(ceil(sqrt(float(spp))));
+        rows = (spp + columns - 1) / columns;
+    }
+
+    virtual shared_ptr<Sampler> clone() const override {
+        return make_shared<StratifiedSampler>(*this);
+    }
+
+    protected:
+    //samples past samplesPerPixel start a fresh set of strata
+    uint32_t stratum(int dim, int count) const {
+        uint32_t seed = hashCombine(pixelSeed(dim), sampleIndex / samplesPerPixel);
+        return permuteIndex(sampleIndex % samplesPerPixel, count, seed);
+    }
+
+    virtual float sample1D(int dim) override {
+        return (stratum(dim, samplesPerPixel) + randomNum()) / samplesPerPixel;
+    }
+
+    virtual void sample2D(int dim, float& u, float& v) override {
+        uint32_t cell = stratum(dim, columns * rows);
+        u = (cell % columns + randomNum()) / columns;
+        v = (cell / columns + randomNum()) / rows;
+    }
+
+    int samplesPerPixel;
+    int columns;
+    int rows;
+};
+
+//Owen scrambled, index shuffled Sobol (0,2)-sequence for every pair of dimensions
+class SobolSampler : public Sampler {
+    public:
+    virtual shared_ptr<Sampler> clone() const override {
+        return make_shared<SobolSampler>(*this);
+    }
+
+    protected:
+    virtual float sample1D(int dim) override {
+        uint32_t seed = pixelSeed(dim);
+        uint32_t index = nestedUniformScramble(sampleIndex, seed);
+        return toUnitFloat(nestedUniformScramble(sobol(index, 0), hashCombine(seed, 0)));
+    }
+
+    virtual void sample2D(int dim, float& u, float& v) override {
+        uint32_t seed = pixelSeed(dim);
+        uint32_t index = nestedUniformScramble(sampleIndex, seed);
+        u = toUnitFloat(nestedUniformScramble(sobol(index, 0), hashCombine(seed, 0)));
+        v = toUnitFloat(nestedUniformScramble(sobol(index, 1), hashCombine(seed, 1)));
+    }
+};
+
+//64x64 tileable blue noise ranks made with void and cluster (Ulichney 1993)
+class BlueNoiseMask {
+    public:
+    static const int size = 64;
+
+    //built once on first use
+    static const BlueNoiseMask& get() {
+        static BlueNoiseMask mask;
+        return mask;
+    }
+
+    //value in (0, 1) at pixel (x, y), wrapping around the tile
+    float at(int x, int y) const {
+        return values[(y & (size-1)) * size + (x & (size-1))];
+    }
+
+    private:
+    BlueNoiseMask() : values(size*size) {
+        const int n = size*size;
+        const float sigma = 1.5;
+        //gaussian falloff by toroidal offset
+        std::vector<float> falloff(n);
+        for (int dy = 0; dy < size; dy++) {
+            for (int dx = 0; dx < size; dx++) {
+                int wx = std::min(dx, size - dx);
+                int wy = std::min(dy, size - dy);
+                falloff[dy*size + dx] = exp(-(wx*wx + wy*wy) / (2*sigma*sigma));
+            }
+        }
+
+        std::vector<char> pattern(n, 0);
+        std::vector<float> energy(n, 0);
+        auto toggle = [&](int i, bool on) {
+            pattern[i] = on;
+            float sign = on ? 1 : -1;
+            int ix = i % size;
+            int iy = i / size;
+            for (int j = 0; j < n; j++) {
+                energy[j] += sign * falloff[((j/size - iy) & (size-1)) * size + ((j%size - ix) & (size-1))];
+            }
+        };
+        //the set pixel with the most set neighbours, or the empty pixel with the fewest
+        auto tightestCluster = [&]() {
+            int best = -1;
+            for (int i = 0; i < n; i++) {
+                if (pattern[i] && (best < 0 || energy[i] > energy[best])) best = i;
+            }
+            return best;
+        };
+        auto largestVoid = [&]() {
+            int best = -1;
+            for (int i = 0; i < n; i++) {
+                if (!pattern[i] && (best < 0 || energy[i] < energy[best])) best = i;
+            }
+            return best;
+        };
+
+        //a fixed seed keeps the mask the same from run to run
+        std::mt19937 generator(1234);
+        int ones = n / 10;
+        for (int placed = 0; placed < ones;) {
+            int i = generator() % n;
+            if (!pattern[i]) {
+                toggle(i, true);
+                placed++;
+            }
+        }
+        //spread the initial points out by moving the tightest cluster into the largest void until nothing moves
+        while (true) {
+            int cluster = tightestCluster();
+            toggle(cluster, false);
+            int gap = largestVoid();
+            toggle(gap, true);
+            if (gap == cluster) {
+                break;
+            }
+        }
+
+        std::vector<int> rank(n);
+        std::vector<char> prototype = pattern;
+        std::vector<float> prototypeEnergy = energy;
+        //phase 1: rank the initial points by removing the tightest cluster first
+        for (int r = ones - 1; r >= 0; r--) {
+            int cluster = tightestCluster();
+            toggle(cluster, false);
+            rank[cluster] = r;
+        }
+        //phase 2: fill the largest voids up to half full
+        pattern = prototype;
+        energy = prototypeEnergy;
+        int r = ones;
+        for (; r < n/2; r++) {
+            int gap = largestVoid();
+            toggle(gap, true);
+            rank[gap] = r;
+        }
+        //phase 3: the empty pixels are now the minority, so rank them by their own clusters
+        std::fill(energy.begin(), energy.end(), 0);
+        std::vector<char> empty(n);
+        for (int i = 0; i < n; i++) {
+            empty[i] = !pattern[i];
+        }
+        pattern = empty;
+        for (int i = 0; i < n; i++) {
+            if (pattern[i]) {
+                pattern[i] = false;
+                toggle(i, true);
+            }
+        }
+        for (; r < n; r++) {
+            int cluster = tightestCluster();
+            toggle(cluster, false);
+            rank[cluster] = r;
+        }
+
+        for (int i = 0; i < n; i++) {
+            values[i] = (rank[i] + 0.5f) / n;
+        }
+    }
+
+    std::vector<float> values;
+};
+
+//the same scrambled Sobol points in every pixel, each pixel rotated (Cranley-Patterson) by a blue noise mask
+//errors of neighbouring pixels are then anti-correlated, so the noise left at low sample counts is blue
+class BlueNoiseSampler : public Sampler {
+    public:
+    virtual shared_ptr<Sampler> clone() const override {
+        return make_shared<BlueNoiseSampler>(*this);
+    }
+
+    protected:
+    //each dimension reads the mask at its own toroidal offset
+    float maskValue(int dim) const {
+        uint32_t shift = hashUint(dim + 1);
+        return BlueNoiseMask::get().at(x + (shift & 63), y + ((shift >> 6) & 63));
+    }
+
+    static float rotate(float value, float offset) {
+        value += offset;
+        return value >= 1 ? value - 1 : value;
+    }
+
+    virtual float sample1D(int dim) override {
+        uint32_t seed = hashUint(dim);
+        uint32_t index = nestedUniformScramble(sampleIndex, seed);
+        return rotate(toUnitFloat(nestedUniformScramble(sobol(index, 0), hashCombine(seed, 0))), maskValue(dim));
+    }
+
+    virtual void sample2D(int dim, float& u, float& v) override {
+        uint32_t seed = hashUint(dim);
+        uint32_t index = nestedUniformScramble(sampleIndex, seed);
+        u = rotate(toUnitFloat(nestedUniformScramble(sobol(index, 0), hashCombine(seed, 0))), maskValue(dim));
+        v = rotate(toUnitFloat(nestedUniformScramble(sobol(index, 1), hashCombine(seed, 1))), maskValue(dim + 1));
+    }
+};
+
+enum class SamplerType { Independent, Stratified, Sobol, BlueNoise };
+
+//returns false if name isn't a sampler
+inline bool parseSamplerType(const std::string& name, SamplerType& type) {
+    if (name == "independent") type = SamplerType::Independent;
+    else if (name == "stratified") type = SamplerType::Stratified;
+    else if (name == "sobol") type = SamplerType::Sobol;
+    else if (name == "bluenoise") type = SamplerType::BlueNoise;
+    else return false;
+    return true;
+}
+
+shared_ptr<Sampler> makeSampler(SamplerType type, int samplesPerPixel) {
+    switch (type) {
+        case SamplerType::Independent:
+            return make_shared<IndependentSampler>();
+        case SamplerType::Stratified:
+            return make_shared<StratifiedSampler>(samplesPerPixel);
+        case SamplerType::BlueNoise:
+            return make_shared<BlueNoiseSampler>();
+        case SamplerType::Sobol:
+        default:
+            return make_shared<SobolSampler>();
+    }
+}
+
+#endif /* SAMPLER_HPP_*/
@@ -0,0 +1,598 @@
+#ifndef SCENECACHE_HPP_
+#define SCENECACHE_HPP_
+
+#include "./rtCommon.hpp"
+#include "./scenes.hpp"
+#include "./flatScene.hpp"
+#include "./material.hpp"
+#include "./texture.hpp"
+#include "./imageTexture.hpp"
+#include "./trace.hpp"
+#include "./perfCounters.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//a built scene written out as one binary file: its settings, textures and materials, every primitive in the
+//FlatScene's typed arrays and the FlatScene's BVH
+//loading maps the file and the FlatScene traces the primitive arrays, nodes and leaf refs where they lie in the
+//mapping, only the Geometry objects hit records and lights point at and the materials are made again (in one pass,
+//without the random numbers and BVH build the scene took the first time)
+//image textures are kept as their file names and decoded again
+
+const uint32_t sceneCacheVersion = 1;
+
+//what a scene was built from, a cache built from anything else is stale
+struct SceneCacheKey {
+    int32_t scene = 0;
+    int32_t lightCount = 0;
+    uint32_t seed = 0;
+    //texels per unit procedural textures were baked at, 0 if they weren't
+    float bakeDensity = 0;
+};
+
+enum class CacheSection : uint32_t { Info, Textures, Materials, Blob, Objects, Spheres, MovingSpheres, XYRects, XZRects,
+    ZYRects, Nodes, Refs, Count };
+
+const int cacheSectionCount = static_cast<int>(CacheSection::Count);
+
+struct SceneCacheHeader {
+    char magic[4] = {'R', 'T', 'S', 'C'};
+    uint32_t version = sceneCacheVersion;
+    //the SceneCacheKey and the build of the program that wrote the file
+    uint64_t key = 0;
+    //over everything after the header, so a truncated or damaged file isn't used
+    uint64_t contentHash = 0;
+    uint64_t contentBytes = 0;
+    //from the start of the file, 16 byte aligned
+    uint64_t offsets[cacheSectionCount] = {};
+    uint64_t sizes[cacheSectionCount] = {};
+};
+
+struct CachedSceneInfo {
+    Vector3 backgroundColor;
+    Vector3 lookfrom;
+    Vector3 lookat;
+    float vfov;
+    float aperture;
+    float aspectRatio;
+    int32_t width;
+    int32_t samplesPerPixel;
+};
+
+enum class CachedTextureType : uint32_t { Solid, Checker, Noise, Image, Baked };
+
+//textures come before any texture made from them
+struct CachedTexture {
+    CachedTextureType type;
+    //checker: the even and odd textures, baked: the texel grid's size
+    uint32_t first;
+    uint32_t second;
+    uint32_t wrapU;
+    float scale;
+    Vector3 color;
+    //noise: the perlin vectors and permutations, image: the file name, baked: the texels
+    uint64_t blobOffset;
+    uint64_t blobBytes;
+};
+
+struct CachedMaterial {
+    MaterialKind kind;
+    //lambertian albedo, light emission
+    uint32_t texture;
+    Vector3 albedo;
+    float fuzz;
+    float indexOfRefraction;
+};
+
+//one per object of the scene, in the scene's order
+struct CachedObject {
+    PrimitiveRef ref;
+    uint32_t material;
+};
+
+//FNV-1a over 64 bit words, then the bytes left over
+inline uint64_t hashWords(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, bytes + 8*i, 8);
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for (size_t i = words * 8; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t sceneCacheKeyHash(const SceneCacheKey& key) {
+    uint64_t hash = hashWords(14695981039346656037ull, &sceneCacheVersion, sizeof(sceneCacheVersion));
+    hash = hashWords(hash, &key, sizeof(key));
+    //the scenes are built by code compiled into the program, a rebuilt program may build them differently
+    const char build[] = __DATE__ " " __TIME__;
+    return hashWords(hash, build, sizeof(build));
+}
+
+//a file mapped read only, unmapped when the last FlatScene reading it is gone
+class MappedFile {
+    public:
+    MappedFile(const std::string& fileName) {
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                bytes = static_cast<const char*>(mapped);
+                size = info.st_size;
+            }
+        }
+        close(fd);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (bytes) {
+            munmap(const_cast<char*>(bytes), size);
+        }
+    }
+
+    const char* bytes = nullptr;
+    size_t size = 0;
+};
+
+//builds the file's sections from a scene and the FlatScene made from it
+class SceneCacheWriter {
+    public:
+    //false, with the reason in error, for scenes holding something the cache has no form for
+    bool write(const std::string& fileName, const Scene& scene, const FlatScene& flat, const SceneCacheKey& key) {
+        if (!flat.others.empty()) {
+            error = "the scene has primitives other than spheres and rectangles";
+            return false;
+        }
+        std::unordered_map<const Geometry*, PrimitiveRef> refs;
+        addRefs(refs, flat.spheres, PrimitiveType::Sphere);
+        addRefs(refs, flat.movingSpheres, PrimitiveType::MovingSphere);
+        addRefs(refs, flat.xyRects, PrimitiveType::XYRect);
+        addRefs(refs, flat.xzRects, PrimitiveType::XZRect);
+        addRefs(refs, flat.zyRects, PrimitiveType::ZYRect);
+        for (const auto& object : scene.objects.objects) {
+            auto found = refs.find(object.get());
+            if (found == refs.end()) {
+                error = "the scene's objects are nested";
+                return false;
+            }
+            uint32_t material = addMaterial(object->material().get());
+            if (!error.empty()) {
+                return false;
+            }
+            objects.push_back(CachedObject{found->second, material});
+        }
+
+        CachedSceneInfo info{scene.backgroundColor, scene.lookfrom, scene.lookat, scene.vfov, scene.aperture,
+            scene.aspectRatio, scene.width, scene.samplesPerPixel};
+        addSection(CacheSection::Info, &info, sizeof(info));
+        addSection(CacheSection::Textures, textures.data(), textures.size() * sizeof(CachedTexture));
+        addSection(CacheSection::Materials, materials.data(), materials.size() * sizeof(CachedMaterial));
+        addSection(CacheSection::Blob, blob.data(), blob.size());
+        addSection(CacheSection::Objects, objects.data(), objects.size() * sizeof(CachedObject));
+        addSection(CacheSection::Spheres, flat.spheres.data.data(), flat.spheres.data.size() * sizeof(SphereData));
+        addSection(CacheSection::MovingSpheres, flat.movingSpheres.data.data(), flat.movingSpheres.data.size() * sizeof(MovingSphereData));
+        addSection(CacheSection::XYRects, flat.xyRects.data.data(), flat.xyRects.data.size() * sizeof(RectData));
+        addSection(CacheSection::XZRects, flat.xzRects.data.data(), flat.xzRects.data.size() * sizeof(RectData));
+        addSection(CacheSection::ZYRects, flat.zyRects.data.data(), flat.zyRects.data.size() * sizeof(RectData));
+        addSection(CacheSection::Nodes, flat.nodes.data(), flat.nodes.size() * sizeof(FlatNode));
+        addSection(CacheSection::Refs, flat.refs.data(), flat.refs.size() * sizeof(PrimitiveRef));
+
+        header.key = sceneCacheKeyHash(key);
+        header.contentBytes = content.size();
+        header.contentHash = hashWords(14695981039346656037ull, content.data(), content.size());
+        //written next to the cache and renamed over it, so no other run ever maps half a file
+        std::string partial = fileName + ".partial";
+        std::ofstream file(partial, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(content.data(), content.size());
+        file.close();
+        if (!file || rename(partial.c_str(), fileName.c_str()) != 0) {
+            error = "could not write " + fileName;
+            remove(partial.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    std::string error;
+
+    private:
+    template <typename Data>
+    void addRefs(std::unordered_map<const Geometry*, PrimitiveRef>& refs, const PrimitiveArray<Data>& array, PrimitiveType type) {
+        for (size_t i = 0; i < array.sources.size(); i++) {
+            refs.emplace(array.sources[i], PrimitiveRef(type, i));
+        }
+    }
+
+    uint32_t addMaterial(const Material* material) {
+        auto found = materialIds.find(material);
+        if (found != materialIds.end()) {
+            return found->second;
+        }
+        CachedMaterial cached{};
+        cached.kind = material ? material->kind() : MaterialKind::Other;
+        switch (cached.kind) {
+            case MaterialKind::Lambertian:
+                cached.texture = addTexture(static_cast<const Lambertian*>(material)->albedo.get());
+                break;
+            case MaterialKind::Metal:
+                cached.albedo = static_cast<const Metal*>(material)->albedo;
+                cached.fuzz = static_cast<const Metal*>(material)->fuzz;
+                break;
+            case MaterialKind::Dielectric:
+                cached.indexOfRefraction = static_cast<const Dielectric*>(material)->indexOfRefraction;
+                break;
+            case MaterialKind::DiffuseLight:
+                cached.texture = addTexture(static_cast<const DiffuseLight*>(material)->emit.get());
+                break;
+            default:
+                error = "the scene has a material the cache can't store";
+                return 0;
+        }
+        materials.push_back(cached);
+        materialIds.emplace(material, materials.size() - 1);
+        return materials.size() - 1;
+    }
+
+    uint32_t addTexture(const Texture* texture) {
+        auto found = textureIds.find(texture);
+        if (found != textureIds.end()) {
+            return found->second;
+        }
+        CachedTexture cached{};
+        if (auto solid = dynamic_cast<const SolidColor*>(texture)) {
+            cached.type = CachedTextureType::Solid;
+            cached.color = solid->color();
+        } else if (auto checker = dynamic_cast<const CheckerTexture*>(texture)) {
+            cached.type = CachedTextureType::Checker;
+            cached.first = addTexture(checker->even.get());
+            cached.second = addTexture(checker->odd.get());
+        } else if (auto noise = dynamic_cast<const noiseTexture*>(texture)) {
+            cached.type = CachedTextureType::Noise;
+            cached.scale = noise->scale;
+            cached.blobOffset = blob.size();
+            addBlob(noise->noise.vectors(), PerlinNoise::pointCount * sizeof(Vector3));
+            for (int axis = 0; axis < 3; axis++) {
+                addBlob(noise->noise.permutation(axis), PerlinNoise::pointCount * sizeof(int));
+            }
+            cached.blobBytes = blob.size() - cached.blobOffset;
+        } else if (auto image = dynamic_cast<const ImageTexture*>(texture)) {
+            cached.type = CachedTextureType::Image;
+            cached.blobOffset = blob.size();
+            cached.blobBytes = image->fileName.size();
+            addBlob(image->fileName.data(), image->fileName.size());
+        } else if (auto baked = dynamic_cast<const BakedTexture*>(texture)) {
+            cached.type = CachedTextureType::Baked;
+            cached.first = baked->width;
+            cached.second = baked->height;
+            cached.wrapU = baked->wrapU;
+            cached.blobOffset = blob.size();
+            cached.blobBytes = baked->texels.size() * sizeof(Vector3);
+            addBlob(baked->texels.data(), cached.blobBytes);
+        } else {
+            error = "the scene has a texture the cache can't store";
+            return 0;
+        }
+        if (!error.empty()) {
+            return 0;
+        }
+        textures.push_back(cached);
+        textureIds.emplace(texture, textures.size() - 1);
+        return textures.size() - 1;
+    }
+
+    //blob entries start 16 byte aligned, so the loader can read them in place
+    void addBlob(const void* data, size_t size) {
+        blob.insert(blob.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+        blob.resize((blob.size() + 15) / 16 * 16);
+    }
+
+    void addSection(CacheSection section, const void* data, size_t size) {
+        int s = static_cast<int>(section);
+        header.offsets[s] = sizeof(header) + content.size();
+        header.sizes[s] = size;
+        content.insert(content.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+        content.resize((content.size() + 15) / 16 * 16);
+    }
+
+    SceneCacheHeader header;
+    std::vector<char> content;
+    std::vector<CachedTexture> textures;
+    std::vector<CachedMaterial> materials;
+    std::vector<CachedObject> objects;
+    std::vector<char> blob;
+    std::unordered_map<const Texture*, uint32_t> textureIds;
+    std::unordered_map<const Material*, uint32_t> materialIds;
+};
+
+//write scene and the FlatScene built from it to fileName, false with a message if it can't be cached
+bool saveSceneCache(const std::string& fileName, const Scene& scene, const FlatScene& flat, const SceneCacheKey& key) {
+    TraceScope trace("save scene cache", "setup");
+    SceneCacheWriter writer;
+    if (!writer.write(fileName, scene, flat, key)) {
+        std::cerr << "Scene not cached: " << writer.error << "\n";
+        return false;
+    }
+    return true;
+}
+
+//the sections of a mapped cache, checked against the file's size before anything reads them
+class SceneCacheReader {
+    public:
+    SceneCacheReader(shared_ptr<const MappedFile> file) : file(file) {}
+
+    bool valid(const SceneCacheKey& key) {
+        if (file->size < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, file->bytes, sizeof(header));
+        SceneCacheHeader expected;
+        if (memcmp(header.magic, expected.magic, sizeof(header.magic)) || header.version != sceneCacheVersion
+            || header.key != sceneCacheKeyHash(key) || header.contentBytes != file->size - sizeof(header)) {
+            return false;
+        }
+        for (int s = 0; s < cacheSectionCount; s++) {
+            if (header.offsets[s] % 16 || header.offsets[s] + header.sizes[s] > file->size) {
+                return false;
+            }
+        }
+        return hashWords(14695981039346656037ull, file->bytes + sizeof(header), header.contentBytes) == header.contentHash;
+    }
+
+    template <typename T>
+    const T* section(CacheSection section, size_t& count) const {
+        int s = static_cast<int>(section);
+        count = header.sizes[s] / sizeof(T);
+        return reinterpret_cast<const T*>(file->bytes + header.offsets[s]);
+    }
+
+    //a blob entry, null if it lies outside the blob
+    const char* blob(uint64_t offset, uint64_t bytes) const {
+        size_t size;
+        const char* blob = section<char>(CacheSection::Blob, size);
+        return offset + bytes <= size ? blob + offset : nullptr;
+    }
+
+    private:
+    shared_ptr<const MappedFile> file;
+    SceneCacheHeader header;
+};
+
+template <typename Rect>
+shared_ptr<Geometry> makeRect(const RectData& rect, shared_ptr<Material> material) {
+    return makeSceneObject<Rect>(rect.a0, rect.a1, rect.b0, rect.b1, rect.k, material);
+}
+
+//point one of the FlatScene's primitive arrays at the mapping, with no objects or materials yet
+template <typename Data>
+void viewPrimitives(PrimitiveArray<Data>& array, const SceneCacheReader& reader, CacheSection section) {
+    size_t count;
+    const Data* data = reader.section<Data>(section, count);
+    array.data.view(data, count);
+    array.sources.resize(count);
+    array.materials.resize(count);
+}
+
+//replace scene with the one cached in fileName and world with its FlatScene, false if there is no cache there or
+//it was built from something other than key, or by another build of this program
+bool loadSceneCache(const std::string& fileName, const SceneCacheKey& key, bool useArena, Scene& scene, shared_ptr<Geometry>& world) {
+    TraceScope trace("load scene cache", "setup");
+    PerfScope perf(PerfPhase::SceneBuild);
+    auto file = make_shared<const MappedFile>(fileName);
+    SceneCacheReader reader(file);
+    if (!file->bytes || !reader.valid(key)) {
+        return false;
+    }
+
+    Scene loaded;
+    if (useArena) {
+        loaded.arena = make_shared<SceneArena>();
+    }
+    ArenaScope scope(loaded.arena);
+    size_t count;
+    const CachedSceneInfo* info = reader.section<CachedSceneInfo>(CacheSection::Info, count);
+    if (count != 1) {
+        return false;
+    }
+    loaded.backgroundColor = info->backgroundColor;
+    loaded.lookfrom = info->lookfrom;
+    loaded.lookat = info->lookat;
+    loaded.vfov = info->vfov;
+    loaded.aperture = info->aperture;
+    loaded.aspectRatio = info->aspectRatio;
+    loaded.width = info->width;
+    loaded.samplesPerPixel = info->samplesPerPixel;
+
+    const CachedTexture* cachedTextures = reader.section<CachedTexture>(CacheSection::Textures, count);
+    std::vector<shared_ptr<Texture>> textures;
+    for (size_t i = 0; i < count; i++) {
+        const CachedTexture& cached = cachedTextures[i];
+        const char* blob = reader.blob(cached.blobOffset, cached.blobBytes);
+        if (!blob) {
+            return false;
+        }
+        switch (cached.type) {
+            case CachedTextureType::Solid:
+                textures.push_back(makeSceneObject<SolidColor>(cached.color));
+                break;
+            case CachedTextureType::Checker:
+                if (cached.first >= i || cached.second >= i) {
+                    return false;
+                }
+                textures.push_back(makeSceneObject<CheckerTexture>(textures[cached.first], textures[cached.second]));
+                break;
+            case CachedTextureType::Noise: {
+                const int points = PerlinNoise::pointCount;
+                if (cached.blobBytes != points * (sizeof(Vector3) + 3 * sizeof(int))) {
+                    return false;
+                }
+                const int* perms = reinterpret_cast<const int*>(blob + points * sizeof(Vector3));
+                textures.push_back(makeSceneObject<noiseTexture>(cached.scale, reinterpret_cast<const Vector3*>(blob),
+                    perms, perms + points, perms + 2*points));
+                break;
+            }
+            case CachedTextureType::Image:
+                textures.push_back(makeSceneObject<ImageTexture>(std::string(blob, cached.blobBytes).c_str()));
+                break;
+            case CachedTextureType::Baked: {
+                if (cached.blobBytes != size_t(cached.first) * cached.second * sizeof(Vector3)) {
+                    return false;
+                }
+                auto baked = makeSceneObject<BakedTexture>(cached.first, cached.second, cached.wrapU != 0);
+                memcpy(baked->texels.data(), blob, cached.blobBytes);
+                textures.push_back(baked);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    const CachedMaterial* cachedMaterials = reader.section<CachedMaterial>(CacheSection::Materials, count);
+    std::vector<shared_ptr<Material>> materials;
+    for (size_t i = 0; i < count; i++) {
+        const CachedMaterial& cached = cachedMaterials[i];
+        bool textured = cached.kind == MaterialKind::Lambertian || cached.kind == MaterialKind::DiffuseLight;
+        if (textured && cached.texture >= textures.size()) {
+            return false;
+        }
+        switch (cached.kind) {
+            case MaterialKind::Lambertian:
+                materials.push_back(makeSceneObject<Lambertian>(textures[cached.texture]));
+                break;
+            case MaterialKind::Metal:
+                materials.push_back(makeSceneObject<Metal>(cached.albedo, cached.fuzz));
+                break;
+            case MaterialKind::Dielectric:
+                materials.push_back(makeSceneObject<Dielectric>(cached.indexOfRefraction));
+                break;
+            case MaterialKind::DiffuseLight:
+                materials.push_back(makeSceneObject<DiffuseLight>(textures[cached.texture]));
+                break;
+            default:
+                return false;
+        }
+    }
+
+    auto flat = make_shared<FlatScene>();
+    flat->storage = file;
+    viewPrimitives(flat->spheres, reader, CacheSection::Spheres);
+    viewPrimitives(flat->movingSpheres, reader, CacheSection::MovingSpheres);
+    viewPrimitives(flat->xyRects, reader, CacheSection::XYRects);
+    viewPrimitives(flat->xzRects, reader, CacheSection::XZRects);
+    viewPrimitives(flat->zyRects, reader, CacheSection::ZYRects);
+    const FlatNode* nodes = reader.section<FlatNode>(CacheSection::Nodes, count);
+    flat->nodes.view(nodes, count);
+    const PrimitiveRef* refs = reader.section<PrimitiveRef>(CacheSection::Refs, count);
+    flat->refs.view(refs, count);
+
+    //the objects go back into the scene in their old order, which keeps light sampling as it was
+    const CachedObject* objects = reader.section<CachedObject>(CacheSection::Objects, count);
+    loaded.objects.objects.reserve(count);
+    size_t primitives = 0;
+    for (size_t i = 0; i < count; i++) {
+        const CachedObject& cached = objects[i];
+        if (cached.material >= materials.size()) {
+            return false;
+        }
+        const shared_ptr<Material>& material = materials[cached.material];
+        uint32_t index = cached.ref.index();
+        shared_ptr<Geometry> object;
+        switch (cached.ref.type()) {
+            case PrimitiveType::Sphere:
+                if (index >= flat->spheres.data.size()) {
+                    return false;
+                }
+                object = makeSceneObject<Sphere>(flat->spheres.data[index].center, flat->spheres.data[index].radius, material);
+                flat->spheres.sources[index] = object.get();
+                flat->spheres.materials[index] = material;
+                break;
+            case PrimitiveType::MovingSphere: {
+                if (index >= flat->movingSpheres.data.size()) {
+                    return false;
+                }
+                const MovingSphereData& s = flat->movingSpheres.data[index];
+                object = makeSceneObject<MovingSphere>(s.center0, s.center1, s.time0, s.time1, s.radius, material);
+                flat->movingSpheres.sources[index] = object.get();
+                flat->movingSpheres.materials[index] = material;
+                break;
+            }
+            case PrimitiveType::XYRect:
+                if (index >= flat->xyRects.data.size()) {
+                    return false;
+                }
+                object = makeRect<XYRect>(flat->xyRects.data[index], material);
+                flat->xyRects.sources[index] = object.get();
+                flat->xyRects.materials[index] = material;
+                break;
+            case PrimitiveType::XZRect:
+                if (index >= flat->xzRects.data.size()) {
+                    return false;
+                }
+                object = makeRect<XZRect>(flat->xzRects.data[index], material);
+                flat->xzRects.sources[index] = object.get();
+                flat->xzRects.materials[index] = material;
+                break;
+            case PrimitiveType::ZYRect:
+                if (index >= flat->zyRects.data.size()) {
+                    return false;
+                }
+                object = makeRect<ZYRect>(flat->zyRects.data[index], material);
+                flat->zyRects.sources[index] = object.get();
+                flat->zyRects.materials[index] = material;
+                break;
+            default:
+                return false;
+        }
+        loaded.objects.add(object);
+        primitives++;
+    }
+    //every primitive a leaf can reach has to have been made again
+    size_t total = flat->spheres.data.size() + flat->movingSpheres.data.size() + flat->xyRects.data.size()
+        + flat->xzRects.data.size() + flat->zyRects.data.size();
+    if (primitives != total) {
+        return false;
+    }
+    size_t sizes[] = {flat->spheres.data.size(), flat->movingSpheres.data.size(), flat->xyRects.data.size(),
+        flat->xzRects.data.size(), flat->zyRects.data.size()};
+    for (size_t i = 0; i < flat->refs.size(); i++) {
+        PrimitiveRef ref = flat->refs[i];
+        if (ref.type() >= PrimitiveType::Other || ref.index() >= sizes[static_cast<int>(ref.type())]) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < flat->nodes.size(); i++) {
+        const FlatNode& node = flat->nodes[i];
+        if (node.count == 0 ? node.offset <= i || node.offset >= flat->nodes.size() : size_t(node.offset) + node.count > flat->refs.size()) {
+            return false;
+        }
+    }
+
+    trace.arg("objects", count);
+    scene = std::move(loaded);
+    world = flat;
+    return true;
+}
+
+#endif /* SCENECACHE_HPP_*/
@@ -0,0 +1,353 @@
+#ifndef SCENES_HPP_
+#define SCENES_HPP_
+
+#include "./rtCommon.hpp"
+#include "./arena.hpp"
+#include "./trace.hpp"
+#include "./perfCounters.hpp"
+#include "./logeometry.hpp"
+#include "./sphere.hpp"
+#include "./movingSphere.hpp"
+#include "./XYRect.hpp"
+#include "./material.hpp"
+#include "./texture.hpp"
+#include "./imageTexture.hpp"
+#include "./camera.hpp"
+#include "./bvh.hpp"
+#include "./flatScene.hpp"
+
+//everything needed to render one of the built in scenes
+struct Scene {
+    LoGeometry objects;
+    Vector3 backgroundColor = Vector3(0, 0, 0);
+    Vector3 lookfrom = Vector3(13, 2, 3);
+    Vector3 lookat = Vector3(0, 0, 0);
+    float vfov = 40.0;
+    float aperture = 0.0;
+    float aspectRatio = 16.0 / 9.0;
+    //image width
+    int width = 400;
+    int samplesPerPixel = 100;
+    //where the scene's objects and its BVH are allocated, null if they were made with make_shared
+    shared_ptr<SceneArena> arena;
+
+    Camera camera() const {
+        return camera(lookfrom, lookat, vfov);
+    }
+
+    //camera with this scene's lens but a different placement
+    Camera camera(Vector3 from, Vector3 at, float fov) const {
+        Vector3 vup(0,1,0);
+        auto distToFocus = 10.0;
+        return Camera(from, at, vup, fov, aspectRatio, aperture, distToFocus, 0.0, 1.0);
+    }
+};
+
+//A random scene of spheres with different materials 
+LoGeometry randomScene() {
+    LoGeometry world;
+
+    auto groundMaterial = makeSceneObject<Lambertian>(Vector3(0.5, 0.5, 0.5));
+    
+    //checkered ground with constructor taking in the 2 colors 
+    auto checkeredGround = makeSceneObject<CheckerTexture>(Vector3(0.2, 0.3, 0.1), Vector3(0.9, 0.9, 0.9));
+    world.add(makeSceneObject<Sphere>(Vector3(0,-1000,0), 1000, makeSceneObject<Lambertian>(checkeredGround)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto chooseMat = randomNum();
+            Vector3 center(a + 0.9*randomNum(), 0.2, b + 0.9*randomNum());
+
+            if ((center - Vector3(4, 0.2, 0)).magnitude() > 0.9) {
+                shared_ptr<Material> sphereMaterial;
+
+                if (chooseMat < 0.8) {
+                    // diffuse
+                    auto albedo = randomVec() * randomVec();
+                    sphereMaterial = makeSceneObject<Lambertian>(albedo);
+                    auto center2 = center + Vector3(0, randomNum(0, 0.5), 0);
+                    world.add(makeSceneObject<MovingSphere>(center, center2, 0.0, 1.0, 0.2, sphereMaterial));
+                } else if (chooseMat < 0.95) {
+                    // metal
+                    auto albedo = randomVec(0.5, 1);
+                    auto fuzz = randomNum(0, 0.5);
+                    sphereMaterial = makeSceneObject<Metal>(albedo, fuzz);
+                    world.add(makeSceneObject<Sphere>(center, 0.2, sphereMaterial));
+                } else {
+                    // glass
+                    sphereMaterial = makeSceneObject<Dielectric>(1.5);
+                    world.add(makeSceneObject<Sphere>(center, 0.2, sphereMaterial));
+                }
+            }
+        }
+    }
+
+    auto material1 = makeSceneObject<Dielectric>(1.5);
+    world.add(makeSceneObject<Sphere>(Vector3(0, 1, 0), 1.0, material1));
+
+    auto material2 = makeSceneObject<Lambertian>(Vector3(0.4, 0.2, 0.1));
+    world.add(makeSceneObject<Sphere>(Vector3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = makeSceneObject<Metal>(Vector3(0.7, 0.6, 0.5), 0.0);
+    world.add(makeSceneObject<Sphere>(Vector3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+//A scene with 2 checkered Spheres
+LoGeometry checkeredSpheres(){
+    LoGeometry objects;
+
+    auto checkerTexture = makeSceneObject<CheckerTexture>(Vector3(0.2, 0.3, 0.1), Vector3(0.9, 0.9, 0.9));
+    objects.add(makeSceneObject<Sphere>(Vector3(0, -10, 0), 10, makeSceneObject<Lambertian>(checkerTexture)));
+    objects.add(makeSceneObject<Sphere>(Vector3(0, 10, 0), 10, makeSceneObject<Lambertian>(checkerTexture)));
+    return objects;
+}
+
+//A scene with two spheres
+LoGeometry perlinSpheres(){
+    LoGeometry objects;
+    auto perlinTexture = makeSceneObject<noiseTexture>(4);
+
+    objects.add(makeSceneObject<Sphere>(Vector3(0, -1000, 0), 1000, makeSceneObject<Lambertian>(perlinTexture)));
+    objects.add(makeSceneObject<Sphere>(Vector3(0, 2, 0), 2, makeSceneObject<Lambertian>(perlinTexture)));
+    return objects;
+}
+
+//A scene with projected image textures
+LoGeometry planetsTextures(){
+    auto jupiterTexture = makeSceneObject<ImageTexture>("src/imageTextures/jupiter.jpg");
+    auto jupiterSurface = makeSceneObject<Lambertian>(jupiterTexture);
+    auto sphere = makeSceneObject<Sphere>(Vector3(0, 0, 0), 2, jupiterSurface);
+
+    return LoGeometry(sphere);
+}
+
+//A scene with a rectangle acting as a light
+LoGeometry rectLight(){
+    LoGeometry objects;
+    auto perlinTexture = makeSceneObject<noiseTexture>(4);
+    objects.add(makeSceneObject<Sphere>(Vector3(0,-1000,0), 1000, makeSceneObject<Lambertian>(perlinTexture)));
+    objects.add(makeSceneObject<Sphere>(Vector3(0,2,0), 2, makeSceneObject<Lambertian>(perlinTexture)));
+
+    auto difflight = makeSceneObject<DiffuseLight>(Vector3(4,4,4));
+    objects.add(makeSceneObject<XYRect>(3, 5, 1, 3, -2, difflight));
+
+    return objects;
+}
+
+LoGeometry cornellBox() {
+    LoGeometry objects;
+
+    auto red   = makeSceneObject<Lambertian>(Vector3(.65, .05, .05));
+    auto white = makeSceneObject<Lambertian>(Vector3(.73, .73, .73));
+    auto green = makeSceneObject<Lambertian>(Vector3(.12, .45, .15));
+    auto light = makeSceneObject<DiffuseLight>(Vector3(15, 15, 15));
+
+    objects.add(makeSceneObject<ZYRect>(0, 555, 0, 555, 555, green));
+    objects.add(makeSceneObject<ZYRect>(0, 555, 0, 555, 0, red));
+    objects.add(makeSceneObject<XZRect>(213, 343, 227, 332, 554, light));
+    objects.add(makeSceneObject<XZRect>(0, 555, 0, 555, 0, white));
+    objects.add(makeSceneObject<XZRect>(0, 555, 0, 555, 555, white));
+    objects.add(makeSceneObject<XYRect>(0, 555, 0, 555, 555, white));
+
+    return objects;
+}
+
+//randomScene() with mostly low fuzz metal, lit by a few glowing spheres and one overhead panel
+//hard on both light sampling (glossy highlights) and material sampling (small lights)
+LoGeometry glossyScene() {
+    LoGeometry world;
+
+    auto checkeredGround = makeSceneObject<CheckerTexture>(Vector3(0.2, 0.3, 0.1), Vector3(0.9, 0.9, 0.9));
+    world.add(makeSceneObject<Sphere>(Vector3(0,-1000,0), 1000, makeSceneObject<Lambertian>(checkeredGround)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto chooseMat = randomNum();
+            Vector3 center(a + 0.9*randomNum(), 0.2, b + 0.9*randomNum());
+
+            if ((center - Vector3(4, 0.2, 0)).magnitude() > 0.9) {
+                shared_ptr<Material> sphereMaterial;
+
+                if (chooseMat < 0.25) {
+                    // diffuse
+                    sphereMaterial = makeSceneObject<Lambertian>(randomVec() * randomVec());
+                } else if (chooseMat < 0.9) {
+                    // glossy metal
+                    sphereMaterial = makeSceneObject<Metal>(randomVec(0.5, 1), randomNum(0.02, 0.2));
+                } else {
+                    // small light
+                    sphereMaterial = makeSceneObject<DiffuseLight>(randomVec(0.5, 1) * 8);
+                }
+                world.add(makeSceneObject<Sphere>(center, 0.2, sphereMaterial));
+            }
+        }
+    }
+
+    world.add(makeSceneObject<Sphere>(Vector3(0, 1, 0), 1.0, makeSceneObject<Metal>(Vector3(0.8, 0.8, 0.8), 0.05)));
+    world.add(makeSceneObject<Sphere>(Vector3(-4, 1, 0), 1.0, makeSceneObject<Metal>(Vector3(0.4, 0.2, 0.1), 0.15)));
+    world.add(makeSceneObject<Sphere>(Vector3(4, 1, 0), 1.0, makeSceneObject<Metal>(Vector3(0.7, 0.6, 0.5), 0.02)));
+    world.add(makeSceneObject<XZRect>(-2, 2, -2, 2, 6, makeSceneObject<DiffuseLight>(Vector3(6, 6, 6))));
+
+    return world;
+}
+
+//a field of count small glowing spheres floating around three large ones
+//the lights share a fixed total power, so the image stays about as bright whatever count is
+LoGeometry lightField(int count) {
+    LoGeometry world;
+
+    world.add(makeSceneObject<Sphere>(Vector3(0,-1000,0), 1000, makeSceneObject<Lambertian>(Vector3(0.5, 0.5, 0.5))));
+    world.add(makeSceneObject<Sphere>(Vector3(0, 1, 0), 1.0, makeSceneObject<Lambertian>(Vector3(0.73, 0.73, 0.73))));
+    world.add(makeSceneObject<Sphere>(Vector3(-4, 1, 0), 1.0, makeSceneObject<Lambertian>(Vector3(0.4, 0.2, 0.1))));
+    world.add(makeSceneObject<Sphere>(Vector3(4, 1, 0), 1.0, makeSceneObject<Metal>(Vector3(0.7, 0.6, 0.5), 0.1)));
+
+    //lights shrink as there get more of them, and get brighter to make up for their smaller area
+    float radius = fmin(0.2, 2 / sqrt(static_cast<float>(count)));
+    float brightness = 90 / (count * radius * radius);
+    for (int i = 0; i < count; i++) {
+        Vector3 center;
+        //scatter over a disk around the large spheres, staying clear of them
+        do {
+            float angle = randomNum(0, 2*pi);
+            float distance = 12 * sqrt(randomNum());
+            center = Vector3(distance*cos(angle), radius + randomNum(0, 3), distance*sin(angle));
+        } while ((center - Vector3(0, 1, 0)).magnitude() < 1.2 + radius
+              || (center - Vector3(-4, 1, 0)).magnitude() < 1.2 + radius
+              || (center - Vector3(4, 1, 0)).magnitude() < 1.2 + radius);
+        auto light = makeSceneObject<DiffuseLight>(randomVec(0.3, 1) * brightness);
+        world.add(makeSceneObject<Sphere>(center, radius, light));
+    }
+    return world;
+}
+
+//rectLight() lit by a ceiling of count small colored panels instead of its single panel
+//the panels cover the same fraction of the ceiling whatever count is, so the lighting stays about the same
+LoGeometry rectLightCeiling(int count) {
+    LoGeometry objects;
+    auto perlinTexture = makeSceneObject<noiseTexture>(4);
+    objects.add(makeSceneObject<Sphere>(Vector3(0,-1000,0), 1000, makeSceneObject<Lambertian>(perlinTexture)));
+    objects.add(makeSceneObject<Sphere>(Vector3(0,2,0), 2, makeSceneObject<Lambertian>(perlinTexture)));
+
+    //square grid over the sphere, out of the camera's view, each panel covering half its cell
+    int columns = std::max(1, static_cast<int>(sqrt(static_cast<float>(count))));
+    int rows = (count + columns - 1) / columns;
+    float cellWidth = 12.0 / columns;
+    float cellDepth = 12.0 / rows;
+    for (int i = 0; i < count; i++) {
+        float x0 = -6 + (i % columns) * cellWidth;
+        float z0 = -6 + (i / columns) * cellDepth;
+        auto light = makeSceneObject<DiffuseLight>(randomVec(0.3, 1) * 6);
+        objects.add(makeSceneObject<XZRect>(x0, x0 + cellWidth*0.7, z0, z0 + cellDepth*0.7, 7, light));
+    }
+    return objects;
+}
+
+//switch case to determine what scene to render
+//lightCount is the number of lights in scenes 8 and 9
+//useArena places every object the scene is made of in one arena instead of a heap allocation each
+Scene loadScene(int sceneNumber, int lightCount = 1000, bool useArena = true) {
+    TraceScope trace("build scene", "setup");
+    PerfScope perf(PerfPhase::SceneBuild);
+    trace.arg("scene", sceneNumber);
+    Scene scene;
+    if (useArena) {
+        scene.arena = make_shared<SceneArena>();
+    }
+    ArenaScope scope(scene.arena);
+    switch(sceneNumber){
+        case 1:
+            scene.objects = randomScene();
+            scene.backgroundColor = Vector3(0.70, 0.80, 1.00);
+            scene.lookfrom = Vector3(13, 2, 3);
+            scene.lookat = Vector3(0, 0, 0);
+            scene.vfov = 20.0;
+            scene.aperture = 0.1;
+            break;
+        case 2: 
+            scene.objects = checkeredSpheres();
+            scene.backgroundColor = Vector3(0.70, 0.80, 1.00);
+            scene.lookfrom = Vector3(13, 2, 3);
+            scene.lookat = Vector3(0, 0, 0);
+            scene.vfov = 20.0;
+            break;
+        case 3:
+            scene.objects = perlinSpheres();
+            scene.backgroundColor = Vector3(0.70, 0.80, 1.00);
+            scene.lookfrom = Vector3(13, 2, 3);
+            scene.lookat = Vector3(0, 0, 0);
+            scene.vfov = 20.0;
+            break;
+        case 4: 
+            scene.objects = planetsTextures();
+            scene.lookfrom = Vector3(13, 2, 3);
+            scene.lookat = Vector3(0, 0, 0);
+            scene.vfov = 20.0;
+            scene.backgroundColor = Vector3(0.70, 0.80, 1.00);
+            break;
+        case 5:
+            scene.objects = rectLight();
+            scene.samplesPerPixel = 800;
+            scene.backgroundColor = Vector3(0, 0, 0);
+            scene.lookfrom = Vector3(26, 3, 6);
+            scene.lookat = Vector3(0,2,0);
+            scene.vfov = 20.0;
+            break;
+        case 7:
+            scene.objects = glossyScene();
+            scene.backgroundColor = Vector3(0.02, 0.02, 0.03);
+            scene.lookfrom = Vector3(13, 2, 3);
+            scene.lookat = Vector3(0, 0, 0);
+            scene.vfov = 20.0;
+            break;
+        case 8:
+            scene.objects = lightField(lightCount);
+            scene.backgroundColor = Vector3(0, 0, 0);
+            scene.lookfrom = Vector3(0, 6, 18);
+            scene.lookat = Vector3(0, 0.5, 0);
+            scene.vfov = 40.0;
+            break;
+        case 9:
+            scene.objects = rectLightCeiling(lightCount);
+            scene.samplesPerPixel = 4;
+            scene.backgroundColor = Vector3(0, 0, 0);
+            scene.lookfrom = Vector3(26, 3, 6);
+            scene.lookat = Vector3(0,2,0);
+            scene.vfov = 20.0;
+            break;
+        case 6:
+        default:
+            scene.objects = cornellBox();
+            scene.aspectRatio = 1.0;
+            scene.width = 600;
+            scene.samplesPerPixel = 200;
+            scene.backgroundColor = Vector3(0, 0, 0);
+            scene.lookfrom = Vector3(278, 278, -800);
+            scene.lookat = Vector3(278, 278, 0);
+            scene.vfov = 40.0;
+            break;
+    }
+    return scene;
+}
+
+//what rays are traced against: scenes can hold many thousands of objects, don't test them one by one
+//a BVH only pays for itself past a handful of objects, the Cornell box renders faster without one
+//flat copies the primitives into a FlatScene, which needs no virtual calls or pointer chasing to trace
+//the BVH is built on threads threads, 0 for every hardware thread
+shared_ptr<Geometry> sceneHierarchy(const Scene& scene, bool flat = false, int threads = 0) {
+    TraceScope trace("build BVH", "setup");
+    PerfScope perf(PerfPhase::BVHBuild);
+    trace.arg("objects", scene.objects.objects.size());
+    if (flat) {
+        return make_shared<FlatScene>(scene.objects, threads);
+    }
+    if (scene.objects.objects.size() <= 16) {
+        return make_shared<LoGeometry>(scene.objects);
+    }
+    ArenaScope scope(scene.arena);
+    LoGeometry objects = scene.objects;
+    return makeSceneObject<BVHNode>(objects, 0.0, 1.0, threads);
+}
+
+#endif /* SCENES_HPP_*/
@@ -1,13 +1,27 @@
 #ifndef SPHERE_HPP_
 #define SPHERE_HPP_
 #include "./geometry.hpp"
+#include "./material.hpp"
+#include "./stats.hpp"
 
 class Sphere: public Geometry {
     public:
     Sphere(){}
     Sphere(Vector3 c, float r, shared_ptr<Material> m) : center(c), radius(r), matPtr(m){};
-    virtual bool hit(const Ray& ray, float tmin, float tmax, hitRecord& rec) const override;
+    virtual bool closestHit(const Ray& ray, float tmin, float tmax, HitCandidate& candidate) const override;
+    virtual void surfaceHit(const Ray& ray, const HitCandidate& candidate, hitRecord& rec) const override;
     virtual bool boundingBox(float t0, float t1, AABB& outputBox) const override;
+    virtual shared_ptr<Material> material() const override { return matPtr; }
+    virtual bool sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const override;
+    virtual float directionPdf(const Vector3& origin, const Vector3& direction) const override;
+    virtual float surfaceArea() const override { return 4*pi*radius*radius; }
+    virtual bool surfacePoint(float u, float v, Vector3& p) const override;
+    virtual void surfaceExtent(float& uLength, float& vLength, bool& wrapU) const override {
+        uLength = 2*pi*radius;
+        vLength = pi*radius;
+        wrapU = true;
+    }
+    virtual void setMaterial(shared_ptr<Material> m) override { matPtr = m; }
     Vector3 center;
     float radius;
     shared_ptr<Material> matPtr;
@@ -20,7 +34,16 @@ void getSphereUV(const Vector3& p, float& u, float& v){
     v = (theta + pi/2) / pi;
 }
 
-bool Sphere::hit(const Ray& ray, float tmin, float tmax, hitRecord& rec) const {
+//the inverse of getSphereUV
+bool Sphere::surfacePoint(float u, float v, Vector3& p) const {
+    float phi = (1-u)*2*pi - pi;
+    float theta = v*pi - pi/2;
+    p = center + Vector3(cos(theta)*cos(phi), sin(theta), cos(theta)*sin(phi)) * radius;
+    return true;
+}
+
+bool Sphere::closestHit(const Ray& ray, float tmin, float tmax, HitCandidate& candidate) const {
+    RT_COUNT(SphereTests);
     // return quadratic equation dot(B, B)*t^2 + 2*dot(B, A-C)*t + dot(A-C, A-C) - Radius*Radius = 0
     // where discriminant is b^2 - 4ac from form at^2 + bt + c = 0 
     Vector3 A = ray.origin();
@@ -37,36 +60,37 @@ bool Sphere::hit(const Ray& ray, float tmin, float tmax, hitRecord& rec) const {
         //quadratic equation is: (-b+-√b^2-4ac) / 2a
         //Let’s assume the closest hit point (smallest t), so we only subtract the discriminant
         float root = (-b - sqrt(discriminant)) / (2.0*a);
-        if (root < tmax && root > tmin) {
-            rec.t = root;
-            rec.p = ray.pointAtParameter(rec.t);
-            //Add surface side determination 
-            rec.normal = (rec.p - center) / radius;
-            rec.setFaceNormal(ray, rec.normal);
-            //record UV coordinates
-            getSphereUV((rec.p - center)/radius, rec.u, rec.v);
-            //record material of this sphere
-            rec.matPtr = matPtr;
-            return true;
+        if (!(root < tmax && root > tmin)) {
+            //the second root based on quadratic equation
+            root = (-b + sqrt(discriminant)) / (2.0*a);
         }
-        //the second root based on quadratic equation
-        root = (-b + sqrt(discriminant)) / (2.0*a);
         if (root < tmax && root > tmin) {
-            rec.t = root;
-            rec.p = ray.pointAtParameter(rec.t);
-            //Add surface side determination 
-            rec.normal = (rec.p - center) / radius;
-            rec.setFaceNormal(ray, rec.normal);
-            //record UV coordinates
-            getSphereUV((rec.p - center)/radius, rec.u, rec.v);
-            //record material of this sphere
-            rec.matPtr = matPtr;
+            candidate.t = root;
+            candidate.object = this;
             return true;
         }
     }
     return false;
 }
 
+void Sphere::surfaceHit(const Ray& ray, const HitCandidate& candidate, hitRecord& rec) const {
+    rec.t = candidate.t;
+    rec.p = ray.pointAtParameter(rec.t);
+    //Add surface side determination 
+    rec.normal = (rec.p - center) / radius;
+    rec.setFaceNormal(ray, rec.normal);
+    //record UV coordinates, the atan2 and asin are skipped for materials that never look them up
+    if (matPtr->needsUV()) {
+        getSphereUV((rec.p - center)/radius, rec.u, rec.v);
+    } else {
+        rec.u = 0;
+        rec.v = 0;
+    }
+    //record material of this sphere
+    rec.matPtr = matPtr;
+    rec.object = this;
+}
+
 bool Sphere::boundingBox(float t0, float t1, AABB& outputBox) const{
     outputBox = AABB(center - Vector3(radius, radius, radius),
     center + Vector3(radius, radius, radius));
@@ -74,4 +98,47 @@ bool Sphere::boundingBox(float t0, float t1, AABB& outputBox) const{
 }
 
 
+//1 - cosine of the half angle of the cone the sphere covers as seen from origin, or -1 if origin is inside
+//written as sin^2 / (1 + cos), so it stays accurate for small, distant spheres where the cosine rounds to 1
+inline float sphereConeOneMinusCosine(const Vector3& center, float radius, const Vector3& origin) {
+    float distanceSquared = (center - origin).vecLengthSquared();
+    if (distanceSquared <= radius*radius) {
+        return -1;
+    }
+    float sinSquared = radius*radius / distanceSquared;
+    return sinSquared / (1 + sqrt(1 - sinSquared));
+}
+
+//uniformly sample the cone of directions that hit the sphere
+bool Sphere::sampleDirection(const Vector3& origin, float u1, float u2, Vector3& direction, float& pdf) const {
+    float oneMinusCosMax = sphereConeOneMinusCosine(center, radius, origin);
+    if (oneMinusCosMax <= 0) {
+        return false;
+    }
+    float oneMinusCosTheta = u1*oneMinusCosMax;
+    float cosTheta = 1 - oneMinusCosTheta;
+    float sinTheta = sqrt(fmax(0.0f, oneMinusCosTheta*(2 - oneMinusCosTheta)));
+    float phi = 2*pi*u2;
+    Vector3 axis = unitVector(center - origin);
+    Vector3 tangent, bitangent;
+    orthonormalBasis(axis, tangent, bitangent);
+    direction = tangent*(sinTheta*cos(phi)) + bitangent*(sinTheta*sin(phi)) + axis*cosTheta;
+    pdf = 1 / (2*pi*oneMinusCosMax);
+    return true;
+}
+
+float Sphere::directionPdf(const Vector3& origin, const Vector3& direction) const {
+    float oneMinusCosMax = sphereConeOneMinusCosine(center, radius, origin);
+    if (oneMinusCosMax <= 0) {
+        return 0;
+    }
+    //inside the cone if the line along direction passes within radius of the center
+    Vector3 unitDirection = unitVector(direction);
+    Vector3 toCenter = center - origin;
+    if (unitDirection.dotProduct(toCenter) <= 0 || unitDirection.crossProduct(toCenter).vecLengthSquared() > radius*radius) {
+        return 0;
+    }
+    return 1 / (2*pi*oneMinusCosMax);
+}
+
 #endif /* SPHERE_HPP_*/
\ No newline at end of file
@@ -0,0 +1,153 @@
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+//counters for the hot paths of rendering: rays, BVH nodes, primitive tests and material samples
+//they only exist when compiled with -DRT_STATS, otherwise every RT_COUNT macro compiles to nothing
+//each thread counts into its own block, which is added to the totals when the thread ends, so counting is
+//a plain increment with no sharing between threads
+
+#ifdef RT_STATS
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+enum class StatCounter {
+    CameraRays,
+    //rays traced after the first hit, along material samples
+    BounceRays,
+    ShadowRays,
+    AABBTests,
+    BVHNodeVisits,
+    SphereTests,
+    MovingSphereTests,
+    XYRectTests,
+    XZRectTests,
+    ZYRectTests,
+    LambertianSamples,
+    MetalSamples,
+    DielectricSamples,
+    //materials that never scatter, such as lights
+    AbsorbingSamples,
+    Count
+};
+
+inline const char* statCounterName(StatCounter counter) {
+    static const char* names[] = {"camera rays", "bounce rays", "shadow rays", "AABB tests", "BVH node visits",
+        "sphere tests", "moving sphere tests", "XY rect tests", "XZ rect tests", "ZY rect tests",
+        "Lambertian samples", "Metal samples", "Dielectric samples", "absorbing material samples"};
+    return names[static_cast<int>(counter)];
+}
+
+struct RenderStats {
+    static const int depthBins = 64;
+    uint64_t counters[static_cast<int>(StatCounter::Count)] = {};
+    //rays traced at each depth of a path, 0 being the camera ray, the last bin holds every deeper one too
+    //how many paths ended at each depth follows from it
+    uint64_t raysAtDepth[depthBins] = {};
+
+    void add(const RenderStats& other) {
+        for (int i = 0; i < static_cast<int>(StatCounter::Count); i++) {
+            counters[i] += other.counters[i];
+        }
+        for (int i = 0; i < depthBins; i++) {
+            raysAtDepth[i] += other.raysAtDepth[i];
+        }
+    }
+
+    uint64_t operator[](StatCounter counter) const {
+        return counters[static_cast<int>(counter)];
+    }
+};
+
+//what finished threads counted
+inline RenderStats& totalStats() {
+    static RenderStats totals;
+    return totals;
+}
+
+inline std::mutex& totalStatsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+//a thread's counters, added to the totals when the thread exits
+struct ThreadStats {
+    RenderStats stats;
+
+    ~ThreadStats() {
+        flush();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(totalStatsMutex());
+        totalStats().add(stats);
+        stats = RenderStats();
+    }
+};
+
+inline ThreadStats& threadStats() {
+    thread_local ThreadStats local;
+    return local;
+}
+
+#define RT_COUNT(counter) (threadStats().stats.counters[static_cast<int>(StatCounter::counter)]++)
+#define RT_COUNT_N(counter, n) (threadStats().stats.counters[static_cast<int>(StatCounter::counter)] += (n))
+//n rays traced at path depth
+#define RT_COUNT_DEPTH(depth, n) (threadStats().stats.raysAtDepth[std::min<int>((depth), RenderStats::depthBins - 1)] += (n))
+
+//print everything counted so far, the calling thread's counts included
+inline void printStats(std::ostream& out) {
+    threadStats().flush();
+    RenderStats stats;
+    {
+        std::lock_guard<std::mutex> lock(totalStatsMutex());
+        stats = totalStats();
+    }
+    out << "\nRender statistics:\n";
+    for (int i = 0; i < static_cast<int>(StatCounter::Count); i++) {
+        if (stats.counters[i] > 0) {
+            out << "  " << std::left << std::setw(28) << statCounterName(static_cast<StatCounter>(i))
+                << std::right << std::setw(14) << stats.counters[i] << "\n";
+        }
+    }
+
+    uint64_t rays = stats[StatCounter::CameraRays] + stats[StatCounter::BounceRays] + stats[StatCounter::ShadowRays];
+    uint64_t primitiveTests = stats[StatCounter::SphereTests] + stats[StatCounter::MovingSphereTests]
+        + stats[StatCounter::XYRectTests] + stats[StatCounter::XZRectTests] + stats[StatCounter::ZYRectTests];
+    if (rays > 0) {
+        out << "  per ray: " << double(stats[StatCounter::BVHNodeVisits]) / rays << " BVH nodes, "
+            << double(stats[StatCounter::AABBTests]) / rays << " AABB tests, "
+            << double(primitiveTests) / rays << " primitive tests\n";
+    }
+
+    int deepest = 0;
+    for (int i = 0; i < RenderStats::depthBins; i++) {
+        if (stats.raysAtDepth[i] > 0) {
+            deepest = i;
+        }
+    }
+    if (stats.raysAtDepth[0] > 0) {
+        //a path ends at depth i if it traced a ray there but none deeper
+        out << "  depth      rays at depth    paths ending there\n";
+        for (int i = 0; i <= deepest; i++) {
+            uint64_t ending = stats.raysAtDepth[i] - (i + 1 < RenderStats::depthBins ? stats.raysAtDepth[i + 1] : 0);
+            out << "    " << std::setw(2) << i << (i == RenderStats::depthBins - 1 ? "+" : " ")
+                << std::setw(16) << stats.raysAtDepth[i] << std::setw(16) << ending << "  "
+                << std::string(static_cast<int>(40.0 * ending / stats.raysAtDepth[0] + 0.5), '#') << "\n";
+        }
+    }
+}
+
+#else
+
+#define RT_COUNT(counter) ((void)0)
+#define RT_COUNT_N(counter, n) ((void)0)
+#define RT_COUNT_DEPTH(depth, n) ((void)0)
+
+#endif /* RT_STATS */
+
+#endif /* STATS_HPP_*/
@@ -2,11 +2,21 @@
 #define TEXTURE_HPP_
 #include "./rtCommon.hpp"
 #include "./perlinNoise.hpp"
+#include "./arena.hpp"
+#include <vector>
 
 class Texture {
     public:
         //Vector3 in this case represents color
         virtual Vector3 value(float u, float v, const Vector3&p) const = 0;
+        //computed from the hit point on every lookup, worth baking into a texel grid (bake.hpp)
+        virtual bool isProcedural() const {
+            return false;
+        }
+        //false if value() ignores u and v
+        virtual bool needsUV() const {
+            return true;
+        }
 };
 
 class SolidColor : public Texture {
@@ -20,6 +30,14 @@ class SolidColor : public Texture {
         return colorValue;
     }
 
+    virtual bool needsUV() const override {
+        return false;
+    }
+
+    Vector3 color() const {
+        return colorValue;
+    }
+
     private:
     Vector3 colorValue;
 };
@@ -32,7 +50,16 @@ class CheckerTexture : public Texture {
     CheckerTexture(shared_ptr<Texture> t0, shared_ptr<Texture> t1): even(t0), odd(t1) {}
 
     CheckerTexture(Vector3 color1, Vector3 color2) 
-        :even(make_shared<SolidColor>(color1)), odd(make_shared<SolidColor>(color2)){}
+        :even(makeSceneObject<SolidColor>(color1)), odd(makeSceneObject<SolidColor>(color2)){}
+
+    virtual bool isProcedural() const override {
+        return true;
+    }
+
+    //the checks come from p, only the textures in them might read u and v
+    virtual bool needsUV() const override {
+        return even->needsUV() || odd->needsUV();
+    }
 
     virtual Vector3 value(float u, float v, const Vector3& p) const override {
         auto sines = sin(10.0*p.getX())*sin(10.0*p.getY())*sin(10.0*p.getZ());
@@ -54,6 +81,17 @@ class CheckerTexture : public Texture {
         public: 
         noiseTexture(){}
         noiseTexture(float s) : scale(s){}
+        //with the noise's random vectors and permutations given instead of drawn
+        noiseTexture(float s, const Vector3* vectors, const int* permX, const int* permY, const int* permZ)
+            : noise(vectors, permX, permY, permZ), scale(s){}
+
+        virtual bool isProcedural() const override {
+            return true;
+        }
+
+        virtual bool needsUV() const override {
+            return false;
+        }
 
         virtual Vector3 value(float u, float v, const Vector3& p) const override {
             //ensure perlin output value is between 0 and 1 (not negative)
@@ -65,4 +103,39 @@ class CheckerTexture : public Texture {
          float scale;
     };
 
+//a texture evaluated once per texel of a uv grid, looked up with bilinear filtering
+//u wraps around for closed surfaces like spheres, v is clamped
+class BakedTexture : public Texture {
+    public:
+    BakedTexture(int w, int h, bool wrap) : width(w), height(h), wrapU(wrap), texels(w*h) {}
+
+    virtual Vector3 value(float u, float v, const Vector3& p) const override {
+        //texel centers sit at (i + 0.5) / width
+        float x = u*width - 0.5f;
+        float y = v*height - 0.5f;
+        int x0 = static_cast<int>(floor(x));
+        int y0 = static_cast<int>(floor(y));
+        float fx = x - x0;
+        float fy = y - y0;
+        int x1 = x0 + 1;
+        int y1 = y0 + 1;
+        if (wrapU) {
+            x0 = (x0 % width + width) % width;
+            x1 = (x1 % width + width) % width;
+        } else {
+            x0 = x0 < 0 ? 0 : (x0 >= width ? width - 1 : x0);
+            x1 = x1 < 0 ? 0 : (x1 >= width ? width - 1 : x1);
+        }
+        y0 = y0 < 0 ? 0 : (y0 >= height ? height - 1 : y0);
+        y1 = y1 < 0 ? 0 : (y1 >= height ? height - 1 : y1);
+        return (texels[y0*width + x0]*(1-fx) + texels[y0*width + x1]*fx)*(1-fy)
+            + (texels[y1*width + x0]*(1-fx) + texels[y1*width + x1]*fx)*fy;
+    }
+
+    int width;
+    int height;
+    bool wrapU;
+    std::vector<Vector3> texels;
+};
+
 #endif /* TEXTURE_HPP_*/
\ No newline at end of file
@@ -0,0 +1,122 @@
+#ifndef THREADING_HPP_
+#define THREADING_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//run work(row) for every row of an image on a group of threads
+template <typename Work>
+void forEachRow(int height, int threadCount, Work work) {
+    std::atomic<int> nextRow(0);
+    auto worker = [&]() {
+        for (int y = nextRow++; y < height; y = nextRow++) {
+            work(y);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+//threads started once and given one batch of work after another, for work that comes in many small parallel
+//passes, where starting threads for every pass would cost more than the pass
+class ThreadPool {
+    public:
+    //threads counts the calling thread, which works on every batch too
+    explicit ThreadPool(int threads) {
+        for (int i = 1; i < threads; i++) {
+            workers.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //run work(i) for every i in [0, n) and return once all of them are done, not to be called from inside work
+    template <typename Work>
+    void forEach(size_t n, Work work) {
+        if (workers.empty() || n <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                work(i);
+            }
+            return;
+        }
+        std::function<void(size_t)> task = [&](size_t i) { work(i); };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &task;
+            count = n;
+            next = 0;
+            busy = workers.size();
+            batch++;
+        }
+        wake.notify_all();
+        drain();
+        //task lives on this stack, every worker has to be done with it
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return busy == 0; });
+        current = nullptr;
+    }
+
+    private:
+    void drain() {
+        for (size_t i = next++; i < count; i = next++) {
+            (*current)(i);
+        }
+    }
+
+    void run() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || batch != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = batch;
+            }
+            drain();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    //the batch being worked on: its work, its size and the next index to hand out
+    const std::function<void(size_t)>* current = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next{0};
+    //workers that haven't finished the current batch
+    size_t busy = 0;
+    uint64_t batch = 0;
+    bool stopping = false;
+};
+
+#endif /* THREADING_HPP_*/
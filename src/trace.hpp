@@ -0,0 +1,176 @@
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+//timeline of what every thread was doing, written as a Chrome trace (open it in chrome://tracing or ui.perfetto.dev)
+//tracing is off until startTrace(), after that a TraceScope costs two clock reads and a write into the
+//ring buffer of its own thread, so threads never wait on each other to record
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//one finished scope, names are string literals so recording never allocates
+struct TraceEvent {
+    static const int maxArgs = 4;
+    const char* name;
+    const char* category;
+    //nanoseconds since startTrace()
+    int64_t start;
+    int64_t duration;
+    int argCount;
+    const char* argNames[maxArgs];
+    int64_t argValues[maxArgs];
+};
+
+//the events of one thread, once full the oldest are overwritten
+struct TraceBuffer {
+    TraceBuffer(int id, size_t capacity) : id(id), events(capacity) {}
+
+    void push(const TraceEvent& event) {
+        events[written % events.size()] = event;
+        written++;
+    }
+
+    int id;
+    std::string name;
+    std::vector<TraceEvent> events;
+    size_t written = 0;
+};
+
+struct TraceState {
+    std::atomic<bool> enabled{false};
+    std::chrono::steady_clock::time_point origin;
+    size_t capacity = 1 << 16;
+    std::mutex mutex;
+    //kept here so the events of threads that have ended can still be written
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+};
+
+inline TraceState& traceState() {
+    static TraceState state;
+    return state;
+}
+
+inline bool traceEnabled() {
+    return traceState().enabled.load(std::memory_order_relaxed);
+}
+
+inline int64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceState().origin).count();
+}
+
+//this thread's buffer, made on the first event the thread records
+inline TraceBuffer& threadTraceBuffer() {
+    thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (!buffer) {
+        TraceState& state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        buffer = std::make_shared<TraceBuffer>(static_cast<int>(state.buffers.size()), state.capacity);
+        buffer->name = buffer->id == 0 ? "main" : "worker " + std::to_string(buffer->id);
+        state.buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+//start recording, eventsPerThread is the size of each thread's ring buffer
+inline void startTrace(size_t eventsPerThread = 1 << 16) {
+    TraceState& state = traceState();
+    state.origin = std::chrono::steady_clock::now();
+    state.capacity = eventsPerThread;
+    state.enabled = true;
+    //the thread starting the trace is listed first
+    threadTraceBuffer();
+}
+
+//records the time from its construction to its destruction as one event
+class TraceScope {
+    public:
+    TraceScope(const char* name, const char* category = "render") {
+        if (traceEnabled()) {
+            event.name = name;
+            event.category = category;
+            event.argCount = 0;
+            event.start = traceNow();
+            active = true;
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    ~TraceScope() {
+        if (active) {
+            event.duration = traceNow() - event.start;
+            threadTraceBuffer().push(event);
+        }
+    }
+
+    //a number shown with the event, name must be a string literal
+    void arg(const char* name, int64_t value) {
+        if (active && event.argCount < TraceEvent::maxArgs) {
+            event.argNames[event.argCount] = name;
+            event.argValues[event.argCount] = value;
+            event.argCount++;
+        }
+    }
+
+    private:
+    TraceEvent event;
+    bool active = false;
+};
+
+//write everything recorded to fileName in the Chrome trace event format
+//traced work should be finished, buffers of threads still running are read as they are
+inline bool writeTrace(const std::string& fileName) {
+    TraceState& state = traceState();
+    std::ofstream file(fileName);
+    if (!file) {
+        std::cerr << "Error: could not open " << fileName << " for writing\n";
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    size_t dropped = 0;
+    bool first = true;
+    auto separator = [&]() -> std::ofstream& {
+        file << (first ? "\n" : ",\n");
+        first = false;
+        return file;
+    };
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (const auto& buffer : state.buffers) {
+        separator() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+            << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+        size_t capacity = buffer->events.size();
+        size_t count = std::min(buffer->written, capacity);
+        dropped += buffer->written - count;
+        for (size_t i = buffer->written - count; i < buffer->written; i++) {
+            const TraceEvent& event = buffer->events[i % capacity];
+            //timestamps are in microseconds
+            separator() << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"ts\":" << event.start / 1000 << "." << event.start % 1000 / 100
+                << ",\"dur\":" << event.duration / 1000 << "." << event.duration % 1000 / 100;
+            if (event.argCount > 0) {
+                file << ",\"args\":{";
+                for (int a = 0; a < event.argCount; a++) {
+                    file << (a ? "," : "") << "\"" << event.argNames[a] << "\":" << event.argValues[a];
+                }
+                file << "}";
+            }
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+    if (dropped > 0) {
+        std::cerr << "Trace buffers overflowed, the oldest " << dropped << " events were dropped\n";
+    }
+    return static_cast<bool>(file);
+}
+
+#endif /* TRACE_HPP_*/
@@ -235,5 +235,52 @@ Vector3 randomFromUnitLookfrom(){
     }
 }
 
+//build tangent and bitangent so (tangent, bitangent, n) is an orthonormal basis, n must be unit length
+//(Duff et al. 2017, "Building an Orthonormal Basis, Revisited")
+inline void orthonormalBasis(const Vector3& n, Vector3& tangent, Vector3& bitangent) {
+    float sign = copysignf(1.0f, n.getZ());
+    float a = -1.0f / (sign + n.getZ());
+    float b = n.getX() * n.getY() * a;
+    tangent = Vector3(1.0f + sign * n.getX() * n.getX() * a, sign * b, -sign * n.getX());
+    bitangent = Vector3(b, sign + n.getY() * n.getY() * a, -n.getY());
+}
+
+//direction around axis with pdf proportional to cos(angle to axis)^exponent, from two uniform samples
+//exponent 1 is the cosine weighted hemisphere a lambertian surface scatters into
+inline Vector3 sampleCosinePowerLobe(const Vector3& axis, float exponent, float u1, float u2) {
+    float cosTheta = pow(1 - u1, 1.0f / (exponent + 1));
+    float sinTheta = sqrt(fmax(0.0f, 1 - cosTheta*cosTheta));
+    float phi = 2*pi*u2;
+    Vector3 tangent, bitangent;
+    orthonormalBasis(axis, tangent, bitangent);
+    return tangent*(sinTheta*cos(phi)) + bitangent*(sinTheta*sin(phi)) + axis*cosTheta;
+}
+
+//pdf (per solid angle) of sampleCosinePowerLobe choosing direction
+inline float cosinePowerLobePdf(const Vector3& axis, float exponent, const Vector3& direction) {
+    float cosTheta = axis.dotProduct(direction);
+    return cosTheta > 0 ? (exponent + 1) / (2*pi) * pow(cosTheta, exponent) : 0;
+}
+
+//map two uniform samples to a point on the unit disk (Shirley-Chiu concentric mapping)
+//keeps the samples' stratification, unlike rejection sampling
+Vector3 sampleUnitDisk(float u1, float u2) {
+    float a = 2*u1 - 1;
+    float b = 2*u2 - 1;
+    if (a == 0 && b == 0) {
+        return Vector3(0, 0, 0);
+    }
+    float r, theta;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        theta = (pi/4) * (b/a);
+    }
+    else {
+        r = b;
+        theta = pi/2 - (pi/4) * (a/b);
+    }
+    return Vector3(r*cos(theta), r*sin(theta), 0);
+}
+
 #endif /* VEC3_HPP_ */
 
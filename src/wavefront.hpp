@@ -0,0 +1,383 @@
+#ifndef WAVEFRONT_HPP_
+#define WAVEFRONT_HPP_
+
+#include "./rtCommon.hpp"
+#include "./geometry.hpp"
+#include "./material.hpp"
+#include "./camera.hpp"
+#include "./frameBuffer.hpp"
+#include "./sampler.hpp"
+#include "./lights.hpp"
+#include "./render.hpp"
+#include "./threading.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+//wavefront path tracing: instead of following one path from the camera to its end before starting the next,
+//a large batch of paths (a wave) moves through the integrator one stage at a time
+//  generate:   camera rays for every sample of a block of pixels
+//  intersect:  closest hit of every active ray
+//  shade:      emission, a light sample (queued as a shadow ray) and a material sample (queued as the next ray),
+//              with the hits bucketed by material so each kind of material is shaded in one devirtualized run
+//  shadow:     visibility of every queued light sample
+//  accumulate: sum each pixel's samples
+//each stage is a tight loop over structure of arrays queues, run on every render thread
+//paths are traced exactly as colorMIS() (or color() for the path integrator) would, with the same sample
+//dimensions, so deterministic samplers give the same image as the recursive integrators
+
+//the paths still being traced, one entry per path, each field in its own array
+struct PathQueue {
+    //which camera sample of the wave the path belongs to
+    std::vector<int32_t> slot;
+    std::vector<Vector3> origin;
+    std::vector<Vector3> direction;
+    std::vector<Vector3> throughput;
+    //how the ray was chosen, to weight any light it hits
+    std::vector<uint8_t> fromDelta;
+    std::vector<float> bsdfPdf;
+    std::vector<Vector3> previousPoint;
+    std::vector<float> time;
+    int size = 0;
+
+    void resize(int capacity) {
+        slot.resize(capacity);
+        origin.resize(capacity);
+        direction.resize(capacity);
+        throughput.resize(capacity);
+        fromDelta.resize(capacity);
+        bsdfPdf.resize(capacity);
+        previousPoint.resize(capacity);
+        time.resize(capacity);
+    }
+};
+
+//light samples waiting for a visibility test
+struct ShadowQueue {
+    std::vector<int32_t> slot;
+    std::vector<Vector3> origin;
+    std::vector<Vector3> direction;
+    std::vector<float> time;
+    std::vector<const Geometry*> light;
+    //what reaches the camera if the light is visible, before its emission
+    std::vector<Vector3> contribution;
+    int size = 0;
+
+    void resize(int capacity) {
+        slot.resize(capacity);
+        origin.resize(capacity);
+        direction.resize(capacity);
+        time.resize(capacity);
+        light.resize(capacity);
+        contribution.resize(capacity);
+    }
+};
+
+//run work(begin, end) over [0, count) in chunks, on a group of threads
+template <typename Work>
+void forEachChunk(int count, int threadCount, Work work) {
+    const int chunkSize = 1024;
+    forEachRow((count + chunkSize - 1) / chunkSize, threadCount, [&](int chunk) {
+        work(chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+    });
+}
+
+void renderFrameWavefront(const Geometry& scene, const LightList& lights, const Camera& cam, const RenderSettings& settings,
+    FrameBuffer& image, AuxBuffers* aux) {
+    int width = settings.width;
+    int height = settings.height;
+    if (image.width != width || image.height != height) {
+        image = FrameBuffer(width, height);
+    }
+    if (aux && (aux->albedo.width != width || aux->albedo.height != height)) {
+        *aux = AuxBuffers(width, height);
+    }
+
+    int threadCount = renderThreadCount(settings);
+    int spp = settings.samplesPerPixel;
+    bool nextEvent = settings.integrator != Integrator::Path;
+    int pixelCount = width * height;
+    //a wave is every sample of a block of pixels, about a quarter million paths
+    int wavePixels = std::max(1, std::min(pixelCount, settings.wavefrontPaths / spp));
+    int waveSize = wavePixels * spp;
+    int waveCount = (pixelCount + wavePixels - 1) / wavePixels;
+
+    PathQueue paths, nextPaths;
+    paths.resize(waveSize);
+    nextPaths.resize(waveSize);
+    ShadowQueue shadows;
+    shadows.resize(waveSize);
+    std::vector<hitRecord> hits(waveSize);
+    std::vector<uint8_t> didHit(waveSize);
+    //what each path hit: 0 for a miss, otherwise its MaterialKind + 1
+    const int materialBuckets = static_cast<int>(MaterialKind::DiffuseLight) + 2;
+    std::vector<uint8_t> kinds(waveSize);
+    //the order the shading stage visits paths in
+    std::vector<int> order(waveSize);
+    std::vector<Vector3> radiance(waveSize);
+    std::vector<FirstHit> firstHits(aux ? waveSize : 0);
+    auto prototype = makeSampler(settings.samplerType, spp);
+    long long rays = 0;
+    auto start = std::chrono::steady_clock::now();
+    //seconds spent intersecting, shading (bucketing included) and testing shadow rays
+    double stageSeconds[3] = {0, 0, 0};
+    auto stageStart = start;
+    auto endStage = [&](int stage) {
+        auto now = std::chrono::steady_clock::now();
+        stageSeconds[stage] += std::chrono::duration<double>(now - stageStart).count();
+        stageStart = now;
+    };
+
+    for (int wave = 0; wave < waveCount; wave++) {
+        int firstPixel = wave * wavePixels;
+        int samples = std::min(wavePixels, pixelCount - firstPixel) * spp;
+        TraceScope trace("wave");
+        trace.arg("samples", samples);
+
+        //generate
+        forEachChunk(samples, threadCount, [&](int begin, int end) {
+            auto sampler = prototype->clone();
+            for (int i = begin; i < end; i++) {
+                int pixel = firstPixel + i / spp;
+                int x = pixel % width;
+                int y = pixel / width;
+                sampler->startSample(x, y, i % spp);
+                float jitterX, jitterY;
+                sampler->get2D(jitterX, jitterY);
+                Ray r = cam.getRay((x + jitterX) / (width - 1), (height - 1 - y + jitterY) / (height - 1), *sampler);
+                paths.slot[i] = i;
+                paths.origin[i] = r.origin();
+                paths.direction[i] = r.direction();
+                paths.throughput[i] = Vector3(1, 1, 1);
+                paths.fromDelta[i] = true;
+                paths.bsdfPdf[i] = 0;
+                paths.time[i] = r.getTime();
+                radiance[i] = Vector3(0, 0, 0);
+            }
+        });
+        paths.size = samples;
+
+        for (int depth = 0; depth < settings.maxDepth && paths.size > 0; depth++) {
+            rays += paths.size;
+            if (depth == 0) {
+                RT_COUNT_N(CameraRays, paths.size);
+            } else {
+                RT_COUNT_N(BounceRays, paths.size);
+            }
+            RT_COUNT_DEPTH(depth, paths.size);
+            stageStart = std::chrono::steady_clock::now();
+
+            //intersect
+            forEachChunk(paths.size, threadCount, [&](int begin, int end) {
+                PerfScope perf(PerfPhase::Intersect);
+                for (int i = begin; i < end; i++) {
+                    Ray r(paths.origin[i], paths.direction[i], paths.time[i]);
+                    didHit[i] = scene.hit(r, 0.01, infinity, hits[i]);
+                    kinds[i] = didHit[i] ? static_cast<uint8_t>(hits[i].matPtr->kind()) + 1 : 0;
+                }
+            });
+
+            endStage(0);
+
+            //bucket the paths by what they hit (misses first, then one bucket per kind of material), so shading
+            //runs one material's code over many hits in a row instead of jumping between materials
+            if (settings.sortByMaterial) {
+                int bucketStart[materialBuckets + 1] = {};
+                for (int i = 0; i < paths.size; i++) {
+                    bucketStart[kinds[i] + 1]++;
+                }
+                for (int k = 1; k <= materialBuckets; k++) {
+                    bucketStart[k] += bucketStart[k - 1];
+                }
+                for (int i = 0; i < paths.size; i++) {
+                    order[bucketStart[kinds[i]]++] = i;
+                }
+            } else {
+                for (int i = 0; i < paths.size; i++) {
+                    order[i] = i;
+                }
+            }
+
+            //shade, compacting the paths that go on into nextPaths
+            std::atomic<int> nextCount(0);
+            std::atomic<int> shadowCount(0);
+            forEachChunk(paths.size, threadCount, [&](int begin, int end) {
+                auto sampler = prototype->clone();
+                PerfScope perf(PerfPhase::Shade);
+                std::vector<int> survivors;
+                //material comes in as its concrete type, and the concrete materials are final, so every call on it
+                //below is direct (and can be inlined), only materials of unknown kind go through the vtable
+                //once the hits are bucketed, the switch that picks the type takes the same branch for long runs
+                auto shade = [&](int i, const auto& material) {
+                    int slot = paths.slot[i];
+                    Ray r(paths.origin[i], paths.direction[i], paths.time[i]);
+                    const Vector3& throughput = paths.throughput[i];
+                    const hitRecord& rec = hits[i];
+                    if (depth == 0 && aux) {
+                        recordFirstHit(r, rec, firstHits[slot]);
+                    }
+
+                    if (!nextEvent) {
+                        radiance[slot] += throughput * material.emitted(rec.u, rec.v, rec.p);
+                    } else if (material.isEmissive()) {
+                        Vector3 emitted = material.emitted(rec.u, rec.v, rec.p);
+                        if (paths.fromDelta[i]) {
+                            radiance[slot] += throughput * emitted;
+                        } else {
+                            float lightPdf = lights.pdf(paths.previousPoint[i], r.direction(), rec.object);
+                            radiance[slot] += throughput * emitted * misWeight(settings.heuristic, paths.bsdfPdf[i], lightPdf);
+                        }
+                    }
+
+                    int pixel = firstPixel + slot / spp;
+                    sampler->resumeSample(pixel % width, pixel / width, slot % spp, depth);
+                    if (nextEvent) {
+                        float lightChoice = lights.empty() ? 0 : sampler->get1D();
+                        float lightU1 = 0, lightU2 = 0;
+                        if (!lights.empty()) {
+                            sampler->get2D(lightU1, lightU2);
+                        }
+                        LightSample lightSample;
+                        if (!material.isSpecular(rec) && lights.sample(rec.p, lightChoice, lightU1, lightU2, lightSample)) {
+                            Vector3 f = material.eval(r, rec, lightSample.direction);
+                            if (f.vecLengthSquared() > 0) {
+                                float weight = misWeight(settings.heuristic, lightSample.pdf, material.pdf(r, rec, lightSample.direction));
+                                int s = shadowCount++;
+                                shadows.slot[s] = slot;
+                                shadows.origin[s] = rec.p;
+                                shadows.direction[s] = lightSample.direction;
+                                shadows.time[s] = paths.time[i];
+                                shadows.light[s] = lightSample.light;
+                                shadows.contribution[s] = throughput * f * (weight / lightSample.pdf);
+                            }
+                        }
+                    }
+
+                    BSDFSample bsdfSample;
+                    if (!material.sample(r, rec, *sampler, bsdfSample)) {
+                        return;
+                    }
+                    //this path's slot in paths is free again, keep what goes on here until its place in nextPaths is known
+                    paths.throughput[i] = throughput * bsdfSample.weight;
+                    paths.fromDelta[i] = bsdfSample.isDelta;
+                    paths.bsdfPdf[i] = bsdfSample.pdf;
+                    paths.previousPoint[i] = rec.p;
+                    paths.origin[i] = rec.p;
+                    paths.direction[i] = bsdfSample.direction;
+                    survivors.push_back(i);
+                };
+
+                for (int k = begin; k < end; k++) {
+                    int i = order[k];
+                    if (!didHit[i]) {
+                        if (depth == 0 && aux) {
+                            recordMiss(settings.backgroundColor, firstHits[paths.slot[i]]);
+                        }
+                        radiance[paths.slot[i]] += paths.throughput[i] * settings.backgroundColor;
+                        continue;
+                    }
+                    const Material& material = *hits[i].matPtr;
+                    switch (material.kind()) {
+                        case MaterialKind::Lambertian:
+                            shade(i, static_cast<const Lambertian&>(material));
+                            break;
+                        case MaterialKind::Metal:
+                            shade(i, static_cast<const Metal&>(material));
+                            break;
+                        case MaterialKind::Dielectric:
+                            shade(i, static_cast<const Dielectric&>(material));
+                            break;
+                        case MaterialKind::DiffuseLight:
+                            shade(i, static_cast<const DiffuseLight&>(material));
+                            break;
+                        case MaterialKind::Other:
+                            shade(i, material);
+                            break;
+                    }
+                }
+                int out = nextCount.fetch_add(survivors.size());
+                for (int i : survivors) {
+                    nextPaths.slot[out] = paths.slot[i];
+                    nextPaths.origin[out] = paths.origin[i];
+                    nextPaths.direction[out] = paths.direction[i];
+                    nextPaths.throughput[out] = paths.throughput[i];
+                    nextPaths.fromDelta[out] = paths.fromDelta[i];
+                    nextPaths.bsdfPdf[out] = paths.bsdfPdf[i];
+                    nextPaths.previousPoint[out] = paths.previousPoint[i];
+                    nextPaths.time[out] = paths.time[i];
+                    out++;
+                }
+            });
+            shadows.size = shadowCount;
+            nextPaths.size = nextCount;
+
+            endStage(1);
+
+            //shadow: the light is visible if the shadow ray's first hit is the light itself
+            //a path has at most one light sample per bounce, so no two entries add to the same slot
+            rays += shadows.size;
+            RT_COUNT_N(ShadowRays, shadows.size);
+            forEachChunk(shadows.size, threadCount, [&](int begin, int end) {
+                PerfScope perf(PerfPhase::Shadow);
+                for (int s = begin; s < end; s++) {
+                    hitRecord shadowRec;
+                    Ray shadowRay(shadows.origin[s], shadows.direction[s], shadows.time[s]);
+                    if (lightVisible(scene, *shadows.light[s], shadowRay, shadowRec)) {
+                        Vector3 emitted = shadowRec.matPtr->emitted(shadowRec.u, shadowRec.v, shadowRec.p);
+                        radiance[shadows.slot[s]] += shadows.contribution[s] * emitted;
+                    }
+                }
+            });
+            endStage(2);
+            std::swap(paths, nextPaths);
+        }
+
+        //accumulate, adding each pixel's samples in order as renderPixel does
+        forEachChunk(samples / spp, threadCount, [&](int begin, int end) {
+            for (int p = begin; p < end; p++) {
+                int pixel = firstPixel + p;
+                Vector3 col(0, 0, 0);
+                Vector3 albedo(0, 0, 0);
+                Vector3 normal(0, 0, 0);
+                float depth = 0;
+                float lumSquared = 0;
+                for (int s = p * spp; s < (p + 1) * spp; s++) {
+                    col += radiance[s];
+                    if (aux) {
+                        albedo += firstHits[s].albedo;
+                        normal += firstHits[s].normal;
+                        depth += firstHits[s].distance;
+                        lumSquared += luminance(radiance[s]) * luminance(radiance[s]);
+                    }
+                }
+                col /= spp;
+                image.pixels[pixel] = col;
+                if (aux) {
+                    aux->albedo.pixels[pixel] = albedo / spp;
+                    aux->normal.pixels[pixel] = normal / spp;
+                    aux->depth[pixel] = depth / spp;
+                    float meanLum = luminance(col);
+                    aux->variance[pixel] = spp > 1 ? std::max(0.0f, lumSquared / spp - meanLum*meanLum) / (spp - 1) : 0;
+                }
+            }
+        });
+
+        if (settings.progress) {
+            settings.progress->store(float(wave + 1) / waveCount);
+        }
+        if (settings.showProgress) {
+            std::cerr << "\rWaves remaining: " << waveCount - wave - 1 << ' ' << std::flush;
+        }
+    }
+
+    if (settings.showProgress) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cerr << "\nTraced " << rays << " rays (" << rays / elapsed.count() / 1e6 << " Mrays/s), intersect "
+            << stageSeconds[0] << "s, shade " << stageSeconds[1] << "s, shadow " << stageSeconds[2] << "s";
+    }
+}
+
+#endif /* WAVEFRONT_HPP_*/